@@ -108,7 +108,80 @@ if test "$PHP_SPHINX" != "no"; then
 
   CPPFLAGS=$_SAVE_CPPFLAGS
 
+  dnl the results cache writes the private values pool of sphinx_result, check it reads back
+  _SAVE_CFLAGS=$CFLAGS
+  _SAVE_LIBS=$LIBS
+  CFLAGS="$CFLAGS -I$SPHINX_DIR/include"
+  LIBS="$LIBS -L$SPHINX_DIR/$PHP_LIBDIR -l$LIBNAME -lm"
+  AC_CACHE_CHECK([for the libsphinxclient result layout], ac_cv_sphinx_result_layout,
+    [AC_TRY_RUN([#include <string.h>
+#include <sphinxclient.h>
+union attr_value {
+  sphinx_int64_t int_value;
+  float float_value;
+  unsigned int *mva_value;
+  const char *string;
+};
+int main() {
+  union attr_value pool[5];
+  unsigned int mva[2] = {1, 42};
+  int types[3] = {SPH_ATTR_INTEGER, SPH_ATTR_FLOAT, SPH_ATTR_MULTI | SPH_ATTR_INTEGER};
+  sphinx_result result;
+
+  memset(&result, 0, sizeof(result));
+  result.num_attrs = 3;
+  result.attr_types = types;
+  result.num_matches = 1;
+  result.values_pool = pool;
+  pool[0].int_value = 7;
+  pool[1].int_value = 3;
+  pool[2].int_value = 5;
+  pool[3].float_value = 1.5f;
+  pool[4].mva_value = mva;
+
+  return !(sphinx_get_id(&result, 0) == 7 && sphinx_get_weight(&result, 0) == 3
+    && sphinx_get_int(&result, 0, 0) == 5 && sphinx_get_float(&result, 0, 1) == 1.5f
+    && sphinx_get_mva(&result, 0, 2) == mva);
+}
+    ], ac_cv_sphinx_result_layout=yes, ac_cv_sphinx_result_layout=no, ac_cv_sphinx_result_layout=no)])
+  if test "$ac_cv_sphinx_result_layout" = yes; then
+    AC_DEFINE(HAVE_SPHINX_RESULT_LAYOUT,1,[Whether the results cache can rebuild libsphinxclient results])
+  fi
+  CFLAGS=$_SAVE_CFLAGS
+  LIBS=$_SAVE_LIBS
+
+  dnl sendQueries() runs the blocking libsphinxclient calls in a separate thread
+  AC_CHECK_HEADERS([pthread.h poll.h], [], [sphinx_no_threads=yes])
+  if test "x$sphinx_no_threads" != "xyes"; then
+    AC_CHECK_FUNC(pthread_create, [
+      AC_DEFINE(HAVE_SPHINX_THREADS,1,[Whether background queries are supported])
+    ], [
+      PHP_CHECK_LIBRARY(pthread, pthread_create, [
+        PHP_ADD_LIBRARY(pthread,, SPHINX_SHARED_LIBADD)
+        AC_DEFINE(HAVE_SPHINX_THREADS,1,[Whether background queries are supported])
+      ])
+    ])
+  fi
+
+  dnl the shared results cache lives in an anonymous shared mapping guarded by pid-stamped spinlocks
+  AC_CACHE_CHECK([for shared results cache support], ac_cv_sphinx_shm,
+    [AC_TRY_LINK([#include <sys/types.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>], [
+      pid_t lock = 0;
+      void *p = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+      while (!__sync_bool_compare_and_swap(&lock, 0, getpid())) if (kill(lock, 0) < 0) sched_yield();
+      __sync_lock_release(&lock);
+      return p == MAP_FAILED;
+    ], ac_cv_sphinx_shm=yes, ac_cv_sphinx_shm=no)])
+  if test "$ac_cv_sphinx_shm" = yes; then
+    AC_DEFINE(HAVE_SPHINX_SHM,1,[Whether the shared results cache is supported])
+  fi
+
   PHP_SUBST(SPHINX_SHARED_LIBADD)
 
   PHP_NEW_EXTENSION(sphinx, sphinx.c, $ext_shared)
+  PHP_ADD_EXTENSION_DEP(sphinx, spl)
 fi
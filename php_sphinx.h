@@ -30,10 +30,35 @@ extern zend_module_entry sphinx_module_entry;
 #endif
 
 PHP_MINIT_FUNCTION(sphinx);
+PHP_MSHUTDOWN_FUNCTION(sphinx);
 PHP_MINFO_FUNCTION(sphinx);
 
 #define PHP_SPHINX_VERSION "1.3.3"
 
+ZEND_BEGIN_MODULE_GLOBALS(sphinx)
+	long pool_max_idle;
+	long pool_idle_timeout;
+	long pool_ping_interval;
+	HashTable backends; /* "host:port" => php_sphinx_backend */
+	long cache_size; /* bytes */
+	HashTable cache; /* encoded request => php_sphinx_cache_entry */
+	struct _php_sphinx_cache_entry *cache_head; /* most recently used */
+	struct _php_sphinx_cache_entry *cache_tail;
+	size_t cache_bytes;
+	long cache_hits;
+	long cache_misses;
+	long cache_evictions;
+	long shm_cache_size; /* bytes, mapped in MINIT */
+	long shm_cache_stale; /* seconds an expired entry is served while one worker refreshes it */
+	HashTable templates; /* prepare()'d settings by name */
+ZEND_END_MODULE_GLOBALS(sphinx)
+
+#ifdef ZTS
+# define SPHINX_G(v) TSRMG(sphinx_globals_id, zend_sphinx_globals *, v)
+#else
+# define SPHINX_G(v) (sphinx_globals.v)
+#endif
+
 #endif	/* PHP_SPHINX_H */
 
 /*
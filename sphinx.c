@@ -27,20 +27,145 @@
 #include "php_ini.h"
 #include "ext/standard/info.h"
 #include "ext/standard/file.h"
+#include "ext/standard/php_smart_str.h"
+#include "ext/standard/php_rand.h"
+#include "ext/standard/md5.h"
+#include "ext/standard/crc32.h"
 #include "zend_operators.h"
+#include "zend_interfaces.h"
+#include "zend_exceptions.h"
+#include "ext/spl/spl_iterators.h"
 #include "php_sphinx.h"
 
 #include <sphinxclient.h>
+#include <ctype.h>
+
+#ifdef HAVE_SPHINX_THREADS
+# include <pthread.h>
+# include <poll.h>
+# include <errno.h>
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#ifdef HAVE_SPHINX_SHM
+# include <sys/mman.h>
+# include <sys/types.h>
+# include <sched.h>
+# include <signal.h>
+# include <errno.h>
+# include <unistd.h>
+#endif
+
+ZEND_DECLARE_MODULE_GLOBALS(sphinx)
 
 static zend_class_entry *ce_sphinx_client;
+static zend_class_entry *ce_sphinx_result;
+#ifdef HAVE_SPHINX_THREADS
+static zend_class_entry *ce_sphinx_multi;
+#endif
 
 static zend_object_handlers php_sphinx_client_handlers;
+static zend_object_handlers php_sphinx_result_handlers;
 static zend_object_handlers cannot_be_cloned;
 
+typedef struct _php_sphinx_results_ref {
+	sphinx_client *sphinx;
+	struct _php_sphinx_cached *cached; /* the results came from the cache, sphinx is NULL then */
+	int refcount; /* the client and its results objects */
+	zend_bool owned; /* the handle is not the client's anymore */
+} php_sphinx_results_ref;
+
+/* results thawed from the cache, the cached data follows the header */
+typedef struct _php_sphinx_cached {
+	int num_results;
+	sphinx_result *results;
+} php_sphinx_cached;
+
+#define php_sphinx_cached_free(cached) do { efree((cached)->results); efree(cached); } while (0)
+
+/* exportConfig() data starts with this, the ops are encoded differently 
+   depending on the libsphinxclient the extension was built with */
+typedef struct _php_sphinx_config_header {
+	char magic[4];
+	int version;
+	int build;
+	unsigned int crc;
+} php_sphinx_config_header;
+
+#define PHP_SPHINX_CONFIG_MAGIC "SPHC"
+#define PHP_SPHINX_CONFIG_VERSION 1
+#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
+# define PHP_SPHINX_CONFIG_BUILD (LIBSPHINX_VERSION_ID | 0x10000)
+#else
+# define PHP_SPHINX_CONFIG_BUILD LIBSPHINX_VERSION_ID
+#endif
+
+/* settings frozen by prepare(), encoded with php_sphinx_ops_encode() */
+typedef struct _php_sphinx_template {
+	char *data;
+	size_t len;
+} php_sphinx_template;
+
+typedef struct _php_sphinx_server {
+	char *host;
+	long port;
+	long weight;
+} php_sphinx_server;
+
+#ifdef HAVE_SPHINX_THREADS
+struct _php_sphinx_job;
+
+#define PHP_SPHINX_LATENCY_SAMPLES 32
+#define PHP_SPHINX_LATENCY_MIN_SAMPLES 8
+#define PHP_SPHINX_DEFAULT_HEDGE_DELAY 0.1
+#endif
+
+/* every successful setter call is recorded as an op, so that the settings 
+   can be re-applied to another libsphinxclient handle (i.e. a pooled one) */
+typedef struct _php_sphinx_op {
+	int code;
+	smart_str buf;
+	struct _php_sphinx_op *next;
+} php_sphinx_op;
+
 typedef struct _php_sphinx_client {
 	zend_object std;
 	sphinx_client *sphinx;
 	zend_bool array_result;
+	int result_format;
+	php_sphinx_results_ref *results_ref; /* the results in the handle are used by SphinxResult objects */
+	php_sphinx_cached *cached; /* the last results came from the cache */
+	long cache_ttl; /* seconds, 0 to bypass the cache */
+	php_sphinx_op *ops;
+	unsigned int applied; /* mask of ops ever applied to the handle */
+	char *host;
+	long port;
+	zend_bool persistent;
+	zend_bool failed;
+	php_sphinx_server *servers; /* backends set by setServers() */
+	int num_servers;
+	int backend; /* the backend the handle was pointed to by the failover, -1 for the configured server */
+	double connect_timeout;
+	long max_query_time;
+	double deadline; /* seconds per query() or runQueries(), 0 for none */
+	zend_bool auto_batch; /* query() queues the query and returns a deferred SphinxResult */
+	zend_bool compact_filters; /* setFilter() sorts and deduplicates the values and makes ranges of the runs */
+	HashTable *scalar_attrs; /* attributes declared to hold one value per document, NULL for none */
+	zval **deferred; /* the deferred results waiting for the queued queries to run */
+	int num_deferred;
+#ifdef HAVE_SPHINX_THREADS
+	struct _php_sphinx_job *job; /* queries sent by sendQueries() */
+	php_sphinx_server *replicas;
+	int num_replicas;
+	int replica; /* the replica the handle talks to */
+	double hedge_delay; /* seconds, negative to use the tracked p95 */
+	double latency[PHP_SPHINX_LATENCY_SAMPLES];
+	int num_latency;
+#endif
 } php_sphinx_client;
 
 #ifdef COMPILE_DL_SPHINX
@@ -51,1027 +176,7356 @@ ZEND_GET_MODULE(sphinx)
 #define E_RECOVERABLE_ERROR E_WARNING
 #endif
 
+#if PHP_VERSION_ID < 50300
+#define array_init_size(arg, size) array_init(arg)
+#endif
+
 #define SPHINX_CONST(name) REGISTER_LONG_CONSTANT(#name, name, CONST_CS | CONST_PERSISTENT)
 
 #define SPHINX_INITIALIZED(c) \
 		if (!(c) || !(c)->sphinx) { \
 			php_error_docref(NULL TSRMLS_CC, E_WARNING, "using uninitialized SphinxClient object"); \
 			RETURN_FALSE; \
-		}
+		} \
+		php_sphinx_client_wait(c);
+
+#define PHP_SPHINX_DEFAULT_HOST "localhost"
+#define PHP_SPHINX_DEFAULT_PORT 9312
+
+/* result formats, SPH_RESULT_COLUMNAR returns one list per attribute instead of an array per match, 
+   SPH_RESULT_LAZY returns SphinxResult objects */
+#define SPH_RESULT_ROWS 0
+#define SPH_RESULT_COLUMNAR 1
+#define SPH_RESULT_LAZY 2
+#define PHP_SPHINX_RESULT_META -1 /* everything but the matches */
+
+/* {{{ settings ops */
+enum {
+	PHP_SPHINX_OP_SERVER = 0,
+	PHP_SPHINX_OP_CONNECT_TIMEOUT,
+	PHP_SPHINX_OP_LIMITS,
+	PHP_SPHINX_OP_MATCH_MODE,
+	PHP_SPHINX_OP_INDEX_WEIGHTS,
+	PHP_SPHINX_OP_SELECT,
+	PHP_SPHINX_OP_ID_RANGE,
+	PHP_SPHINX_OP_FILTER,
+	PHP_SPHINX_OP_FILTER_STRING,
+	PHP_SPHINX_OP_FILTER_RANGE,
+	PHP_SPHINX_OP_FILTER_FLOAT_RANGE,
+	PHP_SPHINX_OP_GEO_ANCHOR,
+	PHP_SPHINX_OP_GROUP_BY,
+	PHP_SPHINX_OP_GROUP_DISTINCT,
+	PHP_SPHINX_OP_RETRIES,
+	PHP_SPHINX_OP_MAX_QUERY_TIME,
+	PHP_SPHINX_OP_RANKING_MODE,
+	PHP_SPHINX_OP_FIELD_WEIGHTS,
+	PHP_SPHINX_OP_SORT_MODE,
+	PHP_SPHINX_OP_OVERRIDE,
+	PHP_SPHINX_OP_RESET_FILTERS,
+	PHP_SPHINX_OP_RESET_GROUPBY,
+	PHP_SPHINX_OP_ADD_QUERY,
+	PHP_SPHINX_OP_LAST
+};
 
-static void php_sphinx_client_obj_dtor(void *object TSRMLS_DC) /* {{{ */
+#define PHP_SPHINX_OP_BIT(code) (1U << (code))
+
+#define PHP_SPHINX_OPS_FILTERS (PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_FILTER) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_FILTER_STRING) | \
+								PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_FILTER_RANGE) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_FILTER_FLOAT_RANGE) | \
+								PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_RESET_FILTERS))
+
+#define PHP_SPHINX_OPS_GROUPBY (PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_GROUP_BY) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_GROUP_DISTINCT) | \
+								PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_RESET_GROUPBY))
+
+/* settings tied to the connection rather than to the queries */
+#define PHP_SPHINX_OPS_CONNECTION (PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_SERVER) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_CONNECT_TIMEOUT))
+
+/* settings libsphinxclient has no way to reset to the defaults */
+#define PHP_SPHINX_OPS_NO_RESET (PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_MATCH_MODE) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_INDEX_WEIGHTS) | \
+								 PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_GEO_ANCHOR) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_FIELD_WEIGHTS))
+
+/* ops appended to the list instead of replacing the previous value */
+#define PHP_SPHINX_OPS_APPEND (PHP_SPHINX_OPS_FILTERS | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_OVERRIDE) | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ADD_QUERY))
+
+/* everything is stored in 8 byte slots, so the arrays can be passed to libsphinxclient as is */
+#define PHP_SPHINX_OP_ALIGN(len) (((len) + 7) & ~((size_t)7))
+
+static php_sphinx_op *php_sphinx_op_new(int code) /* {{{ */
 {
-	php_sphinx_client *c = (php_sphinx_client *)object;
+	php_sphinx_op *op;
 
-	sphinx_destroy(c->sphinx);
-	zend_object_std_dtor(&c->std TSRMLS_CC);
-	efree(c);
+	op = ecalloc(1, sizeof(*op));
+	op->code = code;
+	return op;
 }
 /* }}} */
 
-static zend_object_value php_sphinx_client_new(zend_class_entry *ce TSRMLS_DC) /* {{{ */
+static void php_sphinx_op_free(php_sphinx_op *op) /* {{{ */
 {
-	php_sphinx_client *c;
-	zend_object_value retval;
-#if PHP_VERSION_ID < 50399
-	zval *tmp;
-#endif
+	smart_str_free(&op->buf);
+	efree(op);
+}
+/* }}} */
 
-	c = ecalloc(1, sizeof(*c));
-	zend_object_std_init(&c->std, ce TSRMLS_CC);
+static void php_sphinx_op_put_data(php_sphinx_op *op, const void *data, size_t len) /* {{{ */
+{
+	static const char padding[8] = {0};
 
-#if PHP_VERSION_ID < 50399
-	ALLOC_HASHTABLE(c->std.properties);
-	zend_hash_init(c->std.properties, 0, NULL, ZVAL_PTR_DTOR, 0);
-	zend_hash_copy(c->std.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, (void *) &tmp, sizeof(zval *));
-#else
-	object_properties_init(&c->std, ce);
-#endif
-	retval.handle = zend_objects_store_put(c, (zend_objects_store_dtor_t)zend_objects_destroy_object, php_sphinx_client_obj_dtor, NULL TSRMLS_CC);
-	retval.handlers = &php_sphinx_client_handlers;
-	return retval;
+	if (len) {
+		smart_str_appendl(&op->buf, (const char *)data, len);
+	}
+	if (PHP_SPHINX_OP_ALIGN(len) != len) {
+		smart_str_appendl(&op->buf, padding, PHP_SPHINX_OP_ALIGN(len) - len);
+	}
 }
 /* }}} */
 
-#if PHP_MAJOR_VERSION >= 5 && PHP_MINOR_VERSION >= 4
-static zval *php_sphinx_client_read_property(zval *object, zval *member, int type, const zend_literal *key TSRMLS_DC)
-#else
-static zval *php_sphinx_client_read_property(zval *object, zval *member, int type TSRMLS_DC) /* {{{ */
-#endif
+static inline void php_sphinx_op_put_long(php_sphinx_op *op, sphinx_int64_t value) /* {{{ */
 {
-	zval tmp_member;
-	zval *retval;
-	zend_object_handlers *std_hnd;
+	smart_str_appendl(&op->buf, (const char *)&value, sizeof(value));
+}
+/* }}} */
 
-	if (member->type != IS_STRING) {
-		tmp_member = *member;
-		zval_copy_ctor(&tmp_member);
-		convert_to_string(&tmp_member);
-		member = &tmp_member;
+static inline void php_sphinx_op_put_double(php_sphinx_op *op, double value) /* {{{ */
+{
+	smart_str_appendl(&op->buf, (const char *)&value, sizeof(value));
+}
+/* }}} */
+
+static void php_sphinx_op_put_string(php_sphinx_op *op, const char *str) /* {{{ */
+{
+	size_t len;
+
+	if (!str) {
+		php_sphinx_op_put_long(op, -1);
+		return;
 	}
 
-	/* XXX we can either create retval ourselves (for custom properties) or use standard handlers */
+	/* keep the trailing zero, the string is used in place */
+	len = strlen(str);
+	php_sphinx_op_put_long(op, (sphinx_int64_t)len);
+	php_sphinx_op_put_data(op, str, len + 1);
+}
+/* }}} */
 
-	std_hnd = zend_get_std_object_handlers();
-#if PHP_MAJOR_VERSION >= 5 && PHP_MINOR_VERSION >= 4
-	retval = std_hnd->read_property(object, member, type, key TSRMLS_CC);
-#else
-	retval = std_hnd->read_property(object, member, type TSRMLS_CC);
-#endif
+static inline sphinx_int64_t php_sphinx_op_get_long(const char **p) /* {{{ */
+{
+	sphinx_int64_t value;
 
-	if (member == &tmp_member) {
-		zval_dtor(member);
-	}
-	return retval;
+	memcpy(&value, *p, sizeof(value));
+	*p += sizeof(value);
+	return value;
 }
 /* }}} */
 
-static HashTable *php_sphinx_client_get_properties(zval *object TSRMLS_DC) /* {{{ */
+static inline double php_sphinx_op_get_double(const char **p) /* {{{ */
 {
-	php_sphinx_client *c;
-	const char *warning, *error;
-	zval *tmp;
-	HashTable *props;
+	double value;
 
-	c = (php_sphinx_client *)zend_objects_get_address(object TSRMLS_CC);
+	memcpy(&value, *p, sizeof(value));
+	*p += sizeof(value);
+	return value;
+}
+/* }}} */
 
-	props = zend_std_get_properties(object TSRMLS_CC);
+static inline const void *php_sphinx_op_get_data(const char **p, size_t len) /* {{{ */
+{
+	const char *data = *p;
 
-	error = sphinx_error(c->sphinx);
-	MAKE_STD_ZVAL(tmp);
-	ZVAL_STRING(tmp, (char *)error, 1);
-	zend_hash_update(props, "error", sizeof("error"), (void *)&tmp, sizeof(zval *), NULL);
+	*p += PHP_SPHINX_OP_ALIGN(len);
+	return data;
+}
+/* }}} */
 
-	warning = sphinx_warning(c->sphinx);
-	MAKE_STD_ZVAL(tmp);
-	ZVAL_STRING(tmp, (char *)warning, 1);
-	zend_hash_update(props, "warning", sizeof("warning"), (void *)&tmp, sizeof(zval *), NULL);
-	return c->std.properties;
+static const char *php_sphinx_op_get_string(const char **p) /* {{{ */
+{
+	sphinx_int64_t len;
+
+	len = php_sphinx_op_get_long(p);
+	if (len < 0) {
+		return NULL;
+	}
+	return php_sphinx_op_get_data(p, (size_t)len + 1);
 }
 /* }}} */
 
-#ifdef TONY_200807015
-static inline void php_sphinx_error(php_sphinx_client *c TSRMLS_DC) /* {{{ */
+static void php_sphinx_op_put_weights(php_sphinx_op *op, int num, char **names, int *weights) /* {{{ */
 {
-	const char *err;
+	int i;
 
-	err = sphinx_error(c->sphinx);
-	if (!err || err[0] == '\0') {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown error");
-	} else {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", err);
+	php_sphinx_op_put_long(op, num);
+	for (i = 0; i < num; i++) {
+		php_sphinx_op_put_string(op, names[i]);
 	}
+	php_sphinx_op_put_data(op, weights, num * sizeof(int));
 }
 /* }}} */
-#endif
 
-static void php_sphinx_result_to_array(php_sphinx_client *c, sphinx_result *result, zval **array TSRMLS_DC) /* {{{ */
+static const char **php_sphinx_op_get_weights(const char **p, int *num, const int **weights) /* {{{ */
 {
-	zval *tmp, *tmp_element, *sub_element, *sub_sub_element;
-	int i, j;
+	const char **names;
+	int i;
 
-	array_init(*array);
+	*num = (int)php_sphinx_op_get_long(p);
+	names = safe_emalloc(*num, sizeof(char *), 0);
+	for (i = 0; i < *num; i++) {
+		names[i] = php_sphinx_op_get_string(p);
+	}
+	*weights = php_sphinx_op_get_data(p, *num * sizeof(int));
+	return names;
+}
+/* }}} */
 
-	/* error */
-	if (!result->error) {
-		add_assoc_string_ex(*array, "error", sizeof("error"), "", 1);
-	} else {
-		add_assoc_string_ex(*array, "error", sizeof("error"), (char *)(result->error), 1);
+/* the checked readers are for the data coming from outside, they fail instead of reading past the end */
+static int php_sphinx_op_read_long(const char **p, const char *end, sphinx_int64_t *value) /* {{{ */
+{
+	if ((size_t)(end - *p) < sizeof(*value)) {
+		return FAILURE;
 	}
-	
-	/* warning */
-	if (!result->warning) {
-		add_assoc_string_ex(*array, "warning", sizeof("warning"), "", 1);
-	} else {
-		add_assoc_string_ex(*array, "warning", sizeof("warning"), (char *)result->warning, 1);
+	*value = php_sphinx_op_get_long(p);
+	return SUCCESS;
+}
+/* }}} */
+
+static int php_sphinx_op_read_double(const char **p, const char *end, double *value) /* {{{ */
+{
+	if ((size_t)(end - *p) < sizeof(*value)) {
+		return FAILURE;
 	}
-	
-	/* status */
-	add_assoc_long_ex(*array, "status", sizeof("status"), result->status);
+	*value = php_sphinx_op_get_double(p);
+	return SUCCESS;
+}
+/* }}} */
 
-	switch(result->status) {
-		case SEARCHD_OK:
-			/* ok, continue reading data */
-			break;
-		case SEARCHD_WARNING:
-			/* this seems to be safe, too */
-			break;
-		default: 
-			/* libsphinxclient doesn't nullify the data 
-			   in case of error, so it's not safe to continue. */
-			return;
+static int php_sphinx_op_read_data(const char **p, const char *end, size_t len, const void **data) /* {{{ */
+{
+	if (len > (size_t)(end - *p) || PHP_SPHINX_OP_ALIGN(len) > (size_t)(end - *p)) {
+		return FAILURE;
 	}
+	*data = php_sphinx_op_get_data(p, len);
+	return SUCCESS;
+}
+/* }}} */
 
-	/* fields */
-	MAKE_STD_ZVAL(tmp);
-	array_init(tmp);
+static int php_sphinx_op_read_string(const char **p, const char *end, zend_bool nullable, const char **str) /* {{{ */
+{
+	sphinx_int64_t len;
+	const void *data;
 
-	for (i = 0; i < result->num_fields; i++) {
-		add_next_index_string(tmp, result->fields[i], 1);
+	if (php_sphinx_op_read_long(p, end, &len) == FAILURE) {
+		return FAILURE;
 	}
-	add_assoc_zval_ex(*array, "fields", sizeof("fields"), tmp);
-
-	/* attrs */
-	MAKE_STD_ZVAL(tmp);
-	array_init(tmp);
+	if (len < 0) {
+		*str = NULL;
+		return len == -1 && nullable ? SUCCESS : FAILURE;
+	}
+	if ((sphinx_uint64_t)len >= (size_t)(end - *p)
+		|| php_sphinx_op_read_data(p, end, (size_t)len + 1, &data) == FAILURE
+		|| ((const char *)data)[len] != '\0') {
+		return FAILURE;
+	}
+	*str = (const char *)data;
+	return SUCCESS;
+}
+/* }}} */
 
-	for (i = 0; i < result->num_attrs; i++) {
-#if SIZEOF_LONG == 8
-		add_assoc_long_ex(tmp, result->attr_names[i], strlen(result->attr_names[i]) + 1, result->attr_types[i]);
-#else
-		double float_value;
-		char buf[128];
+/* a count of items taking at least size bytes each, so a forged count fails before anything is allocated */
+static int php_sphinx_op_read_count(const char **p, const char *end, size_t size, int *num) /* {{{ */
+{
+	sphinx_int64_t value;
 
-		float_value = (double)result->attr_types[i];
-		slprintf(buf, sizeof(buf), "%.0f", float_value);
-		add_assoc_string_ex(tmp, result->attr_names[i], strlen(result->attr_names[i]) + 1, buf, 1);
-#endif
+	if (php_sphinx_op_read_long(p, end, &value) == FAILURE
+		|| value < 0 || (sphinx_uint64_t)value > (size_t)(end - *p) / size) {
+		return FAILURE;
 	}
-	add_assoc_zval_ex(*array, "attrs", sizeof("attrs"), tmp);
+	*num = (int)value;
+	return SUCCESS;
+}
+/* }}} */
 
-	/* matches */
-	if (result->num_matches) {
-		MAKE_STD_ZVAL(tmp);
-		array_init(tmp);
+static unsigned int php_sphinx_ops_mask(php_sphinx_op *ops) /* {{{ */
+{
+	unsigned int mask = 0;
 
-		for (i = 0; i < result->num_matches; i++) {
-			MAKE_STD_ZVAL(tmp_element);
-			array_init(tmp_element);
+	for (; ops; ops = ops->next) {
+		mask |= PHP_SPHINX_OP_BIT(ops->code);
+	}
+	return mask;
+}
+/* }}} */
 
-			if (c->array_result) {
-				/* id */
-#if SIZEOF_LONG == 8
-				add_assoc_long_ex(tmp_element, "id", sizeof("id"), sphinx_get_id(result, i));
-#else
-				double float_id;
-				char buf[128];
+static void php_sphinx_ops_free(php_sphinx_op *ops) /* {{{ */
+{
+	php_sphinx_op *next;
 
-				float_id = (double)sphinx_get_id(result, i);
-				slprintf(buf, sizeof(buf), "%.0f", float_id);
-				add_assoc_string_ex(tmp_element, "id", sizeof("id"), buf, 1);
-#endif
-			}
+	for (; ops; ops = next) {
+		next = ops->next;
+		php_sphinx_op_free(ops);
+	}
+}
+/* }}} */
 
-			/* weight */
-			add_assoc_long_ex(tmp_element, "weight", sizeof("weight"), sphinx_get_weight(result, i));
+static void php_sphinx_ops_add(php_sphinx_client *c, php_sphinx_op *op) /* {{{ */
+{
+	php_sphinx_op **p, **tail, *last_query = NULL, *tmp;
+	unsigned int drop = 0;
 
-			/* attrs */
-			MAKE_STD_ZVAL(sub_element);
-			array_init(sub_element);
+	c->applied |= PHP_SPHINX_OP_BIT(op->code);
 
-			for (j = 0; j < result->num_attrs; j++) {
-#if SIZEOF_LONG != 8
-				double float_value;
-				char buf[128];
-#endif
+	for (tmp = c->ops; tmp; tmp = tmp->next) {
+		if (tmp->code == PHP_SPHINX_OP_ADD_QUERY) {
+			last_query = tmp;
+		}
+	}
 
-				MAKE_STD_ZVAL(sub_sub_element);
+	if (op->code == PHP_SPHINX_OP_RESET_FILTERS) {
+		drop = PHP_SPHINX_OPS_FILTERS;
+	} else if (op->code == PHP_SPHINX_OP_RESET_GROUPBY) {
+		drop = PHP_SPHINX_OPS_GROUPBY;
+	} else if (!(PHP_SPHINX_OP_BIT(op->code) & PHP_SPHINX_OPS_APPEND)) {
+		drop = PHP_SPHINX_OP_BIT(op->code);
+	}
 
-				switch(result->attr_types[j]) {
-					case SPH_ATTR_MULTI | SPH_ATTR_INTEGER:
-						{
-							int k;
-							unsigned int *mva = sphinx_get_mva(result, i, j);
-							unsigned int tmp, num;
+	/* ops recorded before the last addQuery() have been encoded into that query already, 
+	   so only the ops after it are replaced */
+	tail = last_query ? &last_query->next : &c->ops;
+	for (p = tail; *p; ) {
+		if (drop & PHP_SPHINX_OP_BIT((*p)->code)) {
+			tmp = *p;
+			*p = tmp->next;
+			php_sphinx_op_free(tmp);
+		} else {
+			p = &(*p)->next;
+		}
+	}
 
-							array_init(sub_sub_element);
+	if (op->code == PHP_SPHINX_OP_RESET_FILTERS || op->code == PHP_SPHINX_OP_RESET_GROUPBY) {
+		int needed = 0;
 
-							if (!mva) {
-								break;
-							}
+		/* a reset is only kept when there is something before the last query to reset */
+		for (tmp = c->ops; last_query && tmp; tmp = tmp->next) {
+			if (tmp->code != op->code && (drop & PHP_SPHINX_OP_BIT(tmp->code))) {
+				needed = 1;
+				break;
+			}
+			if (tmp == last_query) {
+				break;
+			}
+		}
+		if (!needed) {
+			php_sphinx_op_free(op);
+			return;
+		}
+	}
 
-							memcpy(&num, mva, sizeof(unsigned int));
+	op->next = NULL;
+	*p = op;
+}
+/* }}} */
 
-							for (k = 1; k <= num; k++) {
-								mva++;
-								memcpy(&tmp, mva, sizeof(unsigned int));
-#if SIZEOF_LONG == 8
-								add_next_index_long(sub_sub_element, tmp);
-#else
-								float_value = (double)tmp;
-								slprintf(buf, sizeof(buf), "%.0f", float_value);
-								add_next_index_string(sub_sub_element, buf, 1);
-#endif
-							}
-						}	break;
+static void php_sphinx_ops_queries_done(php_sphinx_client *c) /* {{{ */
+{
+	php_sphinx_op *op, *next;
 
-					case SPH_ATTR_FLOAT:
-						ZVAL_DOUBLE(sub_sub_element, sphinx_get_float(result, i, j));
-						break;
-#if LIBSPHINX_VERSION_ID >= 110
-					case SPH_ATTR_STRING:
-						ZVAL_STRING(sub_sub_element, sphinx_get_string(result, i, j), 1);
-						break;                        
+	if (!(php_sphinx_ops_mask(c->ops) & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ADD_QUERY))) {
+		return;
+	}
+
+	/* the queued queries are gone, re-add the rest to get rid of the overridden settings */
+	op = c->ops;
+	c->ops = NULL;
+	for (; op; op = next) {
+		next = op->next;
+		if (op->code == PHP_SPHINX_OP_ADD_QUERY) {
+			php_sphinx_op_free(op);
+		} else {
+			php_sphinx_ops_add(c, op);
+		}
+	}
+}
+/* }}} */
+
+static int php_sphinx_op_apply(sphinx_client *sphinx, php_sphinx_op *op) /* {{{ */
+{
+	const char *p = op->buf.c;
+	int res = 1;
+
+	switch (op->code) {
+		case PHP_SPHINX_OP_SERVER:
+			{
+				const char *host = php_sphinx_op_get_string(&p);
+				res = sphinx_set_server(sphinx, host, (int)php_sphinx_op_get_long(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_CONNECT_TIMEOUT:
+			res = sphinx_set_connect_timeout(sphinx, php_sphinx_op_get_double(&p));
+			break;
+		case PHP_SPHINX_OP_LIMITS:
+			{
+				int offset, limit, max_matches;
+
+				offset = (int)php_sphinx_op_get_long(&p);
+				limit = (int)php_sphinx_op_get_long(&p);
+				max_matches = (int)php_sphinx_op_get_long(&p);
+				res = sphinx_set_limits(sphinx, offset, limit, max_matches, (int)php_sphinx_op_get_long(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_MATCH_MODE:
+			res = sphinx_set_match_mode(sphinx, (int)php_sphinx_op_get_long(&p));
+			break;
+		case PHP_SPHINX_OP_INDEX_WEIGHTS:
+		case PHP_SPHINX_OP_FIELD_WEIGHTS:
+			{
+				const char **names;
+				const int *weights;
+				int num;
+
+				names = php_sphinx_op_get_weights(&p, &num, &weights);
+				if (op->code == PHP_SPHINX_OP_INDEX_WEIGHTS) {
+					res = sphinx_set_index_weights(sphinx, num, names, weights);
+				} else {
+					res = sphinx_set_field_weights(sphinx, num, names, weights);
+				}
+				efree(names);
+			}
+			break;
+#if LIBSPHINX_VERSION_ID >= 99
+		case PHP_SPHINX_OP_SELECT:
+			res = sphinx_set_select(sphinx, php_sphinx_op_get_string(&p));
+			break;
 #endif
-					default:
-#if SIZEOF_LONG == 8
-						ZVAL_LONG(sub_sub_element, sphinx_get_int(result, i, j));
-#else
-						float_value = (double)sphinx_get_int(result, i, j);
-						slprintf(buf, sizeof(buf), "%.0f", float_value);
-						ZVAL_STRING(sub_sub_element, buf, 1);
+		case PHP_SPHINX_OP_ID_RANGE:
+			{
+				sphinx_uint64_t min = (sphinx_uint64_t)php_sphinx_op_get_long(&p);
+				res = sphinx_set_id_range(sphinx, min, (sphinx_uint64_t)php_sphinx_op_get_long(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_FILTER:
+			{
+				const char *attr = php_sphinx_op_get_string(&p);
+				int num = (int)php_sphinx_op_get_long(&p);
+				const sphinx_int64_t *values = php_sphinx_op_get_data(&p, num * sizeof(sphinx_int64_t));
+
+				res = sphinx_add_filter(sphinx, attr, num, values, (int)php_sphinx_op_get_long(&p));
+			}
+			break;
+#ifdef HAVE_SPHINX_ADD_FILTER_STRING
+		case PHP_SPHINX_OP_FILTER_STRING:
+			{
+				const char *attr = php_sphinx_op_get_string(&p);
+				const char *value = php_sphinx_op_get_string(&p);
+
+				res = sphinx_add_filter_string(sphinx, attr, value, (int)php_sphinx_op_get_long(&p));
+			}
+			break;
 #endif
-						break;
-				}
+		case PHP_SPHINX_OP_FILTER_RANGE:
+			{
+				const char *attr = php_sphinx_op_get_string(&p);
+				sphinx_int64_t min = php_sphinx_op_get_long(&p);
+				sphinx_int64_t max = php_sphinx_op_get_long(&p);
+
+				res = sphinx_add_filter_range(sphinx, attr, min, max, (int)php_sphinx_op_get_long(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_FILTER_FLOAT_RANGE:
+			{
+				const char *attr = php_sphinx_op_get_string(&p);
+				double min = php_sphinx_op_get_double(&p);
+				double max = php_sphinx_op_get_double(&p);
 
-				add_assoc_zval(sub_element, result->attr_names[j], sub_sub_element);
+				res = sphinx_add_filter_float_range(sphinx, attr, min, max, (int)php_sphinx_op_get_long(&p));
 			}
+			break;
+		case PHP_SPHINX_OP_GEO_ANCHOR:
+			{
+				const char *attrlat = php_sphinx_op_get_string(&p);
+				const char *attrlong = php_sphinx_op_get_string(&p);
+				double latitude = php_sphinx_op_get_double(&p);
 
-			add_assoc_zval_ex(tmp_element, "attrs", sizeof("attrs"), sub_element);
+				res = sphinx_set_geoanchor(sphinx, attrlat, attrlong, latitude, php_sphinx_op_get_double(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_GROUP_BY:
+			{
+				const char *attr = php_sphinx_op_get_string(&p);
+				int func = (int)php_sphinx_op_get_long(&p);
 
-			if (c->array_result) {
-				add_next_index_zval(tmp, tmp_element);
-			} else {
-#if SIZEOF_LONG == 8
-				add_index_zval(tmp, sphinx_get_id(result, i), tmp_element);
+				res = sphinx_set_groupby(sphinx, attr, func, php_sphinx_op_get_string(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_GROUP_DISTINCT:
+			res = sphinx_set_groupby_distinct(sphinx, php_sphinx_op_get_string(&p));
+			break;
+		case PHP_SPHINX_OP_RETRIES:
+			{
+				int count = (int)php_sphinx_op_get_long(&p);
+				res = sphinx_set_retries(sphinx, count, (int)php_sphinx_op_get_long(&p));
+			}
+			break;
+		case PHP_SPHINX_OP_MAX_QUERY_TIME:
+			res = sphinx_set_max_query_time(sphinx, (int)php_sphinx_op_get_long(&p));
+			break;
+		case PHP_SPHINX_OP_RANKING_MODE:
+			{
+				int ranker = (int)php_sphinx_op_get_long(&p);
+#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
+				res = sphinx_set_ranking_mode(sphinx, ranker, php_sphinx_op_get_string(&p));
 #else
-				char buf[128];
-				double float_id;
-				int buf_len;
+				res = sphinx_set_ranking_mode(sphinx, ranker);
+#endif
+			}
+			break;
+		case PHP_SPHINX_OP_SORT_MODE:
+			{
+				int mode = (int)php_sphinx_op_get_long(&p);
+				res = sphinx_set_sort_mode(sphinx, mode, php_sphinx_op_get_string(&p));
+			}
+			break;
+#if LIBSPHINX_VERSION_ID >= 99
+		case PHP_SPHINX_OP_OVERRIDE:
+			{
+				const char *attr = php_sphinx_op_get_string(&p);
+				int num = (int)php_sphinx_op_get_long(&p);
+				const sphinx_uint64_t *docids = php_sphinx_op_get_data(&p, num * sizeof(sphinx_uint64_t));
 
-				float_id = (double)sphinx_get_id(result, i);
-				buf_len = slprintf(buf, sizeof(buf), "%.0f", float_id);
-				add_assoc_zval_ex(tmp, buf, buf_len + 1, tmp_element);
+				res = sphinx_add_override(sphinx, attr, docids, num, php_sphinx_op_get_data(&p, num * sizeof(unsigned int)));
+			}
+			break;
 #endif
+		case PHP_SPHINX_OP_RESET_FILTERS:
+			sphinx_reset_filters(sphinx);
+			break;
+		case PHP_SPHINX_OP_RESET_GROUPBY:
+			sphinx_reset_groupby(sphinx);
+			break;
+		case PHP_SPHINX_OP_ADD_QUERY:
+			{
+				const char *query = php_sphinx_op_get_string(&p);
+				const char *index = php_sphinx_op_get_string(&p);
+
+				res = sphinx_add_query(sphinx, query, index, php_sphinx_op_get_string(&p)) >= 0;
 			}
+			break;
+	}
+	return res;
+}
+/* }}} */
+
+static int php_sphinx_ops_apply(sphinx_client *sphinx, php_sphinx_op *ops) /* {{{ */
+{
+	for (; ops; ops = ops->next) {
+		if (!php_sphinx_op_apply(sphinx, ops)) {
+			return FAILURE;
 		}
+	}
+	return SUCCESS;
+}
+/* }}} */
 
-		add_assoc_zval_ex(*array, "matches", sizeof("matches"), tmp);
+/* the setters apply the recorded op rather than their arguments, so that the handle 
+   gets exactly what the journal replays on the other handles */
+static int php_sphinx_client_apply(php_sphinx_client *c, php_sphinx_op *op) /* {{{ */
+{
+	if (!php_sphinx_op_apply(c->sphinx, op)) {
+		php_sphinx_op_free(op);
+		return 0;
 	}
+	php_sphinx_ops_add(c, op);
+	return 1;
+}
+/* }}} */
 
-	/* total */
-	add_assoc_long_ex(*array, "total", sizeof("total"), result->total);
+/* the ops as one flat buffer of code, length and contents, the ops in the skip mask are left out */
+static void php_sphinx_ops_encode(php_sphinx_op *ops, unsigned int skip, smart_str *buf) /* {{{ */
+{
+	sphinx_int64_t len;
 
-	/* total_found */
-	add_assoc_long_ex(*array, "total_found", sizeof("total_found"), result->total_found);
-	
-	/* time */
-	add_assoc_double_ex(*array, "time", sizeof("time"), (double)result->time_msec/1000.0);
+	for (; ops; ops = ops->next) {
+		if (skip & PHP_SPHINX_OP_BIT(ops->code)) {
+			continue;
+		}
+		len = ops->buf.len;
+		smart_str_appendl(buf, (const char *)&ops->code, sizeof(ops->code));
+		smart_str_appendl(buf, (const char *)&len, sizeof(len));
+		if (len) {
+			smart_str_appendl(buf, ops->buf.c, (size_t)len);
+		}
+	}
+}
+/* }}} */
 
-	/* words */
-	if (result->num_words) {
-		MAKE_STD_ZVAL(tmp);
-		array_init(tmp);
-		for (i = 0; i < result->num_words; i++) {
-			MAKE_STD_ZVAL(sub_element);
-			array_init(sub_element);
+/* the layout of an op as php_sphinx_op_apply() reads it: l - long, d - double, s - string, 
+   S - string or NULL, w - weights, v - filter values, o - override values */
+static const char *php_sphinx_op_layout(int code) /* {{{ */
+{
+	switch (code) {
+		case PHP_SPHINX_OP_SERVER:
+			return "sl";
+		case PHP_SPHINX_OP_CONNECT_TIMEOUT:
+			return "d";
+		case PHP_SPHINX_OP_LIMITS:
+			return "llll";
+		case PHP_SPHINX_OP_MATCH_MODE:
+		case PHP_SPHINX_OP_MAX_QUERY_TIME:
+			return "l";
+		case PHP_SPHINX_OP_INDEX_WEIGHTS:
+		case PHP_SPHINX_OP_FIELD_WEIGHTS:
+			return "w";
+		case PHP_SPHINX_OP_SELECT:
+		case PHP_SPHINX_OP_GROUP_DISTINCT:
+			return "s";
+		case PHP_SPHINX_OP_ID_RANGE:
+		case PHP_SPHINX_OP_RETRIES:
+			return "ll";
+		case PHP_SPHINX_OP_FILTER:
+			return "svl";
+		case PHP_SPHINX_OP_FILTER_STRING:
+			return "ssl";
+		case PHP_SPHINX_OP_FILTER_RANGE:
+			return "slll";
+		case PHP_SPHINX_OP_FILTER_FLOAT_RANGE:
+			return "sddl";
+		case PHP_SPHINX_OP_GEO_ANCHOR:
+			return "ssdd";
+		case PHP_SPHINX_OP_GROUP_BY:
+			return "slS";
+		case PHP_SPHINX_OP_RANKING_MODE:
+#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
+			return "lS";
+#else
+			return "l";
+#endif
+		case PHP_SPHINX_OP_SORT_MODE:
+			return "lS";
+		case PHP_SPHINX_OP_OVERRIDE:
+			return "so";
+		case PHP_SPHINX_OP_ADD_QUERY:
+			return "sSS";
+	}
+	return "";
+}
+/* }}} */
 
-			add_assoc_long_ex(sub_element, "docs", sizeof("docs"), result->words[i].docs);
-			add_assoc_long_ex(sub_element, "hits", sizeof("hits"), result->words[i].hits);
-			add_assoc_zval_ex(tmp, (char *)result->words[i].word, strlen(result->words[i].word) + 1, sub_element);
+/* walks a decoded op the way php_sphinx_op_apply() does, the op must be used up exactly */
+static int php_sphinx_op_check(php_sphinx_op *op) /* {{{ */
+{
+	const char *layout, *p = op->buf.c, *end = op->buf.c + op->buf.len;
+	const char *str;
+	const void *data;
+	sphinx_int64_t value;
+	double dvalue;
+	int i, num;
+
+	for (layout = php_sphinx_op_layout(op->code); *layout; layout++) {
+		switch (*layout) {
+			case 'l':
+				if (php_sphinx_op_read_long(&p, end, &value) == FAILURE) {
+					return FAILURE;
+				}
+				break;
+			case 'd':
+				if (php_sphinx_op_read_double(&p, end, &dvalue) == FAILURE) {
+					return FAILURE;
+				}
+				break;
+			case 's':
+			case 'S':
+				if (php_sphinx_op_read_string(&p, end, *layout == 'S', &str) == FAILURE) {
+					return FAILURE;
+				}
+				break;
+			case 'w':
+				/* a name takes its length and at least one slot */
+				if (php_sphinx_op_read_count(&p, end, 2 * sizeof(sphinx_int64_t), &num) == FAILURE) {
+					return FAILURE;
+				}
+				for (i = 0; i < num; i++) {
+					if (php_sphinx_op_read_string(&p, end, 0, &str) == FAILURE) {
+						return FAILURE;
+					}
+				}
+				if (php_sphinx_op_read_data(&p, end, num * sizeof(int), &data) == FAILURE) {
+					return FAILURE;
+				}
+				break;
+			case 'v':
+				if (php_sphinx_op_read_count(&p, end, sizeof(sphinx_int64_t), &num) == FAILURE
+					|| php_sphinx_op_read_data(&p, end, num * sizeof(sphinx_int64_t), &data) == FAILURE) {
+					return FAILURE;
+				}
+				break;
+			case 'o':
+				if (php_sphinx_op_read_count(&p, end, sizeof(sphinx_uint64_t), &num) == FAILURE
+					|| php_sphinx_op_read_data(&p, end, num * sizeof(sphinx_uint64_t), &data) == FAILURE
+					|| php_sphinx_op_read_data(&p, end, num * sizeof(unsigned int), &data) == FAILURE) {
+					return FAILURE;
+				}
+				break;
 		}
-		add_assoc_zval_ex(*array, "words", sizeof("words"), tmp);
 	}
+	return p == end ? SUCCESS : FAILURE;
 }
 /* }}} */
 
-
-/* {{{ proto void SphinxClient::__construct() */
-static PHP_METHOD(SphinxClient, __construct)
+static int php_sphinx_ops_decode(const char *buf, size_t buf_len, php_sphinx_op **ops) /* {{{ */
 {
-	php_sphinx_client *c;
+	const char *end = buf + buf_len;
+	php_sphinx_op *op, **tail = ops;
+	sphinx_int64_t len;
+	int code;
+
+	*ops = NULL;
+	while (buf < end) {
+		if ((size_t)(end - buf) < sizeof(code) + sizeof(len)) {
+			goto fail;
+		}
+		memcpy(&code, buf, sizeof(code));
+		memcpy(&len, buf + sizeof(code), sizeof(len));
+		buf += sizeof(code) + sizeof(len);
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+		if (code < 0 || code >= PHP_SPHINX_OP_LAST || len < 0 || len > end - buf) {
+			goto fail;
+		}
 
-	if (c->sphinx) {
-		/* called __construct() twice, bail out */
-		return;
+		op = php_sphinx_op_new(code);
+		if (len) {
+			smart_str_appendl(&op->buf, buf, (size_t)len);
+			buf += len;
+		}
+		*tail = op;
+		tail = &op->next;
+
+		if (php_sphinx_op_check(op) == FAILURE) {
+			goto fail;
+		}
 	}
+	return SUCCESS;
 
-	c->sphinx = sphinx_create(1 /* copy string args */);
-	
-	sphinx_set_connect_timeout(c->sphinx, FG(default_socket_timeout));
+fail:
+	php_sphinx_ops_free(*ops);
+	*ops = NULL;
+	return FAILURE;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setServer(string server, int port) */
-static PHP_METHOD(SphinxClient, setServer)
+static php_sphinx_op *php_sphinx_ops_copy(php_sphinx_op *ops) /* {{{ */
 {
-	php_sphinx_client *c;
-	long port;
-	char *server;
-	int server_len, res;
+	php_sphinx_op *copy = NULL, **tail = &copy, *op;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sl", &server, &server_len, &port) == FAILURE) {
-		return;
+	for (; ops; ops = ops->next) {
+		op = php_sphinx_op_new(ops->code);
+		if (ops->buf.len) {
+			smart_str_appendl(&op->buf, ops->buf.c, ops->buf.len);
+		}
+		*tail = op;
+		tail = &op->next;
 	}
+	return copy;
+}
+/* }}} */
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_set_server(c->sphinx, server, (int)port);
-	if (!res) {
-		RETURN_FALSE;
+/* ops setting the defaults back for the settings in the mask, the rest cannot be reset */
+static php_sphinx_op *php_sphinx_ops_defaults(unsigned int mask) /* {{{ */
+{
+	php_sphinx_op *ops = NULL, *op;
+
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_LIMITS)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_LIMITS);
+		php_sphinx_op_put_long(op, 0);
+		php_sphinx_op_put_long(op, 20);
+		php_sphinx_op_put_long(op, 1000);
+		php_sphinx_op_put_long(op, 0);
+		op->next = ops;
+		ops = op;
 	}
-	RETURN_TRUE;
+#if LIBSPHINX_VERSION_ID >= 99
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_SELECT)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_SELECT);
+		php_sphinx_op_put_string(op, "*");
+		op->next = ops;
+		ops = op;
+	}
+#endif
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ID_RANGE)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_ID_RANGE);
+		php_sphinx_op_put_long(op, 0);
+		php_sphinx_op_put_long(op, 0);
+		op->next = ops;
+		ops = op;
+	}
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_RETRIES)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_RETRIES);
+		php_sphinx_op_put_long(op, 0);
+		php_sphinx_op_put_long(op, 0);
+		op->next = ops;
+		ops = op;
+	}
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_MAX_QUERY_TIME)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_MAX_QUERY_TIME);
+		php_sphinx_op_put_long(op, 0);
+		op->next = ops;
+		ops = op;
+	}
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_RANKING_MODE)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_RANKING_MODE);
+		php_sphinx_op_put_long(op, SPH_RANK_PROXIMITY_BM25);
+#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
+		php_sphinx_op_put_string(op, NULL);
+#endif
+		op->next = ops;
+		ops = op;
+	}
+	if (mask & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_SORT_MODE)) {
+		op = php_sphinx_op_new(PHP_SPHINX_OP_SORT_MODE);
+		php_sphinx_op_put_long(op, SPH_SORT_RELEVANCE);
+		php_sphinx_op_put_string(op, NULL);
+		op->next = ops;
+		ops = op;
+	}
+	return ops;
 }
 /* }}} */
- 
-/* {{{ proto bool SphinxClient::setLimits(int offset, int limit[, int max_matches[, int cutoff]]) */
-static PHP_METHOD(SphinxClient, setLimits)
+/* }}} */
+
+static double php_sphinx_time(void) /* {{{ */
 {
-	php_sphinx_client *c;
-	long offset, limit, max_matches = 1000, cutoff = 0;
-	int res;
+	struct timeval tv;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ll|ll", &offset, &limit, &max_matches, &cutoff) == FAILURE) {
-		return;
-	}
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+/* }}} */
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+/* a fresh handle with the same settings as the client, and the same queued queries if asked */
+static sphinx_client *php_sphinx_client_handle_new(php_sphinx_client *c, zend_bool queries TSRMLS_DC) /* {{{ */
+{
+	sphinx_client *sphinx;
+	php_sphinx_op *op;
 
-	res = sphinx_set_limits(c->sphinx, (int)offset, (int)limit, (int)max_matches, (int)cutoff);
-	if (!res) {
-		RETURN_FALSE;
+	sphinx = sphinx_create(1 /* copy string args */);
+	if (!sphinx) {
+		return NULL;
 	}
-	RETURN_TRUE;
+
+	sphinx_set_connect_timeout(sphinx, FG(default_socket_timeout));
+	for (op = c->ops; op; op = op->next) {
+		if (op->code == PHP_SPHINX_OP_ADD_QUERY && !queries) {
+			continue;
+		}
+		if (!php_sphinx_op_apply(sphinx, op)) {
+			sphinx_destroy(sphinx);
+			return NULL;
+		}
+	}
+	return sphinx;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setMatchMode(int mode) */
-static PHP_METHOD(SphinxClient, setMatchMode)
+/* milliseconds left until the deadline of a call started at start, -1 without a deadline */
+static int php_sphinx_client_remaining(php_sphinx_client *c, double start) /* {{{ */
 {
-	php_sphinx_client *c;
-	long mode;
-	int res;
+	double left;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &mode) == FAILURE) {
-		return;
+	if (c->deadline <= 0) {
+		return -1;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-	
-	res = sphinx_set_match_mode(c->sphinx, mode);
-	if (!res) {
-		RETURN_FALSE;
-	}
-	RETURN_TRUE;
+	left = start + c->deadline - php_sphinx_time();
+	return left > 0 ? (int)(left * 1000) : 0;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setIndexWeights(array weights) */
-static PHP_METHOD(SphinxClient, setIndexWeights)
+/* limits the connect time and the server side query time of the handle to the time 
+   left, so that searchd stops working on the answers nobody is going to wait for */
+static void php_sphinx_client_cap(php_sphinx_client *c, sphinx_client *sphinx, int left) /* {{{ */
 {
-	php_sphinx_client *c;
-	zval *weights, **item;
-	int num_weights, res = 0, i;
-	int *index_weights;
-	char **index_names;
-	char *string_key;
-	unsigned int string_key_len;
-	unsigned long int num_key;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &weights) == FAILURE) {
+	if (left < 0) {
 		return;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-	
-	num_weights = zend_hash_num_elements(Z_ARRVAL_P(weights));
-	if (!num_weights) {
-		/* check for empty array and return false right away */
-		RETURN_FALSE;
+	left = MAX(left, 1);
+	sphinx_set_max_query_time(sphinx, (c->max_query_time > 0 && c->max_query_time < left) ? (int)c->max_query_time : left);
+	sphinx_set_connect_timeout(sphinx, (float)MIN(c->connect_timeout, left / 1000.0));
+}
+/* }}} */
+
+static void php_sphinx_client_uncap(php_sphinx_client *c, sphinx_client *sphinx) /* {{{ */
+{
+	if (c->deadline > 0 && sphinx) {
+		sphinx_set_max_query_time(sphinx, (int)c->max_query_time);
+		sphinx_set_connect_timeout(sphinx, (float)c->connect_timeout);
 	}
+}
+/* }}} */
 
-	index_names = safe_emalloc(num_weights, sizeof(char *), 0);
-	index_weights = safe_emalloc(num_weights, sizeof(int), 0);
+static void php_sphinx_results_ref_release(php_sphinx_results_ref *ref) /* {{{ */
+{
+	if (--ref->refcount == 0) {
+		if (ref->owned) {
+			if (ref->sphinx) {
+				sphinx_destroy(ref->sphinx);
+			}
+			if (ref->cached) {
+				php_sphinx_cached_free(ref->cached);
+			}
+		}
+		efree(ref);
+	}
+}
+/* }}} */
 
-	/* reset num_weights, we'll reuse it count _real_ number of entries */
-	num_weights = 0;
+/* takes a reference to the results in the client's handle, keeping them alive 
+   when the client moves on to another handle */
+static php_sphinx_results_ref *php_sphinx_client_results_ref(php_sphinx_client *c) /* {{{ */
+{
+	if (!c->results_ref) {
+		c->results_ref = emalloc(sizeof(php_sphinx_results_ref));
+		c->results_ref->sphinx = c->cached ? NULL : c->sphinx;
+		c->results_ref->cached = c->cached;
+		c->results_ref->refcount = 1;
+		c->results_ref->owned = 0;
+	}
+	c->results_ref->refcount++;
+	return c->results_ref;
+}
+/* }}} */
 
-	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(weights)); 
-		 zend_hash_get_current_data(Z_ARRVAL_P(weights), (void **)&item) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(weights))) {
-		
-		if (zend_hash_get_current_key_ex(Z_ARRVAL_P(weights), &string_key, &string_key_len, &num_key, 0, NULL) != HASH_KEY_IS_STRING) {
-			/* if the key is not string.. well.. you're screwed */
-			break;
-		}
+/* makes sure no results object uses the client's handle anymore, with renew 
+   the client gets a fresh handle, otherwise the handle is just gone */
+static int php_sphinx_client_detach_results(php_sphinx_client *c, zend_bool renew TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_results_ref *ref = c->results_ref;
 
-		convert_to_long_ex(item);
-		
-		index_names[num_weights] = estrndup(string_key, string_key_len);
-		index_weights[num_weights] = Z_LVAL_PP(item);
+	c->results_ref = NULL;
+	if (!ref || ref->refcount == 1) {
+		/* the results objects are gone */
+		if (ref) {
+			efree(ref);
+		}
+		if (c->cached) {
+			php_sphinx_cached_free(c->cached);
+			c->cached = NULL;
+		}
+		return SUCCESS;
+	}
 
-		num_weights++;
+	ref->owned = 1;
+	ref->refcount--;
+	if (ref->cached) {
+		/* cached results, the handle was not involved */
+		c->cached = NULL;
+		return SUCCESS;
 	}
+	c->persistent = 0;
+	c->backend = -1;
+	c->sphinx = renew ? php_sphinx_client_handle_new(c, 1 TSRMLS_CC) : NULL;
+	return (c->sphinx || !renew) ? SUCCESS : FAILURE;
+}
+/* }}} */
 
-	if (num_weights) {
-		res = sphinx_set_index_weights(c->sphinx, num_weights, (const char **)index_names, index_weights);
+static int php_sphinx_client_set_server(php_sphinx_client *c, char *server, int server_len, long port TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_op *op;
+
+#if LIBSPHINX_VERSION_ID >= 99
+	if (c->persistent && (c->backend >= 0 || port != c->port || strcmp(server, c->host ? c->host : PHP_SPHINX_DEFAULT_HOST) != 0)) {
+		/* the connection belongs to the old server */
+		sphinx_close(c->sphinx);
+		c->persistent = 0;
 	}
+#endif
 
-	for (i = 0; i != num_weights; i++) {
-		efree(index_names[i]);
+	op = php_sphinx_op_new(PHP_SPHINX_OP_SERVER);
+	php_sphinx_op_put_string(op, server);
+	php_sphinx_op_put_long(op, port);
+	if (!php_sphinx_client_apply(c, op)) {
+		return FAILURE;
 	}
-	efree(index_names);
-	efree(index_weights);
 
-	if (!res) {
-		RETURN_FALSE;
+	if (c->host) {
+		efree(c->host);
 	}
-	RETURN_TRUE;
+	c->host = estrndup(server, server_len);
+	c->port = port;
+	c->backend = -1;
+	return SUCCESS;
 }
 /* }}} */
 
-#if LIBSPHINX_VERSION_ID >= 99
-/* {{{ proto bool SphinxClient::setSelect(string clause) */
-static PHP_METHOD(SphinxClient, setSelect)
+/* points the handle to one of the setServers() backends, unlike setServer() it is not journaled, 
+   so that exportConfig() and the copies keep the configured server */
+static int php_sphinx_client_use_backend(php_sphinx_client *c, int i TSRMLS_DC) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *clause;
-	int clause_len, res;
+	php_sphinx_server *server = &c->servers[i];
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &clause, &clause_len) == FAILURE) {
-		return;
+#if LIBSPHINX_VERSION_ID >= 99
+	if (c->persistent && c->backend != i) {
+		/* the connection belongs to another server */
+		sphinx_close(c->sphinx);
+		c->persistent = 0;
 	}
+#endif
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_set_select(c->sphinx, clause);
-	if (!res) {
-		RETURN_FALSE;
+	if (!sphinx_set_server(c->sphinx, server->host, (int)server->port)) {
+		return FAILURE;
 	}
-	RETURN_TRUE;
+	c->backend = i;
+	return SUCCESS;
 }
 /* }}} */
-#endif
 
-/* {{{ proto bool SphinxClient::setIDRange(int min, int max) */
-static PHP_METHOD(SphinxClient, setIDRange)
+/* points the handle back to the configured server before the backends go away */
+static void php_sphinx_client_drop_backend(php_sphinx_client *c) /* {{{ */
 {
-	php_sphinx_client *c;
-	long min, max;
-	int res;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ll", &min, &max) == FAILURE) {
+	if (c->backend < 0) {
 		return;
 	}
-
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_set_id_range(c->sphinx, (sphinx_uint64_t)min, (sphinx_uint64_t)max);
-	if (!res) {
-		RETURN_FALSE;
+#if LIBSPHINX_VERSION_ID >= 99
+	if (c->persistent) {
+		sphinx_close(c->sphinx);
+		c->persistent = 0;
 	}
-	RETURN_TRUE;
+#endif
+	sphinx_set_server(c->sphinx, c->host ? c->host : PHP_SPHINX_DEFAULT_HOST, (int)c->port);
+	c->backend = -1;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setFilter(string attribute, array values[, bool exclude]) */
-static PHP_METHOD(SphinxClient, setFilter)
-{
-	php_sphinx_client *c;
-	zval *values, **item;
-	char *attribute;
-	int	attribute_len, num_values, i = 0, res;
-	zend_bool exclude = 0;
-	sphinx_int64_t *u_values;
+#ifdef HAVE_SPHINX_THREADS
+static void php_sphinx_client_drop_job(php_sphinx_client *c);
+#endif
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sa|b", &attribute, &attribute_len, &values, &exclude) == FAILURE) {
-		return;
+/* replaces the query settings of the client with ops, the filters, the group-by and the settings 
+   ops do not have are reset. The server and the queued queries stay. The settings libsphinxclient 
+   cannot reset (match mode, weights, geo anchor and overrides) stay too, unless ops set them. 
+   The new settings are tried on a fresh handle first, so that a failure leaves the client as it was. */
+static int php_sphinx_client_load_ops(php_sphinx_client *c, php_sphinx_op *ops TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_op *op, *next, *tail, *old_ops, **link;
+	sphinx_client *sphinx;
+	unsigned int stale, applied;
+	long max_query_time = c->max_query_time;
+
+	stale = php_sphinx_ops_mask(c->ops) & ~php_sphinx_ops_mask(ops);
+
+	/* resets go first */
+	op = php_sphinx_op_new(PHP_SPHINX_OP_RESET_GROUPBY);
+	op->next = ops;
+	ops = op;
+	op = php_sphinx_op_new(PHP_SPHINX_OP_RESET_FILTERS);
+	op->next = ops;
+	ops = op;
+	op = php_sphinx_ops_defaults(stale);
+	if (op) {
+		for (tail = op; tail->next; tail = tail->next);
+		tail->next = ops;
+		ops = op;
 	}
-	
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
 
-	num_values = zend_hash_num_elements(Z_ARRVAL_P(values));
-	if (!num_values) {
-		RETURN_FALSE;
-	}
+	for (link = &ops; *link; ) {
+		op = *link;
+		if (PHP_SPHINX_OP_BIT(op->code) & PHP_SPHINX_OPS_CONNECTION) {
+			*link = op->next;
+			php_sphinx_op_free(op);
+			continue;
+		}
+		if (op->code == PHP_SPHINX_OP_MAX_QUERY_TIME) {
+			const char *p = op->buf.c;
 
-	u_values = safe_emalloc(num_values, sizeof(sphinx_int64_t), 0);
+			max_query_time = (long)php_sphinx_op_get_long(&p);
+		}
+		link = &op->next;
+	}
 
-	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(values));
-		 zend_hash_get_current_data(Z_ARRVAL_P(values), (void **) &item) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(values))) {
-		
-		convert_to_double_ex(item);
-		u_values[i] = (sphinx_int64_t)Z_DVAL_PP(item);
-		i++;
+	/* the journal as if the setters had been called */
+	old_ops = c->ops;
+	applied = c->applied;
+	c->ops = php_sphinx_ops_copy(old_ops);
+	for (op = php_sphinx_ops_copy(ops); op; op = next) {
+		next = op->next;
+		php_sphinx_ops_add(c, op);
 	}
 
-	res = sphinx_add_filter(c->sphinx, attribute, num_values, u_values, exclude ? 1 : 0);
-	efree(u_values);
+	sphinx = php_sphinx_client_handle_new(c, 1 TSRMLS_CC);
+	if (!sphinx) {
+		php_sphinx_ops_free(c->ops);
+		c->ops = old_ops;
+		c->applied = applied;
+		php_sphinx_ops_free(ops);
+		return FAILURE;
+	}
+	php_sphinx_ops_free(old_ops);
+	c->max_query_time = max_query_time;
 
-	if (!res) {
-		RETURN_FALSE;
+	/* the client's handle keeps its connection and its results, unless it fails 
+	   halfway, then the fresh one takes over */
+	if (php_sphinx_ops_apply(c->sphinx, ops) == SUCCESS) {
+		sphinx_destroy(sphinx);
+	} else {
+#ifdef HAVE_SPHINX_THREADS
+		php_sphinx_client_drop_job(c);
+#endif
+		php_sphinx_client_detach_results(c, 0 TSRMLS_CC);
+		if (c->sphinx) {
+			sphinx_destroy(c->sphinx);
+		}
+		c->sphinx = sphinx;
+		c->persistent = 0;
+		c->backend = -1;
+		c->applied = php_sphinx_ops_mask(c->ops);
 	}
-	RETURN_TRUE;
+	php_sphinx_ops_free(ops);
+	return SUCCESS;
 }
 /* }}} */
 
-#ifdef HAVE_SPHINX_ADD_FILTER_STRING
-/* {{{ proto bool SphinxClient::setFilterString(string attribute, string value[, bool exclude]) */
-static PHP_METHOD(SphinxClient, setFilterString)
+/* {{{ servers lists */
+static void php_sphinx_servers_free(php_sphinx_server *servers, int num) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *attribute, *value;
-	int	attribute_len, value_len, res;
-	zend_bool exclude = 0;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss|b", &attribute, &attribute_len, &value, &value_len, &exclude) == FAILURE) {
-		return;
+	while (num--) {
+		efree(servers[num].host);
 	}
-
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_add_filter_string(c->sphinx, attribute, value, exclude ? 1 : 0);
-	if (!res) {
-		RETURN_FALSE;
+	if (servers) {
+		efree(servers);
 	}
-	RETURN_TRUE;
 }
 /* }}} */
-#endif
 
-/* {{{ proto bool SphinxClient::setFilterRange(string attribute, int min, int max[, bool exclude]) */
-static PHP_METHOD(SphinxClient, setFilterRange)
+static php_sphinx_server *php_sphinx_servers_copy(php_sphinx_server *servers, int num) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *attribute;
-	int attribute_len, res;
-	long min, max;
-	zend_bool exclude = 0;
+	php_sphinx_server *copy;
+	int i;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sll|b", &attribute, &attribute_len, &min, &max, &exclude ) == FAILURE) {
-		return;
+	if (!servers) {
+		return NULL;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_add_filter_range(c->sphinx, attribute, min, max, exclude);
-
-	if (!res) {
-		RETURN_FALSE;
+	copy = safe_emalloc(num, sizeof(php_sphinx_server), 0);
+	for (i = 0; i < num; i++) {
+		copy[i] = servers[i];
+		copy[i].host = estrdup(servers[i].host);
 	}
-	RETURN_TRUE;
+	return copy;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setFilterFloatRange(string attribute, float min, float max[, bool exclude]) */
-static PHP_METHOD(SphinxClient, setFilterFloatRange)
+static void php_sphinx_servers_put(php_sphinx_op *op, php_sphinx_server *servers, int num) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *attribute;
-	int attribute_len, res;
-	double min, max;
-	zend_bool exclude = 0;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sdd|b", &attribute, &attribute_len, &min, &max, &exclude) == FAILURE) {
-		return;
-	}
-
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_add_filter_float_range(c->sphinx, attribute, min, max, exclude);
+	int i;
 
-	if (!res) {
-		RETURN_FALSE;
+	php_sphinx_op_put_long(op, servers ? num : 0);
+	for (i = 0; servers && i < num; i++) {
+		php_sphinx_op_put_string(op, servers[i].host);
+		php_sphinx_op_put_long(op, servers[i].port);
+		php_sphinx_op_put_long(op, servers[i].weight);
 	}
-	RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setGeoAnchor(string attrlat, string attrlong, float latitude, float longitude) */
-static PHP_METHOD(SphinxClient, setGeoAnchor)
+/* reads back a list written by php_sphinx_servers_put(), the data may come from outside */
+static int php_sphinx_servers_get(const char **p, const char *end, php_sphinx_server **servers, int *num) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *attrlat, *attrlong;
-	int attrlat_len, attrlong_len, res;
-	double latitude, longitude;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ssdd", &attrlat, &attrlat_len, &attrlong, &attrlong_len, &latitude, &longitude) == FAILURE) {
-		return;
+	const char *host;
+	sphinx_int64_t port, weight;
+	int i;
+
+	*servers = NULL;
+	/* a server takes at least the host length, one slot of the host, the port and the weight */
+	if (php_sphinx_op_read_count(p, end, 4 * sizeof(sphinx_int64_t), num) == FAILURE) {
+		*num = 0;
+		return FAILURE;
+	}
+	if (!*num) {
+		return SUCCESS;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_set_geoanchor(c->sphinx, attrlat, attrlong, latitude, longitude);
-
-	if (!res) {
-		RETURN_FALSE;
+	*servers = safe_emalloc(*num, sizeof(php_sphinx_server), 0);
+	for (i = 0; i < *num; i++) {
+		if (php_sphinx_op_read_string(p, end, 0, &host) == FAILURE
+			|| php_sphinx_op_read_long(p, end, &port) == FAILURE
+			|| php_sphinx_op_read_long(p, end, &weight) == FAILURE
+			|| !host[0] || port < 1 || port > 65535 || weight <= 0 || weight > LONG_MAX) {
+			php_sphinx_servers_free(*servers, i);
+			*servers = NULL;
+			*num = 0;
+			return FAILURE;
+		}
+		(*servers)[i].host = estrdup(host);
+		(*servers)[i].port = (long)port;
+		(*servers)[i].weight = (long)weight;
 	}
-	RETURN_TRUE;
+	return SUCCESS;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setGroupBy(string attribute, int func[, string groupsort]) */
-static PHP_METHOD(SphinxClient, setGroupBy)
+/* accepts "host:port", "host" or "/path/to/unix.sock" entries, with weighted 
+   lists the entries may be given as "host:port" => weight */
+static php_sphinx_server *php_sphinx_servers_parse(zval *list, int *num, zend_bool weighted TSRMLS_DC) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *attribute, *groupsort = NULL;
-	int attribute_len, groupsort_len, res;
-	long func;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sl|s", &attribute, &attribute_len, &func, &groupsort, &groupsort_len) == FAILURE) {
-		return;
-	}
-	
-	if (groupsort == NULL) {
-		groupsort = "@group desc";
+	php_sphinx_server *servers;
+	zval **item, weight;
+	char *key, *str, *colon, *end;
+	uint key_len;
+	ulong idx;
+	int i, len;
+
+	*num = zend_hash_num_elements(Z_ARRVAL_P(list));
+	if (!*num) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "servers list is empty");
+		return NULL;
 	}
 
-	if (func < SPH_GROUPBY_DAY || func > SPH_GROUPBY_ATTRPAIR) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid group func specified (%ld)", func);
-		RETURN_FALSE;
-	}
+	servers = safe_emalloc(*num, sizeof(php_sphinx_server), 0);
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	for (i = 0, zend_hash_internal_pointer_reset(Z_ARRVAL_P(list));
+		 zend_hash_get_current_data(Z_ARRVAL_P(list), (void **) &item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(list)), i++) {
 
-	res = sphinx_set_groupby(c->sphinx, attribute, func, groupsort);
+		servers[i].weight = 1;
 
-	if (!res) {
-		RETURN_FALSE;
+		if (weighted && zend_hash_get_current_key_ex(Z_ARRVAL_P(list), &key, &key_len, &idx, 0, NULL) == HASH_KEY_IS_STRING) {
+			str = key;
+			len = key_len - 1;
+
+			weight = **item;
+			zval_copy_ctor(&weight);
+			convert_to_long(&weight);
+			servers[i].weight = Z_LVAL(weight);
+		} else if (Z_TYPE_PP(item) == IS_STRING) {
+			str = Z_STRVAL_PP(item);
+			len = Z_STRLEN_PP(item);
+		} else {
+			str = NULL;
+			len = 0;
+		}
+
+		if (!len || servers[i].weight <= 0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "server must be a non-empty string with a positive weight");
+			php_sphinx_servers_free(servers, i);
+			return NULL;
+		}
+
+		colon = (str[0] != '/') ? strrchr(str, ':') : NULL;
+		if (colon) {
+			servers[i].port = strtol(colon + 1, &end, 10);
+			if (end == colon + 1 || end != str + len || servers[i].port < 1 || servers[i].port > 65535) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid port in server '%s', expected 1-65535", str);
+				php_sphinx_servers_free(servers, i);
+				return NULL;
+			}
+			servers[i].host = estrndup(str, colon - str);
+		} else {
+			servers[i].host = estrndup(str, len);
+			servers[i].port = PHP_SPHINX_DEFAULT_PORT;
+		}
 	}
-	RETURN_TRUE;
+	return servers;
 }
 /* }}} */
+/* }}} */
 
-/* {{{ proto bool SphinxClient::setGroupDistinct(string attribute) */
-static PHP_METHOD(SphinxClient, setGroupDistinct)
+/* {{{ backends
+ * The latency and error rate of every searchd the worker talks to are tracked 
+ * across requests, so that setServers() can prefer the fast and healthy ones. 
+ * A failed backend is skipped until its backoff expires, the next request 
+ * picking it serves as the probe. */
+typedef struct _php_sphinx_backend {
+	double latency; /* EWMA of the answer time, seconds */
+	double errors; /* EWMA of the error rate */
+	double dead_until;
+	long failures; /* in a row */
+} php_sphinx_backend;
+
+#define PHP_SPHINX_EWMA_ALPHA 0.2
+#define PHP_SPHINX_BACKOFF_MIN 1.0
+#define PHP_SPHINX_BACKOFF_MAX 60.0
+
+static php_sphinx_backend *php_sphinx_backend_get(php_sphinx_server *server TSRMLS_DC) /* {{{ */
 {
-	php_sphinx_client *c;
-	char *attribute;
-	int attribute_len, res;
+	php_sphinx_backend *backend, empty;
+	char *key;
+	int key_len;
+
+	key_len = spprintf(&key, 0, "%s:%ld", server->host, server->port);
+	if (zend_hash_find(&SPHINX_G(backends), key, key_len + 1, (void **) &backend) == FAILURE) {
+		memset(&empty, 0, sizeof(empty));
+		zend_hash_update(&SPHINX_G(backends), key, key_len + 1, &empty, sizeof(empty), (void **) &backend);
+	}
+	efree(key);
+	return backend;
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &attribute, &attribute_len) == FAILURE) {
+static void php_sphinx_backend_update(php_sphinx_backend *backend, zend_bool ok, double elapsed) /* {{{ */
+{
+	double backoff;
+
+	if (ok) {
+		backend->latency = backend->latency > 0 ? backend->latency + PHP_SPHINX_EWMA_ALPHA * (elapsed - backend->latency) : elapsed;
+		backend->errors *= 1 - PHP_SPHINX_EWMA_ALPHA;
+		backend->failures = 0;
+		backend->dead_until = 0;
 		return;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	backend->errors += PHP_SPHINX_EWMA_ALPHA * (1 - backend->errors);
+	backend->failures++;
 
-	res = sphinx_set_groupby_distinct(c->sphinx, attribute);
-
-	if (!res) {
-		RETURN_FALSE;
-	}
-	RETURN_TRUE;
+	backoff = PHP_SPHINX_BACKOFF_MIN * (1 << MIN(backend->failures - 1, 16));
+	backend->dead_until = php_sphinx_time() + MIN(backoff, PHP_SPHINX_BACKOFF_MAX);
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setRetries(int count[, int delay]) */
-static PHP_METHOD(SphinxClient, setRetries)
+/* weighted random choice among the live servers not tried yet, the higher 
+   the weight and the lower the latency and the error rate, the better */
+static int php_sphinx_servers_pick(php_sphinx_client *c, const char *tried TSRMLS_DC) /* {{{ */
 {
-	php_sphinx_client *c;
-	long count, delay = 0;
-	int res;
+	php_sphinx_backend *backend;
+	double *scores, total = 0, now = php_sphinx_time(), r, earliest = 0;
+	int i, pick = -1;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|l", &count, &delay) == FAILURE) {
-		return; 
-	}
+	scores = safe_emalloc(c->num_servers, sizeof(double), 0);
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	for (i = 0; i < c->num_servers; i++) {
+		scores[i] = 0;
+		if (tried[i]) {
+			continue;
+		}
 
-	res = sphinx_set_retries(c->sphinx, (int)count, (int)delay);
+		backend = php_sphinx_backend_get(&c->servers[i] TSRMLS_CC);
+		if (backend->dead_until > now) {
+			/* if all of them are dead, probe the one to revive first */
+			if (pick < 0 || backend->dead_until < earliest) {
+				earliest = backend->dead_until;
+				pick = i;
+			}
+			continue;
+		}
 
-	if (!res) {
-		RETURN_FALSE;
+		scores[i] = c->servers[i].weight * (1 - backend->errors) / MAX(backend->latency, 0.001);
+		total += scores[i];
 	}
-	RETURN_TRUE;
+
+	if (total > 0) {
+		r = php_rand(TSRMLS_C) / (PHP_RAND_MAX + 1.0) * total;
+		for (i = 0; i < c->num_servers; i++) {
+			if (scores[i] > 0) {
+				pick = i;
+				r -= scores[i];
+				if (r < 0) {
+					break;
+				}
+			}
+		}
+	}
+
+	efree(scores);
+	return pick;
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setMaxQueryTime(int qtime) */
-static PHP_METHOD(SphinxClient, setMaxQueryTime)
+#ifdef HAVE_SPHINX_THREADS
+static sphinx_result *php_sphinx_client_run_search(php_sphinx_client *c, char *query, char *index, char *comment, double start TSRMLS_DC);
+#endif
+
+/* runs the search on the best server and retries it on the others as long as it fails, 
+   a NULL query runs the queued queries. With a deadline, the attempts run as jobs 
+   given up on once it passes. */
+static sphinx_result *php_sphinx_client_failover(php_sphinx_client *c, char *query, char *index, char *comment, double start TSRMLS_DC) /* {{{ */
 {
-	php_sphinx_client *c;
-	long qtime;
-	int res;
+	php_sphinx_server *server;
+	php_sphinx_backend *backend;
+	sphinx_client *sphinx;
+	sphinx_result *result = NULL;
+	char *tried;
+	double sent;
+	int i, attempt, left;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &qtime) == FAILURE) {
-		return;	
-	}
+	tried = ecalloc(c->num_servers, 1);
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	for (attempt = 0; attempt < c->num_servers; attempt++) {
+		left = php_sphinx_client_remaining(c, start);
+		if (!left) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "deadline of %.3f seconds exceeded", c->deadline);
+			break;
+		}
 
-	res = sphinx_set_max_query_time(c->sphinx, (int)qtime);
+		i = php_sphinx_servers_pick(c, tried TSRMLS_CC);
+		if (i < 0) {
+			break;
+		}
+		tried[i] = 1;
+		server = &c->servers[i];
 
-	if (!res) {
-		RETURN_FALSE;
+		if (attempt) {
+			/* the failed handle is in an unknown state, use a fresh one */
+			sphinx = php_sphinx_client_handle_new(c, 1 TSRMLS_CC);
+			if (!sphinx) {
+				break;
+			}
+			sphinx_destroy(c->sphinx);
+			c->sphinx = sphinx;
+			c->persistent = 0;
+			c->failed = 0;
+			c->backend = -1;
+		}
+
+		if (php_sphinx_client_use_backend(c, i TSRMLS_CC) == FAILURE) {
+			continue;
+		}
+
+		php_sphinx_client_cap(c, c->sphinx, left);
+		sent = php_sphinx_time();
+#ifdef HAVE_SPHINX_THREADS
+		if (left >= 0) {
+			result = php_sphinx_client_run_search(c, query, index, comment, start TSRMLS_CC);
+		} else
+#endif
+		if (query) {
+			result = sphinx_query(c->sphinx, query, index, comment);
+		} else {
+			result = sphinx_run_queries(c->sphinx);
+		}
+		php_sphinx_client_uncap(c, c->sphinx);
+
+		backend = php_sphinx_backend_get(server TSRMLS_CC);
+		php_sphinx_backend_update(backend, result != NULL, php_sphinx_time() - sent);
+		if (result || !c->sphinx) {
+			break;
+		}
+		if (left >= 0 && !php_sphinx_client_remaining(c, start)) {
+			/* timed out, the job has reported it */
+			break;
+		}
 	}
-	RETURN_TRUE;
+
+	efree(tried);
+	return result;
 }
 /* }}} */
+/* }}} */
 
-#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
-/* {{{ proto bool SphinxClient::setRankingMode(int ranker[, string ranking_expression]) */
-static PHP_METHOD(SphinxClient, setRankingMode)
+#if LIBSPHINX_VERSION_ID >= 99
+/* {{{ persistent connections pool */
+static int le_sphinx_pool;
+
+typedef struct _php_sphinx_pool_handle {
+	sphinx_client *sphinx;
+	unsigned int applied;
+	time_t last_used;
+} php_sphinx_pool_handle;
+
+/* idle connections to one searchd, the most recently used one is the last */
+typedef struct _php_sphinx_pool {
+	int num_idle;
+	int max_idle;
+	php_sphinx_pool_handle *idle;
+} php_sphinx_pool;
+
+static void php_sphinx_pool_handle_destroy(sphinx_client *sphinx) /* {{{ */
 {
-	php_sphinx_client *c;
-	long ranker;
-	int res, rank_expr_len;
-	char *rank_expr = NULL;
+	sphinx_close(sphinx);
+	sphinx_destroy(sphinx);
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|s", &ranker, &rank_expr, &rank_expr_len) == FAILURE) {
-		return;
+static ZEND_RSRC_DTOR_FUNC(php_sphinx_pool_dtor) /* {{{ */
+{
+	php_sphinx_pool *pool = (php_sphinx_pool *)rsrc->ptr;
+	int i;
+
+	for (i = 0; i < pool->num_idle; i++) {
+		php_sphinx_pool_handle_destroy(pool->idle[i].sphinx);
 	}
+	if (pool->idle) {
+		pefree(pool->idle, 1);
+	}
+	pefree(pool, 1);
+}
+/* }}} */
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+static php_sphinx_pool *php_sphinx_pool_get(php_sphinx_client *c, int create TSRMLS_DC) /* {{{ */
+{
+	zend_rsrc_list_entry *le, new_le;
+	php_sphinx_pool *pool = NULL;
+	char *key;
+	int key_len;
 
-	res = sphinx_set_ranking_mode(c->sphinx, (int)ranker, rank_expr);
+	key_len = spprintf(&key, 0, "sphinx_pool_%s:%ld", c->host ? c->host : PHP_SPHINX_DEFAULT_HOST, c->port);
 
-	if (!res) {
-		RETURN_FALSE;
+	if (zend_hash_find(&EG(persistent_list), key, key_len + 1, (void **)&le) == SUCCESS) {
+		if (le->type == le_sphinx_pool) {
+			pool = (php_sphinx_pool *)le->ptr;
+		}
+	} else if (create) {
+		pool = pecalloc(1, sizeof(php_sphinx_pool), 1);
+
+		new_le.type = le_sphinx_pool;
+		new_le.ptr = pool;
+		if (zend_hash_update(&EG(persistent_list), key, key_len + 1, (void *)&new_le, sizeof(zend_rsrc_list_entry), NULL) == FAILURE) {
+			pefree(pool, 1);
+			pool = NULL;
+		}
 	}
-	RETURN_TRUE;
+
+	efree(key);
+	return pool;
 }
 /* }}} */
-#else
-/* {{{ proto bool SphinxClient::setRankingMode(int ranker) */
-static PHP_METHOD(SphinxClient, setRankingMode)
-{
-	php_sphinx_client *c;
-	long ranker;
-	int res;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &ranker) == FAILURE) {
-		return;
+static void php_sphinx_pool_remove(php_sphinx_pool *pool, int i) /* {{{ */
+{
+	pool->num_idle--;
+	if (i < pool->num_idle) {
+		memmove(pool->idle + i, pool->idle + i + 1, (pool->num_idle - i) * sizeof(php_sphinx_pool_handle));
 	}
+}
+/* }}} */
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+static void php_sphinx_pool_expire(php_sphinx_pool *pool, time_t now TSRMLS_DC) /* {{{ */
+{
+	/* the oldest connections go first */
+	while (pool->num_idle > 0 && now - pool->idle[0].last_used > SPHINX_G(pool_idle_timeout)) {
+		php_sphinx_pool_handle_destroy(pool->idle[0].sphinx);
+		php_sphinx_pool_remove(pool, 0);
+	}
+}
+/* }}} */
 
-	res = sphinx_set_ranking_mode(c->sphinx, (int)ranker);
+/* restores the defaults for the settings the new owner doesn't set itself */
+static void php_sphinx_pool_handle_reset(sphinx_client *sphinx, unsigned int stale TSRMLS_DC) /* {{{ */
+{
+	sphinx_reset_filters(sphinx);
+	sphinx_reset_groupby(sphinx);
 
-	if (!res) {
-		RETURN_FALSE;
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_CONNECT_TIMEOUT)) {
+		sphinx_set_connect_timeout(sphinx, FG(default_socket_timeout));
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_LIMITS)) {
+		sphinx_set_limits(sphinx, 0, 20, 1000, 0);
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_SELECT)) {
+		sphinx_set_select(sphinx, "*");
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ID_RANGE)) {
+		sphinx_set_id_range(sphinx, 0, 0);
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_RETRIES)) {
+		sphinx_set_retries(sphinx, 0, 0);
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_MAX_QUERY_TIME)) {
+		sphinx_set_max_query_time(sphinx, 0);
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_RANKING_MODE)) {
+#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
+		sphinx_set_ranking_mode(sphinx, SPH_RANK_PROXIMITY_BM25, NULL);
+#else
+		sphinx_set_ranking_mode(sphinx, SPH_RANK_PROXIMITY_BM25);
+#endif
+	}
+	if (stale & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_SORT_MODE)) {
+		sphinx_set_sort_mode(sphinx, SPH_SORT_RELEVANCE, NULL);
 	}
-	RETURN_TRUE;
 }
 /* }}} */
-#endif
 
-/* {{{ proto bool SphinxClient::setFieldWeights(array weights) */
-static PHP_METHOD(SphinxClient, setFieldWeights)
+static int php_sphinx_pool_acquire(php_sphinx_client *c TSRMLS_DC) /* {{{ */
 {
-	php_sphinx_client *c;
-	zval *weights, **item;
-	int num_weights, res = 0, i;
-	int *field_weights;
-	char **field_names;
-	char *string_key;
-	unsigned int string_key_len;
-	unsigned long int num_key;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &weights) == FAILURE) {
-		return;
+	php_sphinx_pool *pool;
+	php_sphinx_pool_handle h;
+	unsigned int mask, stale;
+	time_t now;
+	int i;
+
+	pool = php_sphinx_pool_get(c, 0 TSRMLS_CC);
+	if (!pool) {
+		return FAILURE;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	now = time(NULL);
+	php_sphinx_pool_expire(pool, now TSRMLS_CC);
 
-	num_weights = zend_hash_num_elements(Z_ARRVAL_P(weights));
-	if (!num_weights) {
-		/* check for empty array and return false right away */
-		RETURN_FALSE;
-	}
+	mask = php_sphinx_ops_mask(c->ops);
+	for (i = pool->num_idle - 1; i >= 0; i--) {
+		h = pool->idle[i];
+		stale = h.applied & ~mask;
 
-	field_names = safe_emalloc(num_weights, sizeof(char *), 0);
-	field_weights = safe_emalloc(num_weights, sizeof(int), 0);
+		/* overrides cannot be removed at all, other settings have to be set by the new owner */
+		if ((h.applied & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_OVERRIDE)) || (stale & PHP_SPHINX_OPS_NO_RESET)) {
+			continue;
+		}
 
-	/* reset num_weights, we'll reuse it count _real_ number of entries */
-	num_weights = 0;
+		php_sphinx_pool_remove(pool, i);
 
-	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(weights)); 
-		 zend_hash_get_current_data(Z_ARRVAL_P(weights), (void **)&item) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(weights))) {
-		
-		if (zend_hash_get_current_key_ex(Z_ARRVAL_P(weights), &string_key, &string_key_len, &num_key, 0, NULL) != HASH_KEY_IS_STRING) {
-			/* if the key is not string.. well.. you're screwed */
-			break;
+		if (SPHINX_G(pool_ping_interval) >= 0 && now - h.last_used >= SPHINX_G(pool_ping_interval)) {
+			int num_rows, num_cols;
+			char **status;
+
+			status = sphinx_status(h.sphinx, &num_rows, &num_cols);
+			if (!status) {
+				/* searchd has gone away */
+				php_sphinx_pool_handle_destroy(h.sphinx);
+				continue;
+			}
+			sphinx_status_destroy(status, num_rows, num_cols);
 		}
 
-		convert_to_long_ex(item);
-		
-		field_names[num_weights] = estrndup(string_key, string_key_len);
-		field_weights[num_weights] = Z_LVAL_PP(item);
+		php_sphinx_pool_handle_reset(h.sphinx, stale TSRMLS_CC);
+		if (php_sphinx_ops_apply(h.sphinx, c->ops) == FAILURE) {
+			php_sphinx_pool_handle_destroy(h.sphinx);
+			continue;
+		}
 
-		num_weights++;
+		sphinx_destroy(c->sphinx);
+		c->sphinx = h.sphinx;
+		c->backend = -1;
+		c->applied = h.applied | mask;
+		return SUCCESS;
 	}
+	return FAILURE;
+}
+/* }}} */
 
-	if (num_weights) {
-		res = sphinx_set_field_weights(c->sphinx, num_weights, (const char **) field_names, field_weights);
+static int php_sphinx_pool_release(php_sphinx_client *c TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_pool *pool;
+	php_sphinx_pool_handle *h;
+
+	if (SPHINX_G(pool_max_idle) <= 0) {
+		return FAILURE;
 	}
 
-	for (i = 0; i != num_weights; i++) {
-		efree(field_names[i]);
+	/* neither queued queries nor overrides can be removed from the handle and one talking 
+	   to a backend of setServers() does not belong to the pool of the configured server */
+	if (c->backend >= 0 || (c->applied & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_OVERRIDE))
+		|| (php_sphinx_ops_mask(c->ops) & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ADD_QUERY))) {
+		return FAILURE;
 	}
-	efree(field_names);
-	efree(field_weights);
 
-	if (!res) {
-		RETURN_FALSE;
+	pool = php_sphinx_pool_get(c, 1 TSRMLS_CC);
+	if (!pool) {
+		return FAILURE;
 	}
-	RETURN_TRUE;
+
+	php_sphinx_pool_expire(pool, time(NULL) TSRMLS_CC);
+	if (pool->num_idle >= SPHINX_G(pool_max_idle)) {
+		return FAILURE;
+	}
+
+	if (pool->num_idle == pool->max_idle) {
+		pool->max_idle = pool->max_idle ? pool->max_idle * 2 : 4;
+		pool->idle = perealloc(pool->idle, pool->max_idle * sizeof(php_sphinx_pool_handle), 1);
+	}
+
+	h = &pool->idle[pool->num_idle++];
+	h->sphinx = c->sphinx;
+	h->applied = c->applied;
+	h->last_used = time(NULL);
+
+	c->sphinx = NULL;
+	return SUCCESS;
 }
 /* }}} */
+/* }}} */
+#endif
 
-/* {{{ proto bool SphinxClient::setSortMode(int mode[, string sortby]) */
-static PHP_METHOD(SphinxClient, setSortMode)
+#ifdef HAVE_SPHINX_THREADS
+/* {{{ background jobs
+ * libsphinxclient only has blocking calls, so the request is run in a separate 
+ * thread owning the handle until the job is joined. The thread must not touch 
+ * anything but the handle. Completion is signalled through a pipe, so that 
+ * the jobs can be polled. libsphinxclient resolves host names with the 
+ * non-reentrant gethostbyname(), so the connection is opened by the calling 
+ * thread before the job starts and the worker only talks over the socket. */
+typedef struct _php_sphinx_job php_sphinx_job;
+
+typedef void (*php_sphinx_job_func)(php_sphinx_job *job);
+
+struct _php_sphinx_job {
+	php_sphinx_job_func func;
+	sphinx_client *sphinx;
+	sphinx_result *results;
+	char *query; /* arguments of sphinx_query() */
+	char *index;
+	char *comment;
+	char **attrs; /* arguments of sphinx_update_attributes() */
+	int num_attrs;
+	int num_docs;
+	sphinx_uint64_t *docids;
+	sphinx_int64_t *values;
+	int updated;
+	const char **docs; /* arguments of sphinx_build_excerpts(), owned by the caller who always joins */
+	const char *words;
+	sphinx_excerpt_options *opts;
+	char **excerpts;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int fds[2];
+	zend_bool started;
+	zend_bool opened; /* the connection was opened for the job and is closed by it */
+	zend_bool joined;
+	zend_bool done;
+	php_sphinx_job *next; /* in the list of abandoned jobs */
+};
+
+/* abandoned jobs are kept until their threads finish, MSHUTDOWN cancels the rest */
+static php_sphinx_job *php_sphinx_abandoned_jobs = NULL;
+static pthread_mutex_t php_sphinx_abandoned_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void php_sphinx_job_run_queries(php_sphinx_job *job) /* {{{ */
 {
-	php_sphinx_client *c;
-	long mode;
-	char *sortby = NULL;
-	int sortby_len, res;
+	job->results = sphinx_run_queries(job->sphinx);
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|s", &mode, &sortby, &sortby_len) == FAILURE) {
-		return;
-	}
+static void php_sphinx_job_query(php_sphinx_job *job) /* {{{ */
+{
+	job->results = sphinx_query(job->sphinx, job->query, job->index, job->comment);
+}
+/* }}} */
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+static void php_sphinx_job_update(php_sphinx_job *job) /* {{{ */
+{
+	job->updated = sphinx_update_attributes(job->sphinx, job->index, job->num_attrs, (const char **)job->attrs, 
+			job->num_docs, job->docids, job->values);
+}
+/* }}} */
+
+static void php_sphinx_job_excerpts(php_sphinx_job *job) /* {{{ */
+{
+	job->excerpts = sphinx_build_excerpts(job->sphinx, job->num_docs, job->docs, job->index, job->words, job->opts);
+}
+/* }}} */
 
-	res = sphinx_set_sort_mode(c->sphinx, (int)mode, sortby); 
+static void php_sphinx_job_release(php_sphinx_job *job) /* {{{ */
+{
+	int i;
 
-	if (!res) {
-		RETURN_FALSE;
+	if (job->fds[0] >= 0) {
+		close(job->fds[0]);
 	}
-	RETURN_TRUE;
+	if (job->fds[1] >= 0) {
+		close(job->fds[1]);
+	}
+	if (job->query) {
+		pefree(job->query, 1);
+		pefree(job->comment, 1);
+	}
+	if (job->index) {
+		pefree(job->index, 1);
+	}
+	if (job->attrs) {
+		for (i = 0; i < job->num_attrs; i++) {
+			pefree(job->attrs[i], 1);
+		}
+		pefree(job->attrs, 1);
+		pefree(job->docids, 1);
+		pefree(job->values, 1);
+	}
+	pthread_mutex_destroy(&job->lock);
+	pefree(job, 1);
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setConnectTimeout(float timeout) */
-static PHP_METHOD(SphinxClient, setConnectTimeout)
-{   
-	php_sphinx_client *c;
-	double timeout;
-	int res;
+static void *php_sphinx_job_thread(void *arg) /* {{{ */
+{
+	php_sphinx_job *job = (php_sphinx_job *)arg;
+	char done = 1;
+	int state;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "d", &timeout) == FAILURE) {
-		return;
+	/* only the blocking request may be cancelled at shutdown */
+	job->func(job);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+#if LIBSPHINX_VERSION_ID >= 99
+	if (job->opened) {
+		sphinx_close(job->sphinx);
 	}
+#endif
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_set_connect_timeout(c->sphinx, timeout);
+	pthread_mutex_lock(&job->lock);
+	job->done = 1;
+	pthread_mutex_unlock(&job->lock);
 
-	if (!res) {
-		RETURN_FALSE;
+	if (write(job->fds[1], &done, 1) < 0) {
+		/* nothing to do, the job is joined anyway */
 	}
-	RETURN_TRUE;
-}   
+	/* jobs without a thread run on the caller's */
+	pthread_setcancelstate(state, NULL);
+	return NULL;
+}
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setArrayResult(bool array_result) */
-static PHP_METHOD(SphinxClient, setArrayResult)
+/* jobs may outlive the request when abandoned, so they are allocated persistently */
+static php_sphinx_job *php_sphinx_job_new(sphinx_client *sphinx, php_sphinx_job_func func) /* {{{ */
 {
-	php_sphinx_client *c;
-	zend_bool array_result;
+	php_sphinx_job *job;
+
+	job = pecalloc(1, sizeof(php_sphinx_job), 1);
+	job->sphinx = sphinx;
+	job->func = func;
+	job->fds[0] = job->fds[1] = -1;
+	job->updated = -1;
+	pthread_mutex_init(&job->lock, NULL);
+	return job;
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "b", &array_result) == FAILURE) {
-		return;
-	}
+static void php_sphinx_job_set_query(php_sphinx_job *job, const char *query, const char *index, const char *comment) /* {{{ */
+{
+	job->query = pestrdup(query, 1);
+	job->index = pestrdup(index, 1);
+	job->comment = pestrdup(comment, 1);
+}
+/* }}} */
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+/* the job takes over the docids and values, which must be allocated persistently */
+static void php_sphinx_job_set_update(php_sphinx_job *job, const char *index, const char **attrs, int num_attrs, 
+		sphinx_uint64_t *docids, sphinx_int64_t *values, int num_docs) /* {{{ */
+{
+	int i;
 
-	c->array_result = array_result; 
-	RETURN_TRUE;
+	job->index = pestrdup(index, 1);
+	job->attrs = pemalloc(num_attrs * sizeof(char *), 1);
+	for (i = 0; i < num_attrs; i++) {
+		job->attrs[i] = pestrdup(attrs[i], 1);
+	}
+	job->num_attrs = num_attrs;
+	job->docids = docids;
+	job->values = values;
+	job->num_docs = num_docs;
 }
 /* }}} */
 
-/* {{{ proto int SphinxClient::updateAttributes(string index, array attributes, array values[, bool mva]) */
-static PHP_METHOD(SphinxClient, updateAttributes)
+/* returns 0 when the connection failed, the error is kept in the handle */
+static int php_sphinx_job_connect(php_sphinx_job *job) /* {{{ */
 {
-	php_sphinx_client *c;
-	zval *attributes, *values, **item; 
-	char *index;
-	const char **attrs;
-	int index_len, attrs_num, values_num;
-	int res = 0;
-	sphinx_uint64_t *docids = NULL;
-	sphinx_int64_t *vals = NULL;
-	unsigned int *vals_mva = NULL;
-#if LIBSPHINX_VERSION_ID >= 110
-	int res_mva, values_mva_num, values_mva_size = 0;
-	zval **attr_value_mva;
+#if LIBSPHINX_VERSION_ID >= 99
+	if (sphinx_open(job->sphinx)) {
+		job->opened = 1;
+		return 1;
+	}
+	/* persistent connections are reused as they are */
+	return strcmp(sphinx_error(job->sphinx), "already connected") == 0;
+#else
+	return 1;
 #endif
-	int a = 0, i = 0, j = 0;
-	zend_bool mva = 0;
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "saa|b", &index, &index_len, &attributes, &values, &mva) == FAILURE) {
+static void php_sphinx_job_start(php_sphinx_job *job) /* {{{ */
+{
+	if (!php_sphinx_job_connect(job)) {
+		/* the job fails right away, leaving the error to the handle */
+		job->done = 1;
+		job->joined = 1;
 		return;
 	}
 
-#if LIBSPHINX_VERSION_ID < 110
-	if (mva) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "update mva attributes is not supported");
-		RETURN_FALSE;
+#if LIBSPHINX_VERSION_ID >= 99
+	/* without sphinx_open() the worker would have to connect itself */
+	if (pipe(job->fds) == 0) {
+		if (pthread_create(&job->thread, NULL, php_sphinx_job_thread, job) == 0) {
+			job->started = 1;
+			return;
+		}
 	}
 #endif
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	/* no thread, run it right away */
+	php_sphinx_job_thread(job);
+	job->joined = 1;
+}
+/* }}} */
 
-	attrs_num = zend_hash_num_elements(Z_ARRVAL_P(attributes));
+/* returns 1 when the job is done, timeout is in milliseconds, -1 waits forever */
+static int php_sphinx_job_ready(php_sphinx_job *job, int timeout) /* {{{ */
+{
+	struct pollfd pfd;
+	int res;
 
-	if (!attrs_num) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty attributes array passed");
-		RETURN_FALSE;
+	if (job->joined || job->fds[0] < 0) {
+		return 1;
 	}
 
-	values_num = zend_hash_num_elements(Z_ARRVAL_P(values));
+	pfd.fd = job->fds[0];
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 
-	if (!values_num) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty values array passed");
+	do {
+		res = poll(&pfd, 1, timeout);
+	} while (res < 0 && errno == EINTR);
+
+	return res > 0;
+}
+/* }}} */
+
+/* waits for either of the jobs and returns the one which is done, NULL on timeout */
+static php_sphinx_job *php_sphinx_job_first(php_sphinx_job *a, php_sphinx_job *b, int timeout) /* {{{ */
+{
+	struct pollfd pfds[2];
+	int res;
+
+	if (a->joined || a->fds[0] < 0) {
+		return a;
+	}
+	if (b->joined || b->fds[0] < 0) {
+		return b;
+	}
+
+	pfds[0].fd = a->fds[0];
+	pfds[1].fd = b->fds[0];
+	pfds[0].events = pfds[1].events = POLLIN;
+	pfds[0].revents = pfds[1].revents = 0;
+
+	do {
+		res = poll(pfds, 2, timeout);
+	} while (res < 0 && errno == EINTR);
+
+	if (res <= 0) {
+		return NULL;
+	}
+	return pfds[0].revents ? a : b;
+}
+/* }}} */
+
+/* waits for any of the jobs and returns its position, -1 on error */
+static int php_sphinx_job_any(php_sphinx_job **jobs, int num) /* {{{ */
+{
+	struct pollfd *pfds;
+	int i, res;
+
+	for (i = 0; i < num; i++) {
+		if (jobs[i] && (jobs[i]->joined || jobs[i]->fds[0] < 0)) {
+			return i;
+		}
+	}
+
+	pfds = safe_emalloc(num, sizeof(struct pollfd), 0);
+	for (i = 0; i < num; i++) {
+		pfds[i].fd = jobs[i] ? jobs[i]->fds[0] : -1; /* negative descriptors are ignored */
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+
+	do {
+		res = poll(pfds, num, -1);
+	} while (res < 0 && errno == EINTR);
+
+	for (i = 0; res > 0 && i < num; i++) {
+		if (pfds[i].revents) {
+			break;
+		}
+	}
+	efree(pfds);
+	return res > 0 && i < num ? i : -1;
+}
+/* }}} */
+
+static void php_sphinx_job_wait(php_sphinx_job *job) /* {{{ */
+{
+	if (!job->joined) {
+		pthread_join(job->thread, NULL);
+		job->joined = 1;
+	}
+}
+/* }}} */
+
+static void php_sphinx_job_free(php_sphinx_job *job) /* {{{ */
+{
+	php_sphinx_job_wait(job);
+	php_sphinx_job_release(job);
+}
+/* }}} */
+
+static void php_sphinx_job_destroy(php_sphinx_job *job) /* {{{ */
+{
+	php_sphinx_job_wait(job);
+	sphinx_destroy(job->sphinx);
+	php_sphinx_job_release(job);
+}
+/* }}} */
+
+static zend_bool php_sphinx_job_done(php_sphinx_job *job) /* {{{ */
+{
+	zend_bool done;
+
+	if (job->joined) {
+		return 1;
+	}
+	pthread_mutex_lock(&job->lock);
+	done = job->done;
+	pthread_mutex_unlock(&job->lock);
+	return done;
+}
+/* }}} */
+
+/* frees the abandoned jobs which are done, or all of them cancelling the rest */
+static void php_sphinx_jobs_reap(zend_bool all) /* {{{ */
+{
+	php_sphinx_job **prev, *job;
+
+	pthread_mutex_lock(&php_sphinx_abandoned_lock);
+	prev = &php_sphinx_abandoned_jobs;
+	while ((job = *prev) != NULL) {
+		if (!php_sphinx_job_done(job)) {
+			if (!all) {
+				prev = &job->next;
+				continue;
+			}
+			/* libsphinxclient does not expose the socket, the blocking read is a cancellation point */
+			pthread_cancel(job->thread);
+		}
+		*prev = job->next;
+		php_sphinx_job_destroy(job);
+	}
+	pthread_mutex_unlock(&php_sphinx_abandoned_lock);
+}
+/* }}} */
+
+/* gives up on the job, the handle is destroyed together with it */
+static void php_sphinx_job_abandon(php_sphinx_job *job) /* {{{ */
+{
+	php_sphinx_jobs_reap(0);
+
+	if (php_sphinx_job_done(job)) {
+		php_sphinx_job_destroy(job);
+		return;
+	}
+
+	/* joined and freed once the answer arrives or at shutdown */
+	pthread_mutex_lock(&php_sphinx_abandoned_lock);
+	job->next = php_sphinx_abandoned_jobs;
+	php_sphinx_abandoned_jobs = job;
+	pthread_mutex_unlock(&php_sphinx_abandoned_lock);
+}
+/* }}} */
+
+static void php_sphinx_client_wait(php_sphinx_client *c) /* {{{ */
+{
+	if (c->job) {
+		php_sphinx_job_wait(c->job);
+	}
+}
+/* }}} */
+
+/* the results of sendQueries() are lost once the handle is used for another request */
+static void php_sphinx_client_drop_job(php_sphinx_client *c) /* {{{ */
+{
+	if (c->job) {
+		php_sphinx_job_free(c->job);
+		c->job = NULL;
+	}
+}
+/* }}} */
+/* }}} */
+
+/* {{{ hedged requests
+ * With several replicas, a request not answered within the hedge delay is
+ * sent to the next replica as well, and the first successful answer wins. 
+ * The slower handle is abandoned to its thread. */
+static void php_sphinx_client_free_replicas(php_sphinx_client *c) /* {{{ */
+{
+	php_sphinx_servers_free(c->replicas, c->num_replicas);
+	c->replicas = NULL;
+	c->num_replicas = 0;
+	c->replica = 0;
+}
+/* }}} */
+
+static int php_sphinx_compare_doubles(const void *a, const void *b) /* {{{ */
+{
+	double d = *(const double *)a - *(const double *)b;
+
+	return d < 0 ? -1 : (d > 0 ? 1 : 0);
+}
+/* }}} */
+
+/* returns the hedge delay in milliseconds */
+static int php_sphinx_client_hedge_delay(php_sphinx_client *c) /* {{{ */
+{
+	double sorted[PHP_SPHINX_LATENCY_SAMPLES];
+	int num;
+
+	if (c->hedge_delay >= 0) {
+		return (int)(c->hedge_delay * 1000);
+	}
+
+	num = MIN(c->num_latency, PHP_SPHINX_LATENCY_SAMPLES);
+	if (num < PHP_SPHINX_LATENCY_MIN_SAMPLES) {
+		return (int)(PHP_SPHINX_DEFAULT_HEDGE_DELAY * 1000);
+	}
+
+	/* p95 of the recent answers */
+	memcpy(sorted, c->latency, num * sizeof(double));
+	qsort(sorted, num, sizeof(double), php_sphinx_compare_doubles);
+	return (int)(sorted[num * 95 / 100] * 1000);
+}
+/* }}} */
+
+/* the handle is left to the timed out job, the client continues with a fresh one, 
+   if that cannot be built the client is left uninitialized */
+static void php_sphinx_client_timed_out(php_sphinx_client *c TSRMLS_DC) /* {{{ */
+{
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "deadline of %.3f seconds exceeded", c->deadline);
+	c->sphinx = php_sphinx_client_handle_new(c, 0 TSRMLS_CC);
+	c->persistent = 0;
+	c->backend = -1;
+	c->failed = 0;
+	if (!c->sphinx) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to create a new handle after the timeout");
+	}
+}
+/* }}} */
+
+/* runs the job on the client's handle until the deadline, the job is freed */
+static sphinx_result *php_sphinx_client_run_job(php_sphinx_client *c, php_sphinx_job *job, double start TSRMLS_DC) /* {{{ */
+{
+	sphinx_result *results;
+
+	php_sphinx_job_start(job);
+
+	if (!php_sphinx_job_ready(job, php_sphinx_client_remaining(c, start))) {
+		php_sphinx_job_abandon(job);
+		php_sphinx_client_timed_out(c TSRMLS_CC);
+		return NULL;
+	}
+
+	php_sphinx_job_wait(job);
+	results = job->results;
+	php_sphinx_job_free(job);
+	return results;
+}
+/* }}} */
+
+/* runs the search on the client's handle until the deadline */
+static sphinx_result *php_sphinx_client_run_search(php_sphinx_client *c, char *query, char *index, char *comment, double start TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_job *job = php_sphinx_job_new(c->sphinx, query ? php_sphinx_job_query : php_sphinx_job_run_queries);
+
+	if (query) {
+		php_sphinx_job_set_query(job, query, index, comment);
+	}
+	return php_sphinx_client_run_job(c, job, start TSRMLS_CC);
+}
+/* }}} */
+
+/* runs the job on the client's handle and hedges it if needed, the job is freed */
+static sphinx_result *php_sphinx_client_hedge(php_sphinx_client *c, php_sphinx_job *job, double start TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_job *hedge = NULL, *winner = job, *other;
+	php_sphinx_server *r;
+	sphinx_client *sphinx;
+	sphinx_result *results;
+	int next = (c->replica + 1) % c->num_replicas;
+	int delay, left;
+
+	php_sphinx_job_start(job);
+
+	delay = php_sphinx_client_hedge_delay(c);
+	left = php_sphinx_client_remaining(c, start);
+	if (left >= 0 && left < delay) {
+		delay = left;
+	}
+
+	if (!php_sphinx_job_ready(job, delay) && php_sphinx_client_remaining(c, start)) {
+		r = &c->replicas[next];
+		sphinx = php_sphinx_client_handle_new(c, 1 TSRMLS_CC);
+		if (sphinx && sphinx_set_server(sphinx, r->host, (int)r->port)) {
+			php_sphinx_client_cap(c, sphinx, php_sphinx_client_remaining(c, start));
+			hedge = php_sphinx_job_new(sphinx, job->func);
+			if (job->query) {
+				php_sphinx_job_set_query(hedge, job->query, job->index, job->comment);
+			}
+			php_sphinx_job_start(hedge);
+		} else if (sphinx) {
+			sphinx_destroy(sphinx);
+		}
+	}
+
+	if (hedge) {
+		winner = php_sphinx_job_first(job, hedge, php_sphinx_client_remaining(c, start));
+		if (!winner) {
+			php_sphinx_job_abandon(hedge);
+			php_sphinx_job_abandon(job);
+			php_sphinx_client_timed_out(c TSRMLS_CC);
+			return NULL;
+		}
+		other = (winner == job) ? hedge : job;
+
+		php_sphinx_job_wait(winner);
+		if (!winner->results && php_sphinx_job_ready(other, php_sphinx_client_remaining(c, start))) {
+			/* failed, the other one may still succeed */
+			php_sphinx_job_wait(other);
+			if (other->results) {
+				winner = other;
+			}
+		}
+
+		if (winner == hedge) {
+			/* the pooled connection, if any, goes away with the slow handle */
+			c->sphinx = hedge->sphinx;
+			c->persistent = 0;
+			c->replica = next;
+			php_sphinx_job_abandon(job);
+		} else {
+			php_sphinx_job_abandon(hedge);
+		}
+	} else if (!php_sphinx_job_ready(job, php_sphinx_client_remaining(c, start))) {
+		php_sphinx_job_abandon(job);
+		php_sphinx_client_timed_out(c TSRMLS_CC);
+		return NULL;
+	}
+
+	php_sphinx_job_wait(winner);
+	results = winner->results;
+	if (results) {
+		c->latency[c->num_latency++ % PHP_SPHINX_LATENCY_SAMPLES] = php_sphinx_time() - start;
+	}
+	php_sphinx_job_free(winner);
+	return results;
+}
+/* }}} */
+/* }}} */
+#else
+# define php_sphinx_client_wait(c)
+# define php_sphinx_client_drop_job(c)
+#endif
+
+static void php_sphinx_client_resolve(php_sphinx_client *c, sphinx_result *results TSRMLS_DC);
+
+/* {{{ attribute sets */
+static void php_sphinx_attrs_free(HashTable *attrs) /* {{{ */
+{
+	if (attrs) {
+		zend_hash_destroy(attrs);
+		FREE_HASHTABLE(attrs);
+	}
+}
+/* }}} */
+
+static HashTable *php_sphinx_attrs_copy(HashTable *attrs) /* {{{ */
+{
+	HashTable *copy;
+	char tmp;
+
+	if (!attrs) {
+		return NULL;
+	}
+	ALLOC_HASHTABLE(copy);
+	zend_hash_init(copy, zend_hash_num_elements(attrs), NULL, NULL, 0);
+	zend_hash_copy(copy, attrs, NULL, &tmp, sizeof(tmp));
+	return copy;
+}
+/* }}} */
+/* }}} */
+
+static void php_sphinx_client_obj_dtor(void *object TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_client *c = (php_sphinx_client *)object;
+
+	/* the deferred queries never run */
+	php_sphinx_client_resolve(c, NULL TSRMLS_CC);
+	php_sphinx_client_drop_job(c);
+	php_sphinx_client_detach_results(c, 0 TSRMLS_CC);
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_client_free_replicas(c);
+#endif
+#if LIBSPHINX_VERSION_ID >= 99
+	if (c->sphinx && c->persistent && !c->failed) {
+		php_sphinx_pool_release(c TSRMLS_CC);
+	}
+#endif
+	if (c->sphinx) {
+		sphinx_destroy(c->sphinx);
+	}
+	php_sphinx_ops_free(c->ops);
+	php_sphinx_servers_free(c->servers, c->num_servers);
+	php_sphinx_attrs_free(c->scalar_attrs);
+	if (c->host) {
+		efree(c->host);
+	}
+	zend_object_std_dtor(&c->std TSRMLS_CC);
+	efree(c);
+}
+/* }}} */
+
+static zend_object_value php_sphinx_client_new(zend_class_entry *ce TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_client *c;
+	zend_object_value retval;
+#if PHP_VERSION_ID < 50399
+	zval *tmp;
+#endif
+
+	c = ecalloc(1, sizeof(*c));
+	c->backend = -1;
+	zend_object_std_init(&c->std, ce TSRMLS_CC);
+
+#if PHP_VERSION_ID < 50399
+	ALLOC_HASHTABLE(c->std.properties);
+	zend_hash_init(c->std.properties, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(c->std.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, (void *) &tmp, sizeof(zval *));
+#else
+	object_properties_init(&c->std, ce);
+#endif
+	retval.handle = zend_objects_store_put(c, (zend_objects_store_dtor_t)zend_objects_destroy_object, php_sphinx_client_obj_dtor, NULL TSRMLS_CC);
+	retval.handlers = &php_sphinx_client_handlers;
+	return retval;
+}
+/* }}} */
+
+/* the copy gets the settings journal and a handle of its own built from it, 
+   the queued queries, the results, the background job and the pooled connection 
+   stay with the original */
+static zend_object_value php_sphinx_client_clone(zval *object TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_client *c, *copy;
+	zend_object_value retval;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(object TSRMLS_CC);
+	retval = php_sphinx_client_new(Z_OBJCE_P(object) TSRMLS_CC);
+	copy = (php_sphinx_client *)zend_object_store_get_object_by_handle(retval.handle TSRMLS_CC);
+	zend_objects_clone_members(&copy->std, retval, &c->std, Z_OBJ_HANDLE_P(object) TSRMLS_CC);
+
+	if (!c->sphinx) {
+		/* not constructed, neither is the copy */
+		return retval;
+	}
+
+	copy->array_result = c->array_result;
+	copy->result_format = c->result_format;
+	copy->cache_ttl = c->cache_ttl;
+	copy->ops = php_sphinx_ops_copy(c->ops);
+	php_sphinx_ops_queries_done(copy);
+	copy->host = c->host ? estrdup(c->host) : NULL;
+	copy->port = c->port;
+	copy->servers = php_sphinx_servers_copy(c->servers, c->num_servers);
+	copy->num_servers = c->num_servers;
+	copy->connect_timeout = c->connect_timeout;
+	copy->max_query_time = c->max_query_time;
+	copy->deadline = c->deadline;
+	copy->auto_batch = c->auto_batch;
+	copy->compact_filters = c->compact_filters;
+	copy->scalar_attrs = php_sphinx_attrs_copy(c->scalar_attrs);
+#ifdef HAVE_SPHINX_THREADS
+	copy->replicas = php_sphinx_servers_copy(c->replicas, c->num_replicas);
+	copy->num_replicas = c->num_replicas;
+	copy->replica = c->replica;
+	copy->hedge_delay = c->hedge_delay;
+	memcpy(copy->latency, c->latency, sizeof(c->latency));
+	copy->num_latency = c->num_latency;
+#endif
+
+	copy->sphinx = php_sphinx_client_handle_new(copy, 0 TSRMLS_CC);
+	if (!copy->sphinx) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to create a handle for the copy of SphinxClient");
+	}
+	copy->applied = php_sphinx_ops_mask(copy->ops);
+	return retval;
+}
+/* }}} */
+
+#if PHP_MAJOR_VERSION >= 5 && PHP_MINOR_VERSION >= 4
+static zval *php_sphinx_client_read_property(zval *object, zval *member, int type, const zend_literal *key TSRMLS_DC)
+#else
+static zval *php_sphinx_client_read_property(zval *object, zval *member, int type TSRMLS_DC) /* {{{ */
+#endif
+{
+	zval tmp_member;
+	zval *retval;
+	zend_object_handlers *std_hnd;
+
+	if (member->type != IS_STRING) {
+		tmp_member = *member;
+		zval_copy_ctor(&tmp_member);
+		convert_to_string(&tmp_member);
+		member = &tmp_member;
+	}
+
+	/* XXX we can either create retval ourselves (for custom properties) or use standard handlers */
+
+	std_hnd = zend_get_std_object_handlers();
+#if PHP_MAJOR_VERSION >= 5 && PHP_MINOR_VERSION >= 4
+	retval = std_hnd->read_property(object, member, type, key TSRMLS_CC);
+#else
+	retval = std_hnd->read_property(object, member, type TSRMLS_CC);
+#endif
+
+	if (member == &tmp_member) {
+		zval_dtor(member);
+	}
+	return retval;
+}
+/* }}} */
+
+static HashTable *php_sphinx_client_get_properties(zval *object TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_client *c;
+	const char *warning, *error;
+	zval *tmp;
+	HashTable *props;
+
+	c = (php_sphinx_client *)zend_objects_get_address(object TSRMLS_CC);
+
+	props = zend_std_get_properties(object TSRMLS_CC);
+
+	error = sphinx_error(c->sphinx);
+	MAKE_STD_ZVAL(tmp);
+	ZVAL_STRING(tmp, (char *)error, 1);
+	zend_hash_update(props, "error", sizeof("error"), (void *)&tmp, sizeof(zval *), NULL);
+
+	warning = sphinx_warning(c->sphinx);
+	MAKE_STD_ZVAL(tmp);
+	ZVAL_STRING(tmp, (char *)warning, 1);
+	zend_hash_update(props, "warning", sizeof("warning"), (void *)&tmp, sizeof(zval *), NULL);
+	return c->std.properties;
+}
+/* }}} */
+
+#ifdef TONY_200807015
+static inline void php_sphinx_error(php_sphinx_client *c TSRMLS_DC) /* {{{ */
+{
+	const char *err;
+
+	err = sphinx_error(c->sphinx);
+	if (!err || err[0] == '\0') {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown error");
+	} else {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", err);
+	}
+}
+/* }}} */
+#endif
+
+static void php_sphinx_attr_to_zval(sphinx_result *result, int i, int j, zval *value) /* {{{ */
+{
+#if SIZEOF_LONG != 8
+	double float_value;
+	char buf[128];
+#endif
+
+	switch(result->attr_types[j]) {
+		case SPH_ATTR_MULTI | SPH_ATTR_INTEGER:
+			{
+				int k;
+				unsigned int *mva = sphinx_get_mva(result, i, j);
+				unsigned int tmp, num;
+
+				if (!mva) {
+					array_init(value);
+					break;
+				}
+
+				memcpy(&num, mva, sizeof(unsigned int));
+				array_init_size(value, num);
+
+				for (k = 1; k <= num; k++) {
+					mva++;
+					memcpy(&tmp, mva, sizeof(unsigned int));
+#if SIZEOF_LONG == 8
+					add_next_index_long(value, tmp);
+#else
+					float_value = (double)tmp;
+					slprintf(buf, sizeof(buf), "%.0f", float_value);
+					add_next_index_string(value, buf, 1);
+#endif
+				}
+			}	break;
+
+		case SPH_ATTR_FLOAT:
+			ZVAL_DOUBLE(value, sphinx_get_float(result, i, j));
+			break;
+#if LIBSPHINX_VERSION_ID >= 110
+		case SPH_ATTR_STRING:
+			ZVAL_STRING(value, sphinx_get_string(result, i, j), 1);
+			break;                        
+#endif
+		default:
+#if SIZEOF_LONG == 8
+			ZVAL_LONG(value, sphinx_get_int(result, i, j));
+#else
+			float_value = (double)sphinx_get_int(result, i, j);
+			slprintf(buf, sizeof(buf), "%.0f", float_value);
+			ZVAL_STRING(value, buf, 1);
+#endif
+			break;
+	}
+}
+/* }}} */
+
+static void php_sphinx_result_to_columns(sphinx_result *result, zval *array TSRMLS_DC) /* {{{ */
+{
+	zval *ids, *weights, *columns, *column, *value;
+	int i, j;
+
+	MAKE_STD_ZVAL(ids);
+	array_init_size(ids, result->num_matches);
+
+	MAKE_STD_ZVAL(weights);
+	array_init_size(weights, result->num_matches);
+
+	for (i = 0; i < result->num_matches; i++) {
+#if SIZEOF_LONG == 8
+		add_next_index_long(ids, sphinx_get_id(result, i));
+#else
+		double float_id;
+		char buf[128];
+
+		float_id = (double)sphinx_get_id(result, i);
+		slprintf(buf, sizeof(buf), "%.0f", float_id);
+		add_next_index_string(ids, buf, 1);
+#endif
+		add_next_index_long(weights, sphinx_get_weight(result, i));
+	}
+
+	MAKE_STD_ZVAL(columns);
+	array_init_size(columns, result->num_attrs);
+
+	for (j = 0; j < result->num_attrs; j++) {
+		MAKE_STD_ZVAL(column);
+		array_init_size(column, result->num_matches);
+
+		for (i = 0; i < result->num_matches; i++) {
+			MAKE_STD_ZVAL(value);
+			php_sphinx_attr_to_zval(result, i, j, value);
+			add_next_index_zval(column, value);
+		}
+		add_assoc_zval(columns, result->attr_names[j], column);
+	}
+
+	add_assoc_zval_ex(array, "ids", sizeof("ids"), ids);
+	add_assoc_zval_ex(array, "weights", sizeof("weights"), weights);
+	add_assoc_zval_ex(array, "columns", sizeof("columns"), columns);
+}
+/* }}} */
+
+/* the same keys are used for every match, so they are hashed once per result */
+static void php_sphinx_attr_keys(sphinx_result *result, uint **attr_lens, ulong **attr_hashes) /* {{{ */
+{
+	int j;
+
+	*attr_lens = safe_emalloc(result->num_attrs, sizeof(uint), 0);
+	*attr_hashes = safe_emalloc(result->num_attrs, sizeof(ulong), 0);
+	for (j = 0; j < result->num_attrs; j++) {
+		(*attr_lens)[j] = strlen(result->attr_names[j]) + 1;
+		(*attr_hashes)[j] = zend_get_hash_value(result->attr_names[j], (*attr_lens)[j]);
+	}
+}
+/* }}} */
+
+static void php_sphinx_match_to_array(sphinx_result *result, int i, zend_bool array_result, uint *attr_lens, ulong *attr_hashes, zval *match) /* {{{ */
+{
+	zval *attrs, *value;
+	int j;
+
+	array_init_size(match, 3);
+
+	if (array_result) {
+		/* id */
+#if SIZEOF_LONG == 8
+		add_assoc_long_ex(match, "id", sizeof("id"), sphinx_get_id(result, i));
+#else
+		double float_id;
+		char buf[128];
+
+		float_id = (double)sphinx_get_id(result, i);
+		slprintf(buf, sizeof(buf), "%.0f", float_id);
+		add_assoc_string_ex(match, "id", sizeof("id"), buf, 1);
+#endif
+	}
+
+	/* weight */
+	add_assoc_long_ex(match, "weight", sizeof("weight"), sphinx_get_weight(result, i));
+
+	/* attrs */
+	MAKE_STD_ZVAL(attrs);
+	array_init_size(attrs, result->num_attrs);
+
+	for (j = 0; j < result->num_attrs; j++) {
+		MAKE_STD_ZVAL(value);
+		php_sphinx_attr_to_zval(result, i, j, value);
+
+		zend_hash_quick_update(Z_ARRVAL_P(attrs), result->attr_names[j], attr_lens[j], attr_hashes[j], (void *)&value, sizeof(zval *), NULL);
+	}
+
+	add_assoc_zval_ex(match, "attrs", sizeof("attrs"), attrs);
+}
+/* }}} */
+
+static void php_sphinx_result_to_array(sphinx_result *result, zval **array, zend_bool array_result, int format TSRMLS_DC) /* {{{ */
+{
+	zval *tmp, *tmp_element, *sub_element;
+	uint *attr_lens;
+	ulong *attr_hashes;
+	int i;
+
+	array_init(*array);
+
+	/* error */
+	if (!result->error) {
+		add_assoc_string_ex(*array, "error", sizeof("error"), "", 1);
+	} else {
+		add_assoc_string_ex(*array, "error", sizeof("error"), (char *)(result->error), 1);
+	}
+	
+	/* warning */
+	if (!result->warning) {
+		add_assoc_string_ex(*array, "warning", sizeof("warning"), "", 1);
+	} else {
+		add_assoc_string_ex(*array, "warning", sizeof("warning"), (char *)result->warning, 1);
+	}
+	
+	/* status */
+	add_assoc_long_ex(*array, "status", sizeof("status"), result->status);
+
+	switch(result->status) {
+		case SEARCHD_OK:
+			/* ok, continue reading data */
+			break;
+		case SEARCHD_WARNING:
+			/* this seems to be safe, too */
+			break;
+		default: 
+			/* libsphinxclient doesn't nullify the data 
+			   in case of error, so it's not safe to continue. */
+			return;
+	}
+
+	/* fields */
+	MAKE_STD_ZVAL(tmp);
+	array_init(tmp);
+
+	for (i = 0; i < result->num_fields; i++) {
+		add_next_index_string(tmp, result->fields[i], 1);
+	}
+	add_assoc_zval_ex(*array, "fields", sizeof("fields"), tmp);
+
+	/* attrs */
+	MAKE_STD_ZVAL(tmp);
+	array_init(tmp);
+
+	for (i = 0; i < result->num_attrs; i++) {
+#if SIZEOF_LONG == 8
+		add_assoc_long_ex(tmp, result->attr_names[i], strlen(result->attr_names[i]) + 1, result->attr_types[i]);
+#else
+		double float_value;
+		char buf[128];
+
+		float_value = (double)result->attr_types[i];
+		slprintf(buf, sizeof(buf), "%.0f", float_value);
+		add_assoc_string_ex(tmp, result->attr_names[i], strlen(result->attr_names[i]) + 1, buf, 1);
+#endif
+	}
+	add_assoc_zval_ex(*array, "attrs", sizeof("attrs"), tmp);
+
+	/* matches */
+	if (format == SPH_RESULT_COLUMNAR) {
+		php_sphinx_result_to_columns(result, *array TSRMLS_CC);
+	} else if (format != PHP_SPHINX_RESULT_META && result->num_matches) {
+		MAKE_STD_ZVAL(tmp);
+		array_init_size(tmp, result->num_matches);
+
+		php_sphinx_attr_keys(result, &attr_lens, &attr_hashes);
+
+		for (i = 0; i < result->num_matches; i++) {
+			MAKE_STD_ZVAL(tmp_element);
+			php_sphinx_match_to_array(result, i, array_result, attr_lens, attr_hashes, tmp_element);
+
+			if (array_result) {
+				add_next_index_zval(tmp, tmp_element);
+			} else {
+#if SIZEOF_LONG == 8
+				add_index_zval(tmp, sphinx_get_id(result, i), tmp_element);
+#else
+				char buf[128];
+				double float_id;
+				int buf_len;
+
+				float_id = (double)sphinx_get_id(result, i);
+				buf_len = slprintf(buf, sizeof(buf), "%.0f", float_id);
+				add_assoc_zval_ex(tmp, buf, buf_len + 1, tmp_element);
+#endif
+			}
+		}
+
+		efree(attr_lens);
+		efree(attr_hashes);
+
+		add_assoc_zval_ex(*array, "matches", sizeof("matches"), tmp);
+	}
+
+	/* total */
+	add_assoc_long_ex(*array, "total", sizeof("total"), result->total);
+
+	/* total_found */
+	add_assoc_long_ex(*array, "total_found", sizeof("total_found"), result->total_found);
+	
+	/* time */
+	add_assoc_double_ex(*array, "time", sizeof("time"), (double)result->time_msec/1000.0);
+
+	/* words */
+	if (result->num_words) {
+		MAKE_STD_ZVAL(tmp);
+		array_init(tmp);
+		for (i = 0; i < result->num_words; i++) {
+			MAKE_STD_ZVAL(sub_element);
+			array_init(sub_element);
+
+			add_assoc_long_ex(sub_element, "docs", sizeof("docs"), result->words[i].docs);
+			add_assoc_long_ex(sub_element, "hits", sizeof("hits"), result->words[i].hits);
+			add_assoc_zval_ex(tmp, (char *)result->words[i].word, strlen(result->words[i].word) + 1, sub_element);
+		}
+		add_assoc_zval_ex(*array, "words", sizeof("words"), tmp);
+	}
+}
+/* }}} */
+
+/* {{{ results cache
+ * Results are cached per worker as flat blocks written with the op helpers and 
+ * keyed by the whole settings journal plus the query. A hit is thawed into 
+ * sphinx_result structures, so all the result formats work on cached results. */
+
+/* mirrors union un_attr_value of libsphinxclient, sphinx_get_*() read the values pool through it. 
+   The layout is private to the library, so it is checked by configure and again in MINIT 
+   against the library loaded, results are not cached if it differs. */
+typedef union _php_sphinx_attr_value {
+	sphinx_int64_t int_value;
+	float float_value;
+	unsigned int *mva_value;
+	const char *string;
+} php_sphinx_attr_value;
+
+#ifdef HAVE_SPHINX_RESULT_LAYOUT
+static zend_bool php_sphinx_results_cacheable = 0;
+#else
+# define php_sphinx_results_cacheable 0
+#endif
+
+#define PHP_SPHINX_CACHE_INDEXES 256
+#define PHP_SPHINX_CACHE_DEPS 4
+
+/* the generations of the indexes a cached result was read from, slot 0 stands for any index */
+typedef struct _php_sphinx_cache_deps {
+	int num;
+	unsigned int slots[PHP_SPHINX_CACHE_DEPS];
+	unsigned int gens[PHP_SPHINX_CACHE_DEPS];
+} php_sphinx_cache_deps;
+
+typedef struct _php_sphinx_cache_entry {
+	char *key;
+	int key_len;
+	char *data;
+	size_t data_len;
+	time_t expires;
+	php_sphinx_cache_deps deps;
+	struct _php_sphinx_cache_entry *prev;
+	struct _php_sphinx_cache_entry *next;
+} php_sphinx_cache_entry;
+
+/* the first byte of a key tells what is cached */
+#define PHP_SPHINX_CACHE_RESULTS 'R'
+#define PHP_SPHINX_CACHE_EXCERPT 'E'
+#define PHP_SPHINX_CACHE_KEYWORDS 'K'
+
+#define PHP_SPHINX_CACHE_ENTRY_SIZE(e) (sizeof(php_sphinx_cache_entry) + (e)->key_len + (e)->data_len)
+
+/* bumped by updateAttributes(), the shared cache has its own in the mapping */
+static unsigned int php_sphinx_local_generations[PHP_SPHINX_CACHE_INDEXES];
+
+#ifdef HAVE_SPHINX_SHM
+static struct _php_sphinx_shm *php_sphinx_shm_cache;
+static unsigned int *php_sphinx_shm_generations(void);
+# define PHP_SPHINX_GENERATIONS() (php_sphinx_shm_cache ? php_sphinx_shm_generations() : php_sphinx_local_generations)
+# define PHP_SPHINX_SHM_ENABLED() (php_sphinx_shm_cache != NULL)
+#else
+# define PHP_SPHINX_GENERATIONS() php_sphinx_local_generations
+# define PHP_SPHINX_SHM_ENABLED() 0
+#endif
+
+/* calls func for every index name in an index list, "*" is passed on as it is */
+static void php_sphinx_cache_indexes(const char *list, void (*func)(const char *, int, void *), void *arg) /* {{{ */
+{
+	const char *p = list, *start;
+
+	while (*p) {
+		while (*p && !(isalnum((unsigned char)*p) || *p == '_' || *p == '-' || *p == '*')) {
+			p++;
+		}
+		start = p;
+		while (*p && (isalnum((unsigned char)*p) || *p == '_' || *p == '-' || *p == '*')) {
+			p++;
+		}
+		if (p > start) {
+			func(start, p - start, arg);
+		}
+	}
+}
+/* }}} */
+
+static unsigned int php_sphinx_cache_slot(const char *name, int name_len) /* {{{ */
+{
+	if (name_len == 1 && name[0] == '*') {
+		return 0;
+	}
+	return 1 + zend_inline_hash_func(name, name_len) % (PHP_SPHINX_CACHE_INDEXES - 1);
+}
+/* }}} */
+
+static void php_sphinx_cache_deps_add(const char *name, int name_len, void *arg) /* {{{ */
+{
+	php_sphinx_cache_deps *deps = (php_sphinx_cache_deps *)arg;
+	unsigned int slot = php_sphinx_cache_slot(name, name_len);
+	int i;
+
+	if (deps->num == 1 && deps->slots[0] == 0) {
+		return;
+	}
+	for (i = 0; i < deps->num; i++) {
+		if (deps->slots[i] == slot) {
+			return;
+		}
+	}
+	if (slot == 0 || deps->num == PHP_SPHINX_CACHE_DEPS) {
+		/* depends on every update then */
+		deps->num = 1;
+		deps->slots[0] = 0;
+		return;
+	}
+	deps->slots[deps->num++] = slot;
+}
+/* }}} */
+
+/* must be called before the search, so that updates made meanwhile invalidate the results */
+static void php_sphinx_cache_deps_init(php_sphinx_client *c, const char *index, php_sphinx_cache_deps *deps) /* {{{ */
+{
+	unsigned int *generations = PHP_SPHINX_GENERATIONS();
+	php_sphinx_op *op;
+	int i;
+
+	deps->num = 0;
+	if (index) {
+		php_sphinx_cache_indexes(index, php_sphinx_cache_deps_add, deps);
+	} else {
+		for (op = c->ops; op; op = op->next) {
+			if (op->code == PHP_SPHINX_OP_ADD_QUERY) {
+				const char *p = op->buf.c;
+
+				php_sphinx_op_get_string(&p);
+				php_sphinx_cache_indexes(php_sphinx_op_get_string(&p), php_sphinx_cache_deps_add, deps);
+			}
+		}
+	}
+	if (!deps->num) {
+		deps->num = 1;
+		deps->slots[0] = 0;
+	}
+
+	for (i = 0; i < deps->num; i++) {
+		deps->gens[i] = generations[deps->slots[i]];
+	}
+}
+/* }}} */
+
+static int php_sphinx_cache_deps_valid(const php_sphinx_cache_deps *deps) /* {{{ */
+{
+	unsigned int *generations = PHP_SPHINX_GENERATIONS();
+	int i;
+
+	for (i = 0; i < deps->num; i++) {
+		if (generations[deps->slots[i]] != deps->gens[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+/* }}} */
+
+static void php_sphinx_cache_invalidate_index(const char *name, int name_len, void *arg) /* {{{ */
+{
+	unsigned int *generations = (unsigned int *)arg;
+
+#ifdef HAVE_SPHINX_SHM
+	__sync_fetch_and_add(&generations[php_sphinx_cache_slot(name, name_len)], 1);
+#else
+	generations[php_sphinx_cache_slot(name, name_len)]++;
+#endif
+}
+/* }}} */
+
+/* drops the cached results read from the indexes, called after the documents were changed */
+static void php_sphinx_cache_invalidate(const char *index) /* {{{ */
+{
+	unsigned int *generations = PHP_SPHINX_GENERATIONS();
+
+	php_sphinx_cache_indexes(index, php_sphinx_cache_invalidate_index, generations);
+	php_sphinx_cache_invalidate_index("*", 1, generations);
+}
+/* }}} */
+
+/* the servers the answer may come from, the backends of setServers() are not in the journal */
+static void php_sphinx_cache_servers(php_sphinx_client *c, smart_str *key) /* {{{ */
+{
+	php_sphinx_server *servers = c->servers;
+	int i, num = c->num_servers;
+
+#ifdef HAVE_SPHINX_THREADS
+	if (!num) {
+		servers = c->replicas;
+		num = c->num_replicas;
+	}
+#endif
+	for (i = 0; i < num; i++) {
+		smart_str_appends(key, servers[i].host);
+		smart_str_appendc(key, ':');
+		smart_str_append_long(key, servers[i].port);
+		smart_str_appendc(key, '\0');
+	}
+	if (!num) {
+		smart_str_appends(key, c->host ? c->host : PHP_SPHINX_DEFAULT_HOST);
+		smart_str_appendc(key, ':');
+		smart_str_append_long(key, c->port);
+		smart_str_appendc(key, '\0');
+	}
+}
+/* }}} */
+
+static void php_sphinx_cache_key(php_sphinx_client *c, const char *query, const char *index, const char *comment, smart_str *key) /* {{{ */
+{
+	smart_str_appendc(key, PHP_SPHINX_CACHE_RESULTS);
+	php_sphinx_cache_servers(c, key);
+	php_sphinx_ops_encode(c->ops, 0, key);
+
+	if (query) {
+		smart_str_appendl(key, query, strlen(query) + 1);
+		smart_str_appendl(key, index, strlen(index) + 1);
+		smart_str_appendl(key, comment, strlen(comment) + 1);
+	}
+	smart_str_0(key);
+}
+/* }}} */
+
+static void php_sphinx_cache_entry_dtor(void *data) /* {{{ */
+{
+	php_sphinx_cache_entry *entry = *(php_sphinx_cache_entry **)data;
+
+	pefree(entry->key, 1);
+	pefree(entry->data, 1);
+	pefree(entry, 1);
+}
+/* }}} */
+
+static void php_sphinx_cache_remove(php_sphinx_cache_entry *entry TSRMLS_DC) /* {{{ */
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		SPHINX_G(cache_head) = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		SPHINX_G(cache_tail) = entry->prev;
+	}
+	SPHINX_G(cache_bytes) -= PHP_SPHINX_CACHE_ENTRY_SIZE(entry);
+	zend_hash_del(&SPHINX_G(cache), entry->key, entry->key_len);
+}
+/* }}} */
+
+static void php_sphinx_cache_link(php_sphinx_cache_entry *entry TSRMLS_DC) /* {{{ */
+{
+	entry->prev = NULL;
+	entry->next = SPHINX_G(cache_head);
+	if (entry->next) {
+		entry->next->prev = entry;
+	} else {
+		SPHINX_G(cache_tail) = entry;
+	}
+	SPHINX_G(cache_head) = entry;
+}
+/* }}} */
+
+static php_sphinx_cache_entry *php_sphinx_cache_find(const char *key, int key_len TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_cache_entry **entry;
+
+	if (zend_hash_find(&SPHINX_G(cache), key, key_len, (void **) &entry) == FAILURE) {
+		SPHINX_G(cache_misses)++;
+		return NULL;
+	}
+
+	if ((*entry)->expires <= time(NULL) || !php_sphinx_cache_deps_valid(&(*entry)->deps)) {
+		php_sphinx_cache_remove(*entry TSRMLS_CC);
+		SPHINX_G(cache_misses)++;
+		return NULL;
+	}
+
+	/* the most recently used one goes first */
+	if ((*entry)->prev) {
+		(*entry)->prev->next = (*entry)->next;
+		if ((*entry)->next) {
+			(*entry)->next->prev = (*entry)->prev;
+		} else {
+			SPHINX_G(cache_tail) = (*entry)->prev;
+		}
+		php_sphinx_cache_link(*entry TSRMLS_CC);
+	}
+
+	SPHINX_G(cache_hits)++;
+	return *entry;
+}
+/* }}} */
+
+static void php_sphinx_cache_store(const char *key, int key_len, const char *data, size_t data_len, long ttl, const php_sphinx_cache_deps *deps TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_cache_entry *entry, **old;
+	size_t size = sizeof(php_sphinx_cache_entry) + key_len + data_len;
+
+	if (size > (size_t)SPHINX_G(cache_size)) {
+		return;
+	}
+
+	if (zend_hash_find(&SPHINX_G(cache), key, key_len, (void **) &old) == SUCCESS) {
+		php_sphinx_cache_remove(*old TSRMLS_CC);
+	}
+
+	while (SPHINX_G(cache_tail) && SPHINX_G(cache_bytes) + size > (size_t)SPHINX_G(cache_size)) {
+		php_sphinx_cache_remove(SPHINX_G(cache_tail) TSRMLS_CC);
+		SPHINX_G(cache_evictions)++;
+	}
+
+	entry = pemalloc(sizeof(php_sphinx_cache_entry), 1);
+	entry->key = pemalloc(key_len, 1);
+	memcpy(entry->key, key, key_len);
+	entry->key_len = key_len;
+	entry->data = pemalloc(data_len, 1);
+	memcpy(entry->data, data, data_len);
+	entry->data_len = data_len;
+	entry->expires = time(NULL) + ttl;
+	entry->deps = *deps;
+
+	zend_hash_update(&SPHINX_G(cache), key, key_len, (void *)&entry, sizeof(entry), NULL);
+	php_sphinx_cache_link(entry TSRMLS_CC);
+	SPHINX_G(cache_bytes) += size;
+}
+/* }}} */
+
+/* the block starts with the size of the structures it thaws into, fails if any result is an error */
+static int php_sphinx_cache_encode(sphinx_result *results, int num_results, php_sphinx_op *block) /* {{{ */
+{
+	sphinx_result *result;
+	unsigned int *mva;
+	sphinx_int64_t arena = num_results * sizeof(sphinx_result);
+	int i, j, k;
+
+	php_sphinx_op_put_long(block, 0);
+	php_sphinx_op_put_long(block, num_results);
+
+	for (k = 0; k < num_results; k++) {
+		result = &results[k];
+		if (result->status != SEARCHD_OK && result->status != SEARCHD_WARNING) {
+			return FAILURE;
+		}
+
+		php_sphinx_op_put_long(block, result->status);
+		php_sphinx_op_put_string(block, result->error);
+		php_sphinx_op_put_string(block, result->warning);
+		php_sphinx_op_put_long(block, result->total);
+		php_sphinx_op_put_long(block, result->total_found);
+		php_sphinx_op_put_long(block, result->time_msec);
+
+		php_sphinx_op_put_long(block, result->num_fields);
+		for (i = 0; i < result->num_fields; i++) {
+			php_sphinx_op_put_string(block, result->fields[i]);
+		}
+
+		php_sphinx_op_put_long(block, result->num_attrs);
+		for (j = 0; j < result->num_attrs; j++) {
+			php_sphinx_op_put_string(block, result->attr_names[j]);
+			php_sphinx_op_put_long(block, result->attr_types[j]);
+		}
+
+		php_sphinx_op_put_long(block, result->num_matches);
+		for (i = 0; i < result->num_matches; i++) {
+			php_sphinx_op_put_long(block, (sphinx_int64_t)sphinx_get_id(result, i));
+			php_sphinx_op_put_long(block, sphinx_get_weight(result, i));
+
+			for (j = 0; j < result->num_attrs; j++) {
+				switch (result->attr_types[j]) {
+					case SPH_ATTR_MULTI | SPH_ATTR_INTEGER:
+						mva = sphinx_get_mva(result, i, j);
+						if (!mva) {
+							php_sphinx_op_put_long(block, -1);
+						} else {
+							/* the count goes first, as in the response */
+							php_sphinx_op_put_long(block, mva[0]);
+							php_sphinx_op_put_data(block, mva, (mva[0] + 1) * sizeof(unsigned int));
+						}
+						break;
+					case SPH_ATTR_FLOAT:
+						php_sphinx_op_put_double(block, sphinx_get_float(result, i, j));
+						break;
+#if LIBSPHINX_VERSION_ID >= 110
+					case SPH_ATTR_STRING:
+						php_sphinx_op_put_string(block, sphinx_get_string(result, i, j));
+						break;
+#endif
+					default:
+						php_sphinx_op_put_long(block, sphinx_get_int(result, i, j));
+						break;
+				}
+			}
+		}
+
+		php_sphinx_op_put_long(block, result->num_words);
+		for (i = 0; i < result->num_words; i++) {
+			php_sphinx_op_put_string(block, result->words[i].word);
+			php_sphinx_op_put_long(block, result->words[i].docs);
+			php_sphinx_op_put_long(block, result->words[i].hits);
+		}
+
+		arena += (result->num_fields + result->num_attrs) * sizeof(char *) + result->num_attrs * sizeof(int);
+		arena = PHP_SPHINX_OP_ALIGN(arena);
+		arena += (size_t)(2 + result->num_attrs) * result->num_matches * sizeof(php_sphinx_attr_value);
+		arena += result->num_words * sizeof(sphinx_wordinfo);
+	}
+
+	memcpy(block->buf.c, &arena, sizeof(arena));
+	return SUCCESS;
+}
+/* }}} */
+
+/* the data follows the php_sphinx_cached header in the block returned by php_sphinx_cache_get() */
+#define PHP_SPHINX_CACHED_HEADER PHP_SPHINX_OP_ALIGN(sizeof(php_sphinx_cached))
+
+/* the strings and the MVA values point into the data, the structures are put into a separate arena */
+static php_sphinx_cached *php_sphinx_cached_thaw(php_sphinx_cached *cached) /* {{{ */
+{
+	php_sphinx_attr_value *value;
+	sphinx_result *result;
+	sphinx_int64_t num;
+	const char *p = (char *)cached + PHP_SPHINX_CACHED_HEADER;
+	char *arena;
+	int i, j, k;
+
+	arena = emalloc((size_t)php_sphinx_op_get_long(&p));
+	cached->num_results = (int)php_sphinx_op_get_long(&p);
+	cached->results = (sphinx_result *)arena;
+	arena += cached->num_results * sizeof(sphinx_result);
+
+	for (k = 0; k < cached->num_results; k++) {
+		result = &cached->results[k];
+
+		result->status = (int)php_sphinx_op_get_long(&p);
+		result->error = php_sphinx_op_get_string(&p);
+		result->warning = php_sphinx_op_get_string(&p);
+		result->total = (int)php_sphinx_op_get_long(&p);
+		result->total_found = (int)php_sphinx_op_get_long(&p);
+		result->time_msec = (int)php_sphinx_op_get_long(&p);
+
+		result->num_fields = (int)php_sphinx_op_get_long(&p);
+		result->fields = (char **)arena;
+		arena += result->num_fields * sizeof(char *);
+		for (i = 0; i < result->num_fields; i++) {
+			result->fields[i] = (char *)php_sphinx_op_get_string(&p);
+		}
+
+		result->num_attrs = (int)php_sphinx_op_get_long(&p);
+		result->attr_names = (char **)arena;
+		arena += result->num_attrs * sizeof(char *);
+		result->attr_types = (int *)arena;
+		arena += result->num_attrs * sizeof(int);
+		arena = (char *)cached->results + PHP_SPHINX_OP_ALIGN(arena - (char *)cached->results);
+		for (j = 0; j < result->num_attrs; j++) {
+			result->attr_names[j] = (char *)php_sphinx_op_get_string(&p);
+			result->attr_types[j] = (int)php_sphinx_op_get_long(&p);
+		}
+
+		result->num_matches = (int)php_sphinx_op_get_long(&p);
+		result->values_pool = arena;
+		value = (php_sphinx_attr_value *)arena;
+		arena += (size_t)(2 + result->num_attrs) * result->num_matches * sizeof(php_sphinx_attr_value);
+		for (i = 0; i < result->num_matches; i++) {
+			(value++)->int_value = php_sphinx_op_get_long(&p);
+			(value++)->int_value = php_sphinx_op_get_long(&p);
+
+			for (j = 0; j < result->num_attrs; j++, value++) {
+				value->int_value = 0;
+				switch (result->attr_types[j]) {
+					case SPH_ATTR_MULTI | SPH_ATTR_INTEGER:
+						num = php_sphinx_op_get_long(&p);
+						value->mva_value = (num < 0) ? NULL : (unsigned int *)php_sphinx_op_get_data(&p, (num + 1) * sizeof(unsigned int));
+						break;
+					case SPH_ATTR_FLOAT:
+						value->float_value = (float)php_sphinx_op_get_double(&p);
+						break;
+#if LIBSPHINX_VERSION_ID >= 110
+					case SPH_ATTR_STRING:
+						value->string = php_sphinx_op_get_string(&p);
+						break;
+#endif
+					default:
+						value->int_value = php_sphinx_op_get_long(&p);
+						break;
+				}
+			}
+		}
+
+		result->num_words = (int)php_sphinx_op_get_long(&p);
+		result->words = (sphinx_wordinfo *)arena;
+		arena += result->num_words * sizeof(sphinx_wordinfo);
+		for (i = 0; i < result->num_words; i++) {
+			result->words[i].word = php_sphinx_op_get_string(&p);
+			result->words[i].docs = (int)php_sphinx_op_get_long(&p);
+			result->words[i].hits = (int)php_sphinx_op_get_long(&p);
+		}
+	}
+	return cached;
+}
+/* }}} */
+
+#ifdef HAVE_SPHINX_RESULT_LAYOUT
+/* reads a thawed match back through the accessors of libsphinxclient */
+static zend_bool php_sphinx_cache_layout_check(void) /* {{{ */
+{
+	php_sphinx_attr_value pool[2 + 4];
+	unsigned int mva[2] = {1, 42};
+	int types[4] = {SPH_ATTR_INTEGER, SPH_ATTR_FLOAT, SPH_ATTR_MULTI | SPH_ATTR_INTEGER, SPH_ATTR_INTEGER};
+	sphinx_result result;
+
+	memset(&result, 0, sizeof(result));
+	memset(pool, 0, sizeof(pool));
+	result.num_attrs = 4;
+	result.attr_types = types;
+	result.num_matches = 1;
+	result.values_pool = pool;
+
+	pool[0].int_value = 7;
+	pool[1].int_value = 3;
+	pool[2].int_value = 5;
+	pool[3].float_value = 1.5f;
+	pool[4].mva_value = mva;
+#if LIBSPHINX_VERSION_ID >= 110
+	types[3] = SPH_ATTR_STRING;
+	pool[5].string = "sphinx";
+#else
+	pool[5].int_value = 11;
+#endif
+
+	return sphinx_get_id(&result, 0) == 7 && sphinx_get_weight(&result, 0) == 3
+		&& sphinx_get_int(&result, 0, 0) == 5 && sphinx_get_float(&result, 0, 1) == 1.5f
+		&& sphinx_get_mva(&result, 0, 2) == mva
+#if LIBSPHINX_VERSION_ID >= 110
+		&& sphinx_get_string(&result, 0, 3) == pool[5].string;
+#else
+		&& sphinx_get_int(&result, 0, 3) == 11;
+#endif
+}
+/* }}} */
+#endif
+/* }}} */
+
+#ifdef HAVE_SPHINX_SHM
+/* {{{ shared results cache
+ * With sphinx.shm_cache_size the results cache moves to an anonymous shared mapping 
+ * made in MINIT, so that all the workers forked by the master process use it. The 
+ * mapping is split into stripes by the hash of the key, every stripe has its own 
+ * spinlock, hash buckets, LRU list and fixed size chunks the entries are stored in. 
+ * The spinlock holds the pid of its owner, a worker dying with the lock held is 
+ * noticed by the others, which empty the stripe it may have left half updated. */
+#define PHP_SPHINX_SHM_STRIPES 16
+#define PHP_SPHINX_SHM_BUCKETS 256
+#define PHP_SPHINX_SHM_CHUNK 1024
+#define PHP_SPHINX_SHM_ENTRY_CHUNKS 4 /* expected chunks per entry, gives the number of entries */
+#define PHP_SPHINX_SHM_LOCK_SPINS 1024 /* spins before checking whether the owner of the lock is alive */
+#define PHP_SPHINX_SHM_REFRESH_TIMEOUT 10 /* seconds a stale entry waits for the worker refreshing it */
+
+/* entries and chunks are referred to by their number in the stripe, 0 is none */
+typedef struct _php_sphinx_shm_entry {
+	ulong hash;
+	unsigned int key_len;
+	unsigned int data_len;
+	time_t expires;
+	php_sphinx_cache_deps deps;
+	unsigned int chunk; /* the key is followed by the data */
+	unsigned int num_chunks;
+	unsigned int prev;
+	unsigned int next;
+	unsigned int hash_next; /* or the next free entry */
+	time_t refreshing; /* until when a worker went to searchd to replace the stale entry, 0 for none */
+} php_sphinx_shm_entry;
+
+typedef struct _php_sphinx_shm_chunk {
+	unsigned int next;
+	char data[PHP_SPHINX_SHM_CHUNK];
+} php_sphinx_shm_chunk;
+
+typedef struct _php_sphinx_shm_stripe {
+	volatile pid_t lock; /* pid of the owner, 0 when free */
+	unsigned int buckets[PHP_SPHINX_SHM_BUCKETS];
+	unsigned int head; /* most recently used */
+	unsigned int tail;
+	unsigned int free_entries;
+	unsigned int free_chunks;
+	unsigned int num_free_chunks;
+	unsigned int num_used; /* entries */
+	unsigned int num_entries;
+	unsigned int num_chunks;
+	size_t entries; /* offsets in the mapping */
+	size_t chunks;
+} php_sphinx_shm_stripe;
+
+typedef struct _php_sphinx_shm {
+	size_t size;
+	unsigned int generations[PHP_SPHINX_CACHE_INDEXES];
+	long hits;
+	long misses;
+	long stale_hits;
+	long evictions;
+	php_sphinx_shm_stripe stripes[PHP_SPHINX_SHM_STRIPES];
+} php_sphinx_shm;
+
+#define PHP_SPHINX_SHM_ENTRY(stripe, n) ((php_sphinx_shm_entry *)((char *)php_sphinx_shm_cache + (stripe)->entries) + (n) - 1)
+#define PHP_SPHINX_SHM_CHUNK_AT(stripe, n) ((php_sphinx_shm_chunk *)((char *)php_sphinx_shm_cache + (stripe)->chunks) + (n) - 1)
+
+static unsigned int *php_sphinx_shm_generations(void) /* {{{ */
+{
+	return php_sphinx_shm_cache->generations;
+}
+/* }}} */
+
+/* empties the stripe, its geometry stays */
+static void php_sphinx_shm_stripe_reset(php_sphinx_shm_stripe *stripe) /* {{{ */
+{
+	unsigned int j;
+
+	memset(stripe->buckets, 0, sizeof(stripe->buckets));
+	stripe->head = stripe->tail = 0;
+	stripe->num_used = 0;
+
+	for (j = 1; j <= stripe->num_entries; j++) {
+		PHP_SPHINX_SHM_ENTRY(stripe, j)->hash_next = j < stripe->num_entries ? j + 1 : 0;
+	}
+	for (j = 1; j <= stripe->num_chunks; j++) {
+		PHP_SPHINX_SHM_CHUNK_AT(stripe, j)->next = j < stripe->num_chunks ? j + 1 : 0;
+	}
+	stripe->free_entries = stripe->num_entries ? 1 : 0;
+	stripe->free_chunks = stripe->num_chunks ? 1 : 0;
+	stripe->num_free_chunks = stripe->num_chunks;
+}
+/* }}} */
+
+static void php_sphinx_shm_init(size_t size TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_shm_stripe *stripe;
+	size_t offset, per_stripe;
+	unsigned int i;
+	void *mapping;
+
+	per_stripe = size > sizeof(php_sphinx_shm) ? (size - sizeof(php_sphinx_shm)) / PHP_SPHINX_SHM_STRIPES : 0;
+	if (per_stripe < 2 * (sizeof(php_sphinx_shm_entry) + PHP_SPHINX_SHM_ENTRY_CHUNKS * sizeof(php_sphinx_shm_chunk))) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "sphinx.shm_cache_size of %lu bytes is too small, the shared cache is disabled", (unsigned long)size);
+		return;
+	}
+
+	mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (mapping == MAP_FAILED) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to map %lu bytes for the shared cache: %s", (unsigned long)size, strerror(errno));
+		return;
+	}
+	php_sphinx_shm_cache = (php_sphinx_shm *)mapping;
+	php_sphinx_shm_cache->size = size;
+
+	/* the mapping comes zeroed */
+	offset = PHP_SPHINX_OP_ALIGN(sizeof(php_sphinx_shm));
+	for (i = 0; i < PHP_SPHINX_SHM_STRIPES; i++) {
+		stripe = &php_sphinx_shm_cache->stripes[i];
+		stripe->num_entries = per_stripe / (sizeof(php_sphinx_shm_entry) + PHP_SPHINX_SHM_ENTRY_CHUNKS * sizeof(php_sphinx_shm_chunk));
+		stripe->num_chunks = stripe->num_entries * PHP_SPHINX_SHM_ENTRY_CHUNKS;
+
+		stripe->entries = offset;
+		offset += PHP_SPHINX_OP_ALIGN(stripe->num_entries * sizeof(php_sphinx_shm_entry));
+		stripe->chunks = offset;
+		offset += PHP_SPHINX_OP_ALIGN(stripe->num_chunks * sizeof(php_sphinx_shm_chunk));
+
+		php_sphinx_shm_stripe_reset(stripe);
+	}
+}
+/* }}} */
+
+static void php_sphinx_shm_shutdown(void) /* {{{ */
+{
+	if (php_sphinx_shm_cache) {
+		munmap((void *)php_sphinx_shm_cache, php_sphinx_shm_cache->size);
+		php_sphinx_shm_cache = NULL;
+	}
+}
+/* }}} */
+
+static void php_sphinx_shm_lock(php_sphinx_shm_stripe *stripe) /* {{{ */
+{
+	pid_t pid = getpid(), owner;
+	unsigned int spins = 0;
+
+	while (!__sync_bool_compare_and_swap(&stripe->lock, 0, pid)) {
+		if (++spins % PHP_SPHINX_SHM_LOCK_SPINS == 0) {
+			owner = stripe->lock;
+			if (owner && owner != pid && kill(owner, 0) < 0 && errno == ESRCH
+				&& __sync_bool_compare_and_swap(&stripe->lock, owner, pid)) {
+				/* the owner died in the middle of an update */
+				php_sphinx_shm_stripe_reset(stripe);
+				return;
+			}
+		}
+		sched_yield();
+	}
+}
+/* }}} */
+
+static inline void php_sphinx_shm_unlock(php_sphinx_shm_stripe *stripe) /* {{{ */
+{
+	__sync_lock_release(&stripe->lock);
+}
+/* }}} */
+
+/* copies len bytes from offset of the entry to dst, or compares them with dst when compare is set */
+static int php_sphinx_shm_read(php_sphinx_shm_stripe *stripe, php_sphinx_shm_entry *entry, size_t offset, char *dst, size_t len, zend_bool compare) /* {{{ */
+{
+	php_sphinx_shm_chunk *chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, entry->chunk);
+	size_t n;
+
+	while (offset >= PHP_SPHINX_SHM_CHUNK) {
+		chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, chunk->next);
+		offset -= PHP_SPHINX_SHM_CHUNK;
+	}
+
+	while (len) {
+		n = MIN(len, PHP_SPHINX_SHM_CHUNK - offset);
+		if (compare) {
+			if (memcmp(dst, chunk->data + offset, n) != 0) {
+				return 0;
+			}
+		} else {
+			memcpy(dst, chunk->data + offset, n);
+		}
+		dst += n;
+		len -= n;
+		offset = 0;
+		if (len) {
+			chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, chunk->next);
+		}
+	}
+	return 1;
+}
+/* }}} */
+
+static void php_sphinx_shm_write(php_sphinx_shm_stripe *stripe, php_sphinx_shm_chunk **chunk, size_t *offset, const char *src, size_t len) /* {{{ */
+{
+	size_t n;
+
+	while (len) {
+		if (*offset == PHP_SPHINX_SHM_CHUNK) {
+			*chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, (*chunk)->next);
+			*offset = 0;
+		}
+		n = MIN(len, PHP_SPHINX_SHM_CHUNK - *offset);
+		memcpy((*chunk)->data + *offset, src, n);
+		src += n;
+		len -= n;
+		*offset += n;
+	}
+}
+/* }}} */
+
+static void php_sphinx_shm_unlink(php_sphinx_shm_stripe *stripe, unsigned int n) /* {{{ */
+{
+	php_sphinx_shm_entry *entry = PHP_SPHINX_SHM_ENTRY(stripe, n);
+
+	if (entry->prev) {
+		PHP_SPHINX_SHM_ENTRY(stripe, entry->prev)->next = entry->next;
+	} else {
+		stripe->head = entry->next;
+	}
+	if (entry->next) {
+		PHP_SPHINX_SHM_ENTRY(stripe, entry->next)->prev = entry->prev;
+	} else {
+		stripe->tail = entry->prev;
+	}
+}
+/* }}} */
+
+static void php_sphinx_shm_link(php_sphinx_shm_stripe *stripe, unsigned int n) /* {{{ */
+{
+	php_sphinx_shm_entry *entry = PHP_SPHINX_SHM_ENTRY(stripe, n);
+
+	entry->prev = 0;
+	entry->next = stripe->head;
+	if (stripe->head) {
+		PHP_SPHINX_SHM_ENTRY(stripe, stripe->head)->prev = n;
+	} else {
+		stripe->tail = n;
+	}
+	stripe->head = n;
+}
+/* }}} */
+
+static void php_sphinx_shm_remove(php_sphinx_shm_stripe *stripe, unsigned int n) /* {{{ */
+{
+	php_sphinx_shm_entry *entry = PHP_SPHINX_SHM_ENTRY(stripe, n);
+	unsigned int *link = &stripe->buckets[(entry->hash / PHP_SPHINX_SHM_STRIPES) % PHP_SPHINX_SHM_BUCKETS];
+	php_sphinx_shm_chunk *last;
+
+	while (*link != n) {
+		link = &PHP_SPHINX_SHM_ENTRY(stripe, *link)->hash_next;
+	}
+	*link = entry->hash_next;
+	php_sphinx_shm_unlink(stripe, n);
+
+	/* the chunks of the entry go to the free list as they are */
+	for (last = PHP_SPHINX_SHM_CHUNK_AT(stripe, entry->chunk); last->next; last = PHP_SPHINX_SHM_CHUNK_AT(stripe, last->next));
+	last->next = stripe->free_chunks;
+	stripe->free_chunks = entry->chunk;
+	stripe->num_free_chunks += entry->num_chunks;
+
+	entry->hash_next = stripe->free_entries;
+	stripe->free_entries = n;
+	stripe->num_used--;
+}
+/* }}} */
+
+static unsigned int php_sphinx_shm_lookup(php_sphinx_shm_stripe *stripe, ulong hash, const char *key, int key_len) /* {{{ */
+{
+	php_sphinx_shm_entry *entry;
+	unsigned int n;
+
+	for (n = stripe->buckets[(hash / PHP_SPHINX_SHM_STRIPES) % PHP_SPHINX_SHM_BUCKETS]; n; n = entry->hash_next) {
+		entry = PHP_SPHINX_SHM_ENTRY(stripe, n);
+		if (entry->hash == hash && entry->key_len == (unsigned int)key_len
+			&& php_sphinx_shm_read(stripe, entry, 0, (char *)key, key_len, 1)) {
+			return n;
+		}
+	}
+	return 0;
+}
+/* }}} */
+
+/* a stale entry is given to everyone but the first worker to see it, that one refreshes it. 
+   The claim expires if the worker neither stores nor releases it in time. */
+static char *php_sphinx_shm_find(const char *key, int key_len, size_t header, size_t *data_len TSRMLS_DC) /* {{{ */
+{
+	ulong hash = zend_inline_hash_func(key, key_len);
+	php_sphinx_shm_stripe *stripe = &php_sphinx_shm_cache->stripes[hash % PHP_SPHINX_SHM_STRIPES];
+	php_sphinx_shm_entry *entry;
+	time_t now = time(NULL);
+	char *block;
+	unsigned int n;
+
+	php_sphinx_shm_lock(stripe);
+
+	n = php_sphinx_shm_lookup(stripe, hash, key, key_len);
+	if (!n) {
+		php_sphinx_shm_unlock(stripe);
+		__sync_fetch_and_add(&php_sphinx_shm_cache->misses, 1);
+		return NULL;
+	}
+
+	entry = PHP_SPHINX_SHM_ENTRY(stripe, n);
+	if (now >= entry->expires + SPHINX_G(shm_cache_stale) || !php_sphinx_cache_deps_valid(&entry->deps)) {
+		php_sphinx_shm_remove(stripe, n);
+		php_sphinx_shm_unlock(stripe);
+		__sync_fetch_and_add(&php_sphinx_shm_cache->misses, 1);
+		return NULL;
+	}
+	if (now >= entry->expires) {
+		if (now >= entry->refreshing) {
+			entry->refreshing = now + PHP_SPHINX_SHM_REFRESH_TIMEOUT;
+			php_sphinx_shm_unlock(stripe);
+			__sync_fetch_and_add(&php_sphinx_shm_cache->misses, 1);
+			return NULL;
+		}
+		__sync_fetch_and_add(&php_sphinx_shm_cache->stale_hits, 1);
+	} else {
+		__sync_fetch_and_add(&php_sphinx_shm_cache->hits, 1);
+	}
+
+	if (stripe->head != n) {
+		php_sphinx_shm_unlink(stripe, n);
+		php_sphinx_shm_link(stripe, n);
+	}
+
+	*data_len = entry->data_len;
+	block = emalloc(header + entry->data_len);
+	php_sphinx_shm_read(stripe, entry, entry->key_len, block + header, entry->data_len, 0);
+
+	php_sphinx_shm_unlock(stripe);
+	return block;
+}
+/* }}} */
+
+/* gives up refreshing the stale entry, the next worker to see it tries again */
+static void php_sphinx_shm_release(const char *key, int key_len) /* {{{ */
+{
+	ulong hash = zend_inline_hash_func(key, key_len);
+	php_sphinx_shm_stripe *stripe = &php_sphinx_shm_cache->stripes[hash % PHP_SPHINX_SHM_STRIPES];
+	unsigned int n;
+
+	php_sphinx_shm_lock(stripe);
+	n = php_sphinx_shm_lookup(stripe, hash, key, key_len);
+	if (n) {
+		PHP_SPHINX_SHM_ENTRY(stripe, n)->refreshing = 0;
+	}
+	php_sphinx_shm_unlock(stripe);
+}
+/* }}} */
+
+static void php_sphinx_shm_store(const char *key, int key_len, const char *data, size_t data_len, long ttl, const php_sphinx_cache_deps *deps TSRMLS_DC) /* {{{ */
+{
+	ulong hash = zend_inline_hash_func(key, key_len);
+	php_sphinx_shm_stripe *stripe = &php_sphinx_shm_cache->stripes[hash % PHP_SPHINX_SHM_STRIPES];
+	php_sphinx_shm_entry *entry;
+	php_sphinx_shm_chunk *chunk;
+	unsigned int n, i;
+	size_t offset = 0, num_chunks;
+
+	num_chunks = (key_len + data_len + PHP_SPHINX_SHM_CHUNK - 1) / PHP_SPHINX_SHM_CHUNK;
+	if (num_chunks > stripe->num_chunks) {
+		return;
+	}
+
+	php_sphinx_shm_lock(stripe);
+
+	n = php_sphinx_shm_lookup(stripe, hash, key, key_len);
+	if (n) {
+		php_sphinx_shm_remove(stripe, n);
+	}
+	while (stripe->tail && (stripe->num_free_chunks < num_chunks || !stripe->free_entries)) {
+		php_sphinx_shm_remove(stripe, stripe->tail);
+		__sync_fetch_and_add(&php_sphinx_shm_cache->evictions, 1);
+	}
+
+	n = stripe->free_entries;
+	entry = PHP_SPHINX_SHM_ENTRY(stripe, n);
+	stripe->free_entries = entry->hash_next;
+	stripe->num_used++;
+
+	entry->hash = hash;
+	entry->key_len = key_len;
+	entry->data_len = (unsigned int)data_len;
+	entry->expires = time(NULL) + ttl;
+	entry->deps = *deps;
+	entry->refreshing = 0;
+	entry->num_chunks = (unsigned int)num_chunks;
+
+	/* takes the chunks from the head of the free list and cuts it after the last one */
+	entry->chunk = stripe->free_chunks;
+	chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, entry->chunk);
+	for (i = 1; i < num_chunks; i++) {
+		chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, chunk->next);
+	}
+	stripe->free_chunks = chunk->next;
+	stripe->num_free_chunks -= num_chunks;
+	chunk->next = 0;
+
+	chunk = PHP_SPHINX_SHM_CHUNK_AT(stripe, entry->chunk);
+	php_sphinx_shm_write(stripe, &chunk, &offset, key, key_len);
+	php_sphinx_shm_write(stripe, &chunk, &offset, data, data_len);
+
+	entry->hash_next = stripe->buckets[(hash / PHP_SPHINX_SHM_STRIPES) % PHP_SPHINX_SHM_BUCKETS];
+	stripe->buckets[(hash / PHP_SPHINX_SHM_STRIPES) % PHP_SPHINX_SHM_BUCKETS] = n;
+	php_sphinx_shm_link(stripe, n);
+
+	php_sphinx_shm_unlock(stripe);
+}
+/* }}} */
+
+static void php_sphinx_shm_stats(zval *array) /* {{{ */
+{
+	long entries = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < PHP_SPHINX_SHM_STRIPES; i++) {
+		entries += php_sphinx_shm_cache->stripes[i].num_used;
+		bytes += (long)(php_sphinx_shm_cache->stripes[i].num_chunks - php_sphinx_shm_cache->stripes[i].num_free_chunks) * PHP_SPHINX_SHM_CHUNK;
+	}
+
+	add_assoc_long_ex(array, "hits", sizeof("hits"), php_sphinx_shm_cache->hits);
+	add_assoc_long_ex(array, "misses", sizeof("misses"), php_sphinx_shm_cache->misses);
+	add_assoc_long_ex(array, "stale_hits", sizeof("stale_hits"), php_sphinx_shm_cache->stale_hits);
+	add_assoc_long_ex(array, "evictions", sizeof("evictions"), php_sphinx_shm_cache->evictions);
+	add_assoc_long_ex(array, "entries", sizeof("entries"), entries);
+	add_assoc_long_ex(array, "bytes", sizeof("bytes"), bytes);
+}
+/* }}} */
+/* }}} */
+#endif
+
+/* returns an emalloc'ed copy of the cached data, placed header bytes into the block */
+static char *php_sphinx_cache_get(const char *key, int key_len, size_t header, size_t *data_len TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_cache_entry *entry;
+	char *block;
+
+#ifdef HAVE_SPHINX_SHM
+	if (php_sphinx_shm_cache) {
+		return php_sphinx_shm_find(key, key_len, header, data_len TSRMLS_CC);
+	}
+#endif
+	entry = php_sphinx_cache_find(key, key_len TSRMLS_CC);
+	if (!entry) {
+		return NULL;
+	}
+
+	*data_len = entry->data_len;
+	block = emalloc(header + entry->data_len);
+	memcpy(block + header, entry->data, entry->data_len);
+	return block;
+}
+/* }}} */
+
+static php_sphinx_cached *php_sphinx_cache_fetch(const char *key, int key_len TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_cached *cached;
+	size_t data_len;
+
+	cached = (php_sphinx_cached *)php_sphinx_cache_get(key, key_len, PHP_SPHINX_CACHED_HEADER, &data_len TSRMLS_CC);
+	return cached ? php_sphinx_cached_thaw(cached) : NULL;
+}
+/* }}} */
+
+static void php_sphinx_cache_put(const char *key, int key_len, const char *data, size_t data_len, long ttl, const php_sphinx_cache_deps *deps TSRMLS_DC) /* {{{ */
+{
+#ifdef HAVE_SPHINX_SHM
+	if (php_sphinx_shm_cache) {
+		php_sphinx_shm_store(key, key_len, data, data_len, ttl, deps TSRMLS_CC);
+		return;
+	}
+#endif
+	php_sphinx_cache_store(key, key_len, data, data_len, ttl, deps TSRMLS_CC);
+}
+/* }}} */
+
+/* the request for a missed key failed, nothing is going to be put */
+static void php_sphinx_cache_miss_failed(const char *key, int key_len) /* {{{ */
+{
+#ifdef HAVE_SPHINX_SHM
+	if (php_sphinx_shm_cache) {
+		php_sphinx_shm_release(key, key_len);
+	}
+#endif
+}
+/* }}} */
+
+/* {{{ lazy results
+ * A SphinxResult keeps the results parsed by libsphinxclient and converts the 
+ * matches only when they are accessed. The results live in the handle, so the 
+ * handle is shared by the client and its results objects. When the client needs 
+ * the handle for another request, it leaves the old one to the results objects 
+ * and continues with a fresh one. */
+typedef struct _php_sphinx_result_obj {
+	zend_object std;
+	php_sphinx_results_ref *ref;
+	sphinx_result *result;
+	uint *attr_lens;
+	ulong *attr_hashes;
+	int num_matches; /* 0 if the result is an error */
+	int pos;
+	zend_bool array_result;
+	php_sphinx_client *client; /* the client a deferred query is queued in, NULL once it ran */
+	int batch_pos; /* the position of the deferred query in the batch */
+} php_sphinx_result_obj;
+
+static void php_sphinx_result_obj_dtor(void *object TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_result_obj *r = (php_sphinx_result_obj *)object;
+
+	if (r->ref) {
+		php_sphinx_results_ref_release(r->ref);
+	}
+	if (r->attr_lens) {
+		efree(r->attr_lens);
+		efree(r->attr_hashes);
+	}
+	zend_object_std_dtor(&r->std TSRMLS_CC);
+	efree(r);
+}
+/* }}} */
+
+static zend_object_value php_sphinx_result_new(zend_class_entry *ce TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_result_obj *r;
+	zend_object_value retval;
+#if PHP_VERSION_ID < 50399
+	zval *tmp;
+#endif
+
+	r = ecalloc(1, sizeof(*r));
+	zend_object_std_init(&r->std, ce TSRMLS_CC);
+
+#if PHP_VERSION_ID < 50399
+	ALLOC_HASHTABLE(r->std.properties);
+	zend_hash_init(r->std.properties, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(r->std.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, (void *) &tmp, sizeof(zval *));
+#else
+	object_properties_init(&r->std, ce);
+#endif
+	retval.handle = zend_objects_store_put(r, (zend_objects_store_dtor_t)zend_objects_destroy_object, php_sphinx_result_obj_dtor, NULL TSRMLS_CC);
+	retval.handlers = &php_sphinx_result_handlers;
+	return retval;
+}
+/* }}} */
+
+static php_sphinx_result_obj *php_sphinx_result_get(zval *object TSRMLS_DC);
+
+static int php_sphinx_result_count_elements(zval *object, long *count TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(object TSRMLS_CC);
+	*count = r->num_matches;
+	return SUCCESS;
+}
+/* }}} */
+
+static void php_sphinx_result_bind(php_sphinx_client *c, php_sphinx_result_obj *r, sphinx_result *result TSRMLS_DC) /* {{{ */
+{
+	r->ref = php_sphinx_client_results_ref(c);
+	r->result = result;
+	r->array_result = c->array_result;
+
+	if (result->status == SEARCHD_OK || result->status == SEARCHD_WARNING) {
+		/* the data is not safe to read otherwise */
+		r->num_matches = result->num_matches;
+		php_sphinx_attr_keys(result, &r->attr_lens, &r->attr_hashes);
+	}
+}
+/* }}} */
+
+static void php_sphinx_result_object(php_sphinx_client *c, sphinx_result *result, zval *object TSRMLS_DC) /* {{{ */
+{
+	object_init_ex(object, ce_sphinx_result);
+	php_sphinx_result_bind(c, (php_sphinx_result_obj *)zend_object_store_get_object(object TSRMLS_CC), result TSRMLS_CC);
+}
+/* }}} */
+/* }}} */
+
+static int php_sphinx_client_num_results(php_sphinx_client *c) /* {{{ */
+{
+	return c->cached ? c->cached->num_results : sphinx_get_num_results(c->sphinx);
+}
+/* }}} */
+
+/* {{{ deferred queries
+ * With auto-batch on, query() only queues the query and returns a SphinxResult 
+ * waiting for it. The queued queries run as one batch once any of the deferred 
+ * results is read, or when the client runs its queued queries anyway. */
+
+/* hands the results of the batch to the deferred queries, NULL results leave them empty */
+static void php_sphinx_client_resolve(php_sphinx_client *c, sphinx_result *results TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_result_obj *r;
+	zval **deferred = c->deferred;
+	int i, num_deferred = c->num_deferred, num_results;
+
+	if (!num_deferred) {
+		return;
+	}
+	c->deferred = NULL;
+	c->num_deferred = 0;
+
+	num_results = results ? php_sphinx_client_num_results(c) : 0;
+	for (i = 0; i < num_deferred; i++) {
+		r = (php_sphinx_result_obj *)zend_object_store_get_object(deferred[i] TSRMLS_CC);
+		r->client = NULL;
+		if (r->batch_pos < num_results) {
+			php_sphinx_result_bind(c, r, &results[r->batch_pos] TSRMLS_CC);
+		}
+		zval_ptr_dtor(&deferred[i]);
+	}
+	efree(deferred);
+}
+/* }}} */
+/* }}} */
+
+static void php_sphinx_results_to_array(php_sphinx_client *c, sphinx_result *results, zval *array TSRMLS_DC) /* {{{ */
+{
+	zval *single_result;
+	int i, num_results;
+
+	num_results = php_sphinx_client_num_results(c);
+
+	array_init_size(array, num_results);
+	for (i = 0; i < num_results; i++) {
+		MAKE_STD_ZVAL(single_result);
+		if (c->result_format == SPH_RESULT_LAZY) {
+			php_sphinx_result_object(c, &results[i], single_result TSRMLS_CC);
+		} else {
+			php_sphinx_result_to_array(&results[i], &single_result, c->array_result, c->result_format TSRMLS_CC);
+		}
+		add_next_index_zval(array, single_result);
+	}
+}
+/* }}} */
+
+/* runs the search the way the client is set up, a NULL query runs the queued queries */
+static sphinx_result *php_sphinx_client_search(php_sphinx_client *c, char *query, char *index, char *comment TSRMLS_DC) /* {{{ */
+{
+	sphinx_result *results;
+	php_sphinx_cache_deps deps;
+	smart_str key = {0};
+	double start;
+
+	if (query && c->num_deferred) {
+		/* sphinx_query() does not run with queries queued, the deferred ones go first */
+		php_sphinx_client_search(c, NULL, NULL, NULL TSRMLS_CC);
+	}
+	if (!c->sphinx) {
+		/* the handle was lost to a timed out request */
+		if (!query) {
+			php_sphinx_ops_queries_done(c);
+			php_sphinx_client_resolve(c, NULL TSRMLS_CC);
+		}
+		return NULL;
+	}
+
+	php_sphinx_client_drop_job(c);
+	if (php_sphinx_client_detach_results(c, 1 TSRMLS_CC) == FAILURE) {
+		return NULL;
+	}
+
+	if (c->cache_ttl > 0 && php_sphinx_results_cacheable && (SPHINX_G(cache_size) > 0 || PHP_SPHINX_SHM_ENABLED())) {
+		php_sphinx_cache_key(c, query, index, comment, &key);
+		php_sphinx_cache_deps_init(c, query ? index : NULL, &deps);
+		c->cached = php_sphinx_cache_fetch(key.c, key.len TSRMLS_CC);
+		if (c->cached) {
+			smart_str_free(&key);
+			if (!query) {
+				/* there is no way to drop the queued queries but to start over */
+				sphinx_client *sphinx = php_sphinx_client_handle_new(c, 0 TSRMLS_CC);
+
+				if (!sphinx) {
+					php_sphinx_cached_free(c->cached);
+					c->cached = NULL;
+					return NULL;
+				}
+				sphinx_destroy(c->sphinx);
+				c->sphinx = sphinx;
+				c->persistent = 0;
+				c->backend = -1;
+				php_sphinx_ops_queries_done(c);
+				php_sphinx_client_resolve(c, c->cached->results TSRMLS_CC);
+			}
+			return c->cached->results;
+		}
+	}
+
+	start = php_sphinx_time();
+	php_sphinx_client_cap(c, c->sphinx, php_sphinx_client_remaining(c, start));
+
+#ifdef HAVE_SPHINX_THREADS
+	if (c->num_replicas > 1) {
+		php_sphinx_job *job = php_sphinx_job_new(c->sphinx, query ? php_sphinx_job_query : php_sphinx_job_run_queries);
+
+		if (query) {
+			php_sphinx_job_set_query(job, query, index, comment);
+		}
+		results = php_sphinx_client_hedge(c, job, start TSRMLS_CC);
+	} else if (c->deadline > 0 && !c->num_servers) {
+		results = php_sphinx_client_run_search(c, query, index, comment, start TSRMLS_CC);
+	} else
+#endif
+	if (c->num_servers) {
+		results = php_sphinx_client_failover(c, query, index, comment, start TSRMLS_CC);
+	} else if (query) {
+		results = sphinx_query(c->sphinx, query, index, comment);
+	} else {
+		results = sphinx_run_queries(c->sphinx);
+	}
+	php_sphinx_client_uncap(c, c->sphinx);
+
+	if (key.c) {
+		if (results) {
+			php_sphinx_op block = {0};
+
+			if (php_sphinx_cache_encode(results, query ? 1 : sphinx_get_num_results(c->sphinx), &block) == SUCCESS) {
+				php_sphinx_cache_put(key.c, key.len, block.buf.c, block.buf.len, c->cache_ttl, &deps TSRMLS_CC);
+			}
+			smart_str_free(&block.buf);
+		} else {
+			php_sphinx_cache_miss_failed(key.c, key.len);
+		}
+		smart_str_free(&key);
+	}
+
+	if (!query) {
+		php_sphinx_ops_queries_done(c);
+		if (!results && c->num_deferred) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to run the deferred queries: %s", c->sphinx ? sphinx_error(c->sphinx) : "no handle left");
+		}
+		php_sphinx_client_resolve(c, results TSRMLS_CC);
+	}
+	if (!results) {
+		c->failed = c->persistent;
+	}
+	return results;
+}
+/* }}} */
+
+static void php_sphinx_result_to_ids(sphinx_result *result, zend_bool weights, zval *array) /* {{{ */
+{
+	int i;
+
+	if (result->status != SEARCHD_OK && result->status != SEARCHD_WARNING) {
+		ZVAL_FALSE(array);
+		return;
+	}
+
+	array_init_size(array, result->num_matches);
+	for (i = 0; i < result->num_matches; i++) {
+#if SIZEOF_LONG == 8
+		if (weights) {
+			add_index_long(array, sphinx_get_id(result, i), sphinx_get_weight(result, i));
+		} else {
+			add_next_index_long(array, sphinx_get_id(result, i));
+		}
+#else
+		char buf[128];
+		int buf_len;
+
+		buf_len = slprintf(buf, sizeof(buf), "%.0f", (double)sphinx_get_id(result, i));
+		if (weights) {
+			add_assoc_long_ex(array, buf, buf_len + 1, sphinx_get_weight(result, i));
+		} else {
+			add_next_index_stringl(array, buf, buf_len, 1);
+		}
+#endif
+	}
+}
+/* }}} */
+
+/* the options are in the key as a whole, so that the defaults and the same values given explicitly match */
+static void php_sphinx_excerpts_key(php_sphinx_client *c, php_sphinx_op *key, const char *index, const char *words, sphinx_excerpt_options *opts) /* {{{ */
+{
+	smart_str_appendc(&key->buf, PHP_SPHINX_CACHE_EXCERPT);
+	php_sphinx_cache_servers(c, &key->buf);
+	php_sphinx_op_put_string(key, index);
+	php_sphinx_op_put_string(key, words);
+	php_sphinx_op_put_string(key, opts->before_match);
+	php_sphinx_op_put_string(key, opts->after_match);
+	php_sphinx_op_put_string(key, opts->chunk_separator);
+	php_sphinx_op_put_long(key, opts->limit);
+	php_sphinx_op_put_long(key, opts->around);
+	php_sphinx_op_put_long(key, opts->exact_phrase);
+	php_sphinx_op_put_long(key, opts->single_passage);
+	php_sphinx_op_put_long(key, opts->use_boundaries);
+	php_sphinx_op_put_long(key, opts->weight_order);
+#if LIBSPHINX_VERSION_ID >= 110
+	php_sphinx_op_put_long(key, opts->query_mode);
+	php_sphinx_op_put_long(key, opts->force_all_words);
+	php_sphinx_op_put_long(key, opts->limit_passages);
+	php_sphinx_op_put_long(key, opts->limit_words);
+	php_sphinx_op_put_long(key, opts->start_passage_id);
+	php_sphinx_op_put_string(key, opts->html_strip_mode);
+	php_sphinx_op_put_long(key, opts->allow_empty);
+#endif
+}
+/* }}} */
+
+/* replaces whatever follows the first prefix_len bytes of the key with the hash of the document */
+static void php_sphinx_excerpts_doc_key(php_sphinx_op *key, size_t prefix_len, const char *doc) /* {{{ */
+{
+	PHP_MD5_CTX context;
+	unsigned char digest[16];
+	size_t len = strlen(doc);
+
+	PHP_MD5Init(&context);
+	PHP_MD5Update(&context, doc, len);
+	PHP_MD5Final(digest, &context);
+
+	key->buf.len = prefix_len;
+	php_sphinx_op_put_long(key, (sphinx_int64_t)len);
+	smart_str_appendl(&key->buf, (const char *)digest, sizeof(digest));
+}
+/* }}} */
+
+/* with jobs > 1 the documents are split into chunks built at the same time on 
+   separate connections, spread over the replicas if there are any */
+static char **php_sphinx_client_build_excerpts(php_sphinx_client *c, int num_docs, const char **docs, const char *index, const char *words, 
+		sphinx_excerpt_options *opts, int chunk_size, int num_jobs TSRMLS_DC) /* {{{ */
+{
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_job **jobs;
+	php_sphinx_server *r;
+	sphinx_client *sphinx;
+	char **result, **chunk;
+	int num_chunks, num, failed = 0, i, j;
+
+	if (chunk_size <= 0 || num_jobs <= 1 || num_docs <= chunk_size) {
+		return sphinx_build_excerpts(c->sphinx, num_docs, docs, index, words, opts);
+	}
+
+	num_chunks = (num_docs + chunk_size - 1) / chunk_size;
+	if (num_chunks > num_jobs) {
+		/* bigger chunks rather than more connections */
+		chunk_size = (num_docs + num_jobs - 1) / num_jobs;
+		num_chunks = (num_docs + chunk_size - 1) / chunk_size;
+	}
+
+	/* the first chunk is built on the client's handle meanwhile */
+	jobs = safe_emalloc(num_chunks, sizeof(php_sphinx_job *), 0);
+	jobs[0] = NULL;
+	for (i = 1; i < num_chunks; i++) {
+		jobs[i] = NULL;
+		sphinx = php_sphinx_client_handle_new(c, 0 TSRMLS_CC);
+		if (sphinx && c->num_replicas > 1) {
+			r = &c->replicas[(c->replica + i) % c->num_replicas];
+			if (!sphinx_set_server(sphinx, r->host, (int)r->port)) {
+				sphinx_destroy(sphinx);
+				sphinx = NULL;
+			}
+		}
+		if (!sphinx) {
+			continue;
+		}
+
+		jobs[i] = php_sphinx_job_new(sphinx, php_sphinx_job_excerpts);
+		jobs[i]->index = pestrdup(index, 1);
+		jobs[i]->docs = docs + i * chunk_size;
+		jobs[i]->num_docs = i == num_chunks - 1 ? num_docs - i * chunk_size : chunk_size;
+		jobs[i]->words = words;
+		jobs[i]->opts = opts;
+		php_sphinx_job_start(jobs[i]);
+	}
+
+	result = calloc(num_docs, sizeof(char *));
+	if (!result) {
+		failed = 1;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		num = i == num_chunks - 1 ? num_docs - i * chunk_size : chunk_size;
+		chunk = NULL;
+		if (jobs[i]) {
+			php_sphinx_job_wait(jobs[i]);
+			chunk = jobs[i]->excerpts;
+			sphinx_destroy(jobs[i]->sphinx);
+			php_sphinx_job_free(jobs[i]);
+		}
+
+		/* a failed chunk is retried on the client's handle, which keeps the error */
+		if (!chunk && !failed) {
+			chunk = sphinx_build_excerpts(c->sphinx, num, docs + i * chunk_size, index, words, opts);
+		}
+		if (!chunk) {
+			failed = 1;
+			continue;
+		}
+
+		if (failed) {
+			for (j = 0; j < num; j++) {
+				free(chunk[j]);
+			}
+		} else {
+			memcpy(result + i * chunk_size, chunk, num * sizeof(char *));
+		}
+		free(chunk);
+	}
+	efree(jobs);
+
+	if (failed && result) {
+		for (i = 0; i < num_docs; i++) {
+			free(result[i]);
+		}
+		free(result);
+		result = NULL;
+	}
+	return result;
+#else
+	return sphinx_build_excerpts(c->sphinx, num_docs, docs, index, words, opts);
+#endif
+}
+/* }}} */
+
+/* sphinx_build_excerpts() going through the cache, only the documents missing there are sent 
+   to searchd and their excerpts are merged back in order. Returns malloc'ed strings, the same 
+   as libsphinxclient does. */
+static char **php_sphinx_client_excerpts(php_sphinx_client *c, int num_docs, const char **docs, const char *index, const char *words, 
+		sphinx_excerpt_options *opts, int chunk_size, int num_jobs TSRMLS_DC) /* {{{ */
+{
+	sphinx_excerpt_options defaults;
+	php_sphinx_cache_deps deps = {0}; /* the excerpts do not depend on the indexed documents */
+	php_sphinx_op key = {0};
+	const char **missed_docs;
+	char **result, **fetched, *data;
+	int *missed, num_missed = 0, i, j;
+	size_t prefix_len, data_len;
+
+	if (c->cache_ttl <= 0 || !(SPHINX_G(cache_size) > 0 || PHP_SPHINX_SHM_ENABLED())) {
+		return php_sphinx_client_build_excerpts(c, num_docs, docs, index, words, opts, chunk_size, num_jobs TSRMLS_CC);
+	}
+
+	if (!opts) {
+		sphinx_init_excerpt_options(&defaults);
+		opts = &defaults;
+	}
+#if LIBSPHINX_VERSION_ID >= 110
+	if (opts->load_files) {
+		/* the documents are file names */
+		return php_sphinx_client_build_excerpts(c, num_docs, docs, index, words, opts, chunk_size, num_jobs TSRMLS_CC);
+	}
+#endif
+
+	php_sphinx_excerpts_key(c, &key, index, words, opts);
+	prefix_len = key.buf.len;
+
+	result = calloc(num_docs, sizeof(char *));
+	if (!result) {
+		smart_str_free(&key.buf);
+		return NULL;
+	}
+	missed = safe_emalloc(num_docs, sizeof(int), 0);
+
+	for (i = 0; i < num_docs; i++) {
+		php_sphinx_excerpts_doc_key(&key, prefix_len, docs[i]);
+		data = php_sphinx_cache_get(key.buf.c, key.buf.len, 0, &data_len TSRMLS_CC);
+		if (data && (result[i] = malloc(data_len))) {
+			memcpy(result[i], data, data_len);
+		} else {
+			missed[num_missed++] = i;
+		}
+		if (data) {
+			efree(data);
+		}
+	}
+
+	if (num_missed) {
+		missed_docs = safe_emalloc(num_missed, sizeof(char *), 0);
+		for (j = 0; j < num_missed; j++) {
+			missed_docs[j] = docs[missed[j]];
+		}
+		fetched = php_sphinx_client_build_excerpts(c, num_missed, missed_docs, index, words, opts, chunk_size, num_jobs TSRMLS_CC);
+		efree(missed_docs);
+
+		if (!fetched) {
+			for (j = 0; j < num_missed; j++) {
+				php_sphinx_excerpts_doc_key(&key, prefix_len, docs[missed[j]]);
+				php_sphinx_cache_miss_failed(key.buf.c, key.buf.len);
+			}
+			for (i = 0; i < num_docs; i++) {
+				free(result[i]);
+			}
+			free(result);
+			result = NULL;
+		} else {
+			for (j = 0; j < num_missed; j++) {
+				i = missed[j];
+				result[i] = fetched[j];
+				if (fetched[j]) {
+					php_sphinx_excerpts_doc_key(&key, prefix_len, docs[i]);
+					php_sphinx_cache_put(key.buf.c, key.buf.len, fetched[j], strlen(fetched[j]) + 1, c->cache_ttl, &deps TSRMLS_CC);
+				}
+			}
+			free(fetched);
+		}
+	}
+
+	efree(missed);
+	smart_str_free(&key.buf);
+	return result;
+}
+/* }}} */
+
+/* {{{ proto void SphinxClient::__construct() */
+static PHP_METHOD(SphinxClient, __construct)
+{
+	php_sphinx_client *c;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+
+	if (c->sphinx) {
+		/* called __construct() twice, bail out */
+		return;
+	}
+
+	c->sphinx = sphinx_create(1 /* copy string args */);
+	c->port = PHP_SPHINX_DEFAULT_PORT;
+	c->connect_timeout = FG(default_socket_timeout);
+	
+	sphinx_set_connect_timeout(c->sphinx, FG(default_socket_timeout));
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setServer(string server, int port) */
+static PHP_METHOD(SphinxClient, setServer)
+{
+	php_sphinx_client *c;
+	long port;
+	char *server;
+	int server_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sl", &server, &server_len, &port) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (php_sphinx_client_set_server(c, server, server_len, port TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	php_sphinx_servers_free(c->servers, c->num_servers);
+	c->servers = NULL;
+	c->num_servers = 0;
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_client_free_replicas(c);
+#endif
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setServers(array servers) */
+static PHP_METHOD(SphinxClient, setServers)
+{
+	php_sphinx_client *c;
+	php_sphinx_server *servers;
+	zval *list;
+	int num;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &list) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	servers = php_sphinx_servers_parse(list, &num, 1 TSRMLS_CC);
+	if (!servers) {
+		RETURN_FALSE;
+	}
+
+	php_sphinx_client_drop_backend(c);
+	php_sphinx_servers_free(c->servers, c->num_servers);
+	c->servers = servers;
+	c->num_servers = num;
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_client_free_replicas(c);
+#endif
+	RETURN_TRUE;
+}
+/* }}} */
+
+#ifdef HAVE_SPHINX_THREADS
+/* {{{ proto bool SphinxClient::setReplicas(array servers[, float hedge_delay]) */
+static PHP_METHOD(SphinxClient, setReplicas)
+{
+	php_sphinx_client *c;
+	php_sphinx_server *replicas;
+	zval *servers;
+	double hedge_delay = -1;
+	int num;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a|d", &servers, &hedge_delay) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	replicas = php_sphinx_servers_parse(servers, &num, 0 TSRMLS_CC);
+	if (!replicas) {
+		RETURN_FALSE;
+	}
+
+	if (php_sphinx_client_set_server(c, replicas[0].host, strlen(replicas[0].host), replicas[0].port TSRMLS_CC) == FAILURE) {
+		php_sphinx_servers_free(replicas, num);
+		RETURN_FALSE;
+	}
+
+	php_sphinx_servers_free(c->servers, c->num_servers);
+	c->servers = NULL;
+	c->num_servers = 0;
+	php_sphinx_client_free_replicas(c);
+	c->replicas = replicas;
+	c->num_replicas = num;
+	c->hedge_delay = hedge_delay;
+	RETURN_TRUE;
+}
+/* }}} */
+#endif
+ 
+/* {{{ proto bool SphinxClient::setLimits(int offset, int limit[, int max_matches[, int cutoff]]) */
+static PHP_METHOD(SphinxClient, setLimits)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long offset, limit, max_matches = 1000, cutoff = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ll|ll", &offset, &limit, &max_matches, &cutoff) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_LIMITS);
+	php_sphinx_op_put_long(op, offset);
+	php_sphinx_op_put_long(op, limit);
+	php_sphinx_op_put_long(op, max_matches);
+	php_sphinx_op_put_long(op, cutoff);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setMatchMode(int mode) */
+static PHP_METHOD(SphinxClient, setMatchMode)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long mode;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &mode) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	
+	op = php_sphinx_op_new(PHP_SPHINX_OP_MATCH_MODE);
+	php_sphinx_op_put_long(op, mode);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setIndexWeights(array weights) */
+static PHP_METHOD(SphinxClient, setIndexWeights)
+{
+	php_sphinx_client *c;
+	zval *weights, **item;
+	int num_weights, res = 0, i;
+	int *index_weights;
+	char **index_names;
+	char *string_key;
+	unsigned int string_key_len;
+	unsigned long int num_key;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &weights) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	
+	num_weights = zend_hash_num_elements(Z_ARRVAL_P(weights));
+	if (!num_weights) {
+		/* check for empty array and return false right away */
+		RETURN_FALSE;
+	}
+
+	index_names = safe_emalloc(num_weights, sizeof(char *), 0);
+	index_weights = safe_emalloc(num_weights, sizeof(int), 0);
+
+	/* reset num_weights, we'll reuse it count _real_ number of entries */
+	num_weights = 0;
+
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(weights)); 
+		 zend_hash_get_current_data(Z_ARRVAL_P(weights), (void **)&item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(weights))) {
+		
+		if (zend_hash_get_current_key_ex(Z_ARRVAL_P(weights), &string_key, &string_key_len, &num_key, 0, NULL) != HASH_KEY_IS_STRING) {
+			/* if the key is not string.. well.. you're screwed */
+			break;
+		}
+
+		convert_to_long_ex(item);
+		
+		index_names[num_weights] = estrndup(string_key, string_key_len);
+		index_weights[num_weights] = Z_LVAL_PP(item);
+
+		num_weights++;
+	}
+
+	if (num_weights) {
+		php_sphinx_op *op = php_sphinx_op_new(PHP_SPHINX_OP_INDEX_WEIGHTS);
+
+		php_sphinx_op_put_weights(op, num_weights, index_names, index_weights);
+		res = php_sphinx_client_apply(c, op);
+	}
+
+	for (i = 0; i != num_weights; i++) {
+		efree(index_names[i]);
+	}
+	efree(index_names);
+	efree(index_weights);
+
+	if (!res) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+#if LIBSPHINX_VERSION_ID >= 99
+/* {{{ proto bool SphinxClient::setSelect(string clause) */
+static PHP_METHOD(SphinxClient, setSelect)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *clause;
+	int clause_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &clause, &clause_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_SELECT);
+	php_sphinx_op_put_string(op, clause);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+#endif
+
+/* {{{ proto bool SphinxClient::setIDRange(int min, int max) */
+static PHP_METHOD(SphinxClient, setIDRange)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long min, max;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ll", &min, &max) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_ID_RANGE);
+	php_sphinx_op_put_long(op, min);
+	php_sphinx_op_put_long(op, max);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ filter compaction
+ * The values are sorted and deduplicated. Consecutive values become a range filter, which 
+ * matches the same documents for any attribute. Values with a few holes become a range filter 
+ * and an exclude filter of the holes when that is smaller. That only holds for include filters 
+ * on attributes with one value per document: an MVA having both a hole and a listed value would 
+ * be lost, so the caller has to declare such attributes scalar. */
+
+/* bytes a filter takes in the request besides its values: the attribute name, the type and the exclude flag */
+#define PHP_SPHINX_FILTER_SIZE(attr_len) (4 + (attr_len) + 4 + 4)
+
+static int php_sphinx_value_compare(const void *a, const void *b) /* {{{ */
+{
+	sphinx_int64_t x = *(const sphinx_int64_t *)a, y = *(const sphinx_int64_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+/* }}} */
+
+/* document ids are unsigned, {2^64-1, 0} sorted as signed would make an empty range */
+static int php_sphinx_id_compare(const void *a, const void *b) /* {{{ */
+{
+	sphinx_uint64_t x = *(const sphinx_uint64_t *)a, y = *(const sphinx_uint64_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+/* }}} */
+
+static php_sphinx_op *php_sphinx_filter_op(const char *attr, const sphinx_int64_t *values, int num, int exclude) /* {{{ */
+{
+	php_sphinx_op *op;
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_FILTER);
+	php_sphinx_op_put_string(op, attr);
+	php_sphinx_op_put_long(op, num);
+	php_sphinx_op_put_data(op, values, num * sizeof(sphinx_int64_t));
+	php_sphinx_op_put_long(op, exclude);
+	return op;
+}
+/* }}} */
+
+static php_sphinx_op *php_sphinx_filter_range_op(const char *attr, sphinx_int64_t min, sphinx_int64_t max, int exclude) /* {{{ */
+{
+	php_sphinx_op *op;
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_FILTER_RANGE);
+	php_sphinx_op_put_string(op, attr);
+	php_sphinx_op_put_long(op, min);
+	php_sphinx_op_put_long(op, max);
+	php_sphinx_op_put_long(op, exclude);
+	return op;
+}
+/* }}} */
+
+static int php_sphinx_client_is_scalar(php_sphinx_client *c, const char *attr, int attr_len) /* {{{ */
+{
+	if (!strcmp(attr, "@id")) {
+		return 1;
+	}
+	return c->scalar_attrs && zend_hash_exists(c->scalar_attrs, (char *)attr, attr_len + 1);
+}
+/* }}} */
+
+/* values are sorted in place when the client compacts filters */
+static int php_sphinx_client_add_filter(php_sphinx_client *c, const char *attr, sphinx_int64_t *values, int num, int exclude) /* {{{ */
+{
+	sphinx_int64_t *holes;
+	sphinx_uint64_t num_holes, value;
+	int attr_len = strlen(attr), i, n, res;
+
+	if (!c->compact_filters) {
+		return php_sphinx_client_apply(c, php_sphinx_filter_op(attr, values, num, exclude));
+	}
+
+	qsort(values, num, sizeof(sphinx_int64_t), strcmp(attr, "@id") ? php_sphinx_value_compare : php_sphinx_id_compare);
+	for (i = 1, n = 1; i < num; i++) {
+		if (values[i] != values[n - 1]) {
+			values[n++] = values[i];
+		}
+	}
+	num = n;
+
+	/* the arithmetic is unsigned, so that it holds for either order */
+	num_holes = (sphinx_uint64_t)values[num - 1] - (sphinx_uint64_t)values[0] - (sphinx_uint64_t)(num - 1);
+	if (!num_holes) {
+		return php_sphinx_client_apply(c, php_sphinx_filter_range_op(attr, values[0], values[num - 1], exclude));
+	}
+
+	/* the values take 4 + 8 * num bytes, the range 16 and the holes another filter of 4 + 8 * num_holes */
+	if (exclude || num_holes >= (sphinx_uint64_t)num || !php_sphinx_client_is_scalar(c, attr, attr_len) ||
+		PHP_SPHINX_FILTER_SIZE(attr_len) + 16 + 8 * num_holes >= 8 * (sphinx_uint64_t)num) {
+		return php_sphinx_client_apply(c, php_sphinx_filter_op(attr, values, num, exclude));
+	}
+
+	holes = safe_emalloc((int)num_holes, sizeof(sphinx_int64_t), 0);
+	for (i = 1, n = 0; i < num; i++) {
+		for (value = (sphinx_uint64_t)values[i - 1] + 1; value != (sphinx_uint64_t)values[i]; value++) {
+			holes[n++] = (sphinx_int64_t)value;
+		}
+	}
+
+	res = php_sphinx_client_apply(c, php_sphinx_filter_range_op(attr, values[0], values[num - 1], 0)) &&
+		php_sphinx_client_apply(c, php_sphinx_filter_op(attr, holes, n, 1));
+	efree(holes);
+	return res;
+}
+/* }}} */
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setFilter(string attribute, mixed values[, bool exclude]) 
+   values is an array or a string of 64-bit little endian integers as made by pack('P*') */
+static PHP_METHOD(SphinxClient, setFilter)
+{
+	php_sphinx_client *c;
+	zval *values, **item;
+	char *attribute;
+	int	attribute_len, num_values, i = 0, res;
+	zend_bool exclude = 0;
+	sphinx_int64_t *u_values;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sz|b", &attribute, &attribute_len, &values, &exclude) == FAILURE) {
+		return;
+	}
+	
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	switch (Z_TYPE_P(values)) {
+		case IS_ARRAY:
+			num_values = zend_hash_num_elements(Z_ARRVAL_P(values));
+			break;
+		case IS_STRING:
+			if (Z_STRLEN_P(values) % sizeof(sphinx_int64_t)) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "packed values must be a multiple of %d bytes long", (int)sizeof(sphinx_int64_t));
+				RETURN_FALSE;
+			}
+			num_values = Z_STRLEN_P(values) / sizeof(sphinx_int64_t);
+			break;
+		default:
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "values must be an array or a packed string");
+			RETURN_FALSE;
+	}
+	if (!num_values) {
+		RETURN_FALSE;
+	}
+
+#ifndef WORDS_BIGENDIAN
+	if (Z_TYPE_P(values) == IS_STRING && !c->compact_filters) {
+		/* already in the layout libsphinxclient takes, a single copy into the op */
+		if (!php_sphinx_client_apply(c, php_sphinx_filter_op(attribute, (const sphinx_int64_t *)Z_STRVAL_P(values), num_values, exclude))) {
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
+#endif
+
+	u_values = safe_emalloc(num_values, sizeof(sphinx_int64_t), 0);
+
+	if (Z_TYPE_P(values) == IS_STRING) {
+#ifdef WORDS_BIGENDIAN
+		const unsigned char *packed = (const unsigned char *)Z_STRVAL_P(values);
+		int j;
+
+		for (i = 0; i < num_values; i++, packed += sizeof(sphinx_int64_t)) {
+			sphinx_uint64_t value = 0;
+
+			for (j = sizeof(sphinx_int64_t) - 1; j >= 0; j--) {
+				value = (value << 8) | packed[j];
+			}
+			u_values[i] = (sphinx_int64_t)value;
+		}
+#else
+		memcpy(u_values, Z_STRVAL_P(values), Z_STRLEN_P(values));
+#endif
+	} else {
+		for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(values));
+			 zend_hash_get_current_data(Z_ARRVAL_P(values), (void **) &item) != FAILURE;
+			 zend_hash_move_forward(Z_ARRVAL_P(values))) {
+			
+			convert_to_double_ex(item);
+			u_values[i] = (sphinx_int64_t)Z_DVAL_PP(item);
+			i++;
+		}
+	}
+
+	res = php_sphinx_client_add_filter(c, attribute, u_values, num_values, exclude ? 1 : 0);
+	efree(u_values);
+
+	if (!res) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+#ifdef HAVE_SPHINX_ADD_FILTER_STRING
+/* {{{ proto bool SphinxClient::setFilterString(string attribute, string value[, bool exclude]) */
+static PHP_METHOD(SphinxClient, setFilterString)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *attribute, *value;
+	int	attribute_len, value_len;
+	zend_bool exclude = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss|b", &attribute, &attribute_len, &value, &value_len, &exclude) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_FILTER_STRING);
+	php_sphinx_op_put_string(op, attribute);
+	php_sphinx_op_put_string(op, value);
+	php_sphinx_op_put_long(op, exclude ? 1 : 0);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+#endif
+
+/* {{{ proto bool SphinxClient::setFilterRange(string attribute, int min, int max[, bool exclude]) */
+static PHP_METHOD(SphinxClient, setFilterRange)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *attribute;
+	int attribute_len;
+	long min, max;
+	zend_bool exclude = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sll|b", &attribute, &attribute_len, &min, &max, &exclude ) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_FILTER_RANGE);
+	php_sphinx_op_put_string(op, attribute);
+	php_sphinx_op_put_long(op, min);
+	php_sphinx_op_put_long(op, max);
+	php_sphinx_op_put_long(op, exclude);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setFilterFloatRange(string attribute, float min, float max[, bool exclude]) */
+static PHP_METHOD(SphinxClient, setFilterFloatRange)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *attribute;
+	int attribute_len;
+	double min, max;
+	zend_bool exclude = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sdd|b", &attribute, &attribute_len, &min, &max, &exclude) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_FILTER_FLOAT_RANGE);
+	php_sphinx_op_put_string(op, attribute);
+	php_sphinx_op_put_double(op, min);
+	php_sphinx_op_put_double(op, max);
+	php_sphinx_op_put_long(op, exclude);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setGeoAnchor(string attrlat, string attrlong, float latitude, float longitude) */
+static PHP_METHOD(SphinxClient, setGeoAnchor)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *attrlat, *attrlong;
+	int attrlat_len, attrlong_len;
+	double latitude, longitude;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ssdd", &attrlat, &attrlat_len, &attrlong, &attrlong_len, &latitude, &longitude) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_GEO_ANCHOR);
+	php_sphinx_op_put_string(op, attrlat);
+	php_sphinx_op_put_string(op, attrlong);
+	php_sphinx_op_put_double(op, latitude);
+	php_sphinx_op_put_double(op, longitude);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setGroupBy(string attribute, int func[, string groupsort]) */
+static PHP_METHOD(SphinxClient, setGroupBy)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *attribute, *groupsort = NULL;
+	int attribute_len, groupsort_len;
+	long func;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sl|s", &attribute, &attribute_len, &func, &groupsort, &groupsort_len) == FAILURE) {
+		return;
+	}
+	
+	if (groupsort == NULL) {
+		groupsort = "@group desc";
+	}
+
+	if (func < SPH_GROUPBY_DAY || func > SPH_GROUPBY_ATTRPAIR) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid group func specified (%ld)", func);
+		RETURN_FALSE;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_GROUP_BY);
+	php_sphinx_op_put_string(op, attribute);
+	php_sphinx_op_put_long(op, func);
+	php_sphinx_op_put_string(op, groupsort);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setGroupDistinct(string attribute) */
+static PHP_METHOD(SphinxClient, setGroupDistinct)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	char *attribute;
+	int attribute_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &attribute, &attribute_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_GROUP_DISTINCT);
+	php_sphinx_op_put_string(op, attribute);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setRetries(int count[, int delay]) */
+static PHP_METHOD(SphinxClient, setRetries)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long count, delay = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|l", &count, &delay) == FAILURE) {
+		return; 
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_RETRIES);
+	php_sphinx_op_put_long(op, count);
+	php_sphinx_op_put_long(op, delay);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setMaxQueryTime(int qtime) */
+static PHP_METHOD(SphinxClient, setMaxQueryTime)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long qtime;
+	int res;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &qtime) == FAILURE) {
+		return;	
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	res = sphinx_set_max_query_time(c->sphinx, (int)qtime);
+
+	if (!res) {
+		RETURN_FALSE;
+	}
+	c->max_query_time = qtime;
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_MAX_QUERY_TIME);
+	php_sphinx_op_put_long(op, qtime);
+	php_sphinx_ops_add(c, op);
+	RETURN_TRUE;
+}
+/* }}} */
+
+#ifdef HAVE_3ARG_SPHINX_SET_RANKING_MODE
+/* {{{ proto bool SphinxClient::setRankingMode(int ranker[, string ranking_expression]) */
+static PHP_METHOD(SphinxClient, setRankingMode)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long ranker;
+	int rank_expr_len;
+	char *rank_expr = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|s", &ranker, &rank_expr, &rank_expr_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_RANKING_MODE);
+	php_sphinx_op_put_long(op, ranker);
+	php_sphinx_op_put_string(op, rank_expr);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+#else
+/* {{{ proto bool SphinxClient::setRankingMode(int ranker) */
+static PHP_METHOD(SphinxClient, setRankingMode)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long ranker;
+	int res;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &ranker) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_RANKING_MODE);
+	php_sphinx_op_put_long(op, ranker);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+#endif
+
+/* {{{ proto bool SphinxClient::setFieldWeights(array weights) */
+static PHP_METHOD(SphinxClient, setFieldWeights)
+{
+	php_sphinx_client *c;
+	zval *weights, **item;
+	int num_weights, res = 0, i;
+	int *field_weights;
+	char **field_names;
+	char *string_key;
+	unsigned int string_key_len;
+	unsigned long int num_key;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &weights) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	num_weights = zend_hash_num_elements(Z_ARRVAL_P(weights));
+	if (!num_weights) {
+		/* check for empty array and return false right away */
+		RETURN_FALSE;
+	}
+
+	field_names = safe_emalloc(num_weights, sizeof(char *), 0);
+	field_weights = safe_emalloc(num_weights, sizeof(int), 0);
+
+	/* reset num_weights, we'll reuse it count _real_ number of entries */
+	num_weights = 0;
+
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(weights)); 
+		 zend_hash_get_current_data(Z_ARRVAL_P(weights), (void **)&item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(weights))) {
+		
+		if (zend_hash_get_current_key_ex(Z_ARRVAL_P(weights), &string_key, &string_key_len, &num_key, 0, NULL) != HASH_KEY_IS_STRING) {
+			/* if the key is not string.. well.. you're screwed */
+			break;
+		}
+
+		convert_to_long_ex(item);
+		
+		field_names[num_weights] = estrndup(string_key, string_key_len);
+		field_weights[num_weights] = Z_LVAL_PP(item);
+
+		num_weights++;
+	}
+
+	if (num_weights) {
+		php_sphinx_op *op = php_sphinx_op_new(PHP_SPHINX_OP_FIELD_WEIGHTS);
+
+		php_sphinx_op_put_weights(op, num_weights, field_names, field_weights);
+		res = php_sphinx_client_apply(c, op);
+	}
+
+	for (i = 0; i != num_weights; i++) {
+		efree(field_names[i]);
+	}
+	efree(field_names);
+	efree(field_weights);
+
+	if (!res) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setSortMode(int mode[, string sortby]) */
+static PHP_METHOD(SphinxClient, setSortMode)
+{
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	long mode;
+	char *sortby = NULL;
+	int sortby_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|s", &mode, &sortby, &sortby_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_SORT_MODE);
+	php_sphinx_op_put_long(op, mode);
+	php_sphinx_op_put_string(op, sortby);
+	if (!php_sphinx_client_apply(c, op)) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setConnectTimeout(float timeout) */
+static PHP_METHOD(SphinxClient, setConnectTimeout)
+{   
+	php_sphinx_client *c;
+	php_sphinx_op *op;
+	double timeout;
+	int res;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "d", &timeout) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	res = sphinx_set_connect_timeout(c->sphinx, timeout);
+
+	if (!res) {
+		RETURN_FALSE;
+	}
+	c->connect_timeout = timeout;
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_CONNECT_TIMEOUT);
+	php_sphinx_op_put_double(op, timeout);
+	php_sphinx_ops_add(c, op);
+	RETURN_TRUE;
+}   
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setDeadline(float timeout) */
+static PHP_METHOD(SphinxClient, setDeadline)
+{
+	php_sphinx_client *c;
+	double timeout;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "d", &timeout) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (timeout < 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "deadline cannot be negative");
+		RETURN_FALSE;
+	}
+
+	c->deadline = timeout;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setArrayResult(bool array_result) */
+static PHP_METHOD(SphinxClient, setArrayResult)
+{
+	php_sphinx_client *c;
+	zend_bool array_result;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "b", &array_result) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	c->array_result = array_result; 
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setResultFormat(int format) */
+static PHP_METHOD(SphinxClient, setResultFormat)
+{
+	php_sphinx_client *c;
+	long format;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &format) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (format != SPH_RESULT_ROWS && format != SPH_RESULT_COLUMNAR && format != SPH_RESULT_LAZY) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown result format %ld", format);
+		RETURN_FALSE;
+	}
+
+	c->result_format = (int)format;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::prepare(string name) */
+static PHP_METHOD(SphinxClient, prepare)
+{
+	php_sphinx_client *c;
+	php_sphinx_template tpl;
+	smart_str buf = {0};
+	char *name;
+	int name_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &name, &name_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	php_sphinx_ops_encode(c->ops, PHP_SPHINX_OPS_CONNECTION | PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ADD_QUERY), &buf);
+
+	tpl.len = buf.len;
+	tpl.data = pemalloc(buf.len ? buf.len : 1, 1);
+	if (buf.len) {
+		memcpy(tpl.data, buf.c, buf.len);
+	}
+	smart_str_free(&buf);
+
+	if (zend_hash_update(&SPHINX_G(templates), name, name_len + 1, (void *)&tpl, sizeof(tpl), NULL) == FAILURE) {
+		pefree(tpl.data, 1);
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::usePrepared(string name) */
+static PHP_METHOD(SphinxClient, usePrepared)
+{
+	php_sphinx_client *c;
+	php_sphinx_template *tpl;
+	php_sphinx_op *ops;
+	char *name;
+	int name_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &name, &name_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (zend_hash_find(&SPHINX_G(templates), name, name_len + 1, (void **)&tpl) == FAILURE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "no prepared settings named '%s'", name);
+		RETURN_FALSE;
+	}
+
+	if (php_sphinx_ops_decode(tpl->data, tpl->len, &ops) == FAILURE
+		|| php_sphinx_client_load_ops(c, ops TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+static unsigned int php_sphinx_config_crc(const char *data, size_t len) /* {{{ */
+{
+	unsigned int crc = ~0U;
+
+	while (len--) {
+		CRC32(crc, (unsigned char)*data++);
+	}
+	return ~crc;
+}
+/* }}} */
+
+/* {{{ proto string SphinxClient::exportConfig() */
+static PHP_METHOD(SphinxClient, exportConfig)
+{
+	php_sphinx_client *c;
+	php_sphinx_config_header header;
+	php_sphinx_op body = {0};
+	smart_str journal = {0}, out = {0};
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	php_sphinx_op_put_long(&body, c->array_result);
+	php_sphinx_op_put_long(&body, c->result_format);
+	php_sphinx_op_put_long(&body, c->cache_ttl);
+	php_sphinx_op_put_double(&body, c->deadline);
+	php_sphinx_servers_put(&body, c->servers, c->num_servers);
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_op_put_double(&body, c->hedge_delay);
+	php_sphinx_servers_put(&body, c->replicas, c->num_replicas);
+#else
+	php_sphinx_op_put_double(&body, -1);
+	php_sphinx_servers_put(&body, NULL, 0);
+#endif
+
+	/* the queued queries are not a part of the configuration */
+	php_sphinx_ops_encode(c->ops, PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ADD_QUERY), &journal);
+	php_sphinx_op_put_long(&body, journal.len);
+	php_sphinx_op_put_data(&body, journal.c, journal.len);
+	smart_str_free(&journal);
+
+	memcpy(header.magic, PHP_SPHINX_CONFIG_MAGIC, sizeof(header.magic));
+	header.version = PHP_SPHINX_CONFIG_VERSION;
+	header.build = PHP_SPHINX_CONFIG_BUILD;
+	header.crc = php_sphinx_config_crc(body.buf.c, body.buf.len);
+
+	smart_str_appendl(&out, (const char *)&header, sizeof(header));
+	smart_str_appendl(&out, body.buf.c, body.buf.len);
+	smart_str_0(&out);
+	smart_str_free(&body.buf);
+
+	RETURN_STRINGL(out.c, out.len, 0);
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::importConfig(string data) */
+static PHP_METHOD(SphinxClient, importConfig)
+{
+	php_sphinx_client *c;
+	php_sphinx_config_header header;
+	php_sphinx_server *servers, *replicas;
+	php_sphinx_op *ops, *op, **link, *server, *timeout;
+	const char *p, *end, *host = PHP_SPHINX_DEFAULT_HOST;
+	const void *journal;
+	char *data;
+	int data_len, num_servers, num_replicas, res;
+	double deadline, hedge_delay;
+	sphinx_int64_t array_result, result_format, cache_ttl, journal_len, port = PHP_SPHINX_DEFAULT_PORT;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &data, &data_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if ((size_t)data_len < sizeof(header)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid configuration data");
+		RETURN_FALSE;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, PHP_SPHINX_CONFIG_MAGIC, sizeof(header.magic)) != 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid configuration data");
+		RETURN_FALSE;
+	}
+	if (header.version != PHP_SPHINX_CONFIG_VERSION) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "unsupported configuration version %d", header.version);
+		RETURN_FALSE;
+	}
+	if (header.build != PHP_SPHINX_CONFIG_BUILD) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "the configuration was exported with a different libsphinxclient");
+		RETURN_FALSE;
+	}
+	if (header.crc != php_sphinx_config_crc(data + sizeof(header), data_len - sizeof(header))) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "corrupted configuration data");
+		RETURN_FALSE;
+	}
+
+	p = data + sizeof(header);
+	end = data + data_len;
+	servers = replicas = NULL;
+	num_servers = num_replicas = 0;
+	if (php_sphinx_op_read_long(&p, end, &array_result) == FAILURE
+		|| php_sphinx_op_read_long(&p, end, &result_format) == FAILURE
+		|| php_sphinx_op_read_long(&p, end, &cache_ttl) == FAILURE
+		|| php_sphinx_op_read_double(&p, end, &deadline) == FAILURE
+		|| php_sphinx_servers_get(&p, end, &servers, &num_servers) == FAILURE
+		|| php_sphinx_op_read_double(&p, end, &hedge_delay) == FAILURE
+		|| php_sphinx_servers_get(&p, end, &replicas, &num_replicas) == FAILURE
+		|| php_sphinx_op_read_long(&p, end, &journal_len) == FAILURE
+		|| (result_format != SPH_RESULT_ROWS && result_format != SPH_RESULT_COLUMNAR && result_format != SPH_RESULT_LAZY)
+		|| cache_ttl < 0 || cache_ttl > LONG_MAX
+		|| journal_len < 0 || (sphinx_uint64_t)journal_len > (size_t)(end - p)
+		|| php_sphinx_op_read_data(&p, end, (size_t)journal_len, &journal) == FAILURE || p != end
+		|| php_sphinx_ops_decode(journal, (size_t)journal_len, &ops) == FAILURE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "corrupted configuration data");
+		php_sphinx_servers_free(servers, num_servers);
+		php_sphinx_servers_free(replicas, num_replicas);
+		RETURN_FALSE;
+	}
+
+	/* the connection settings go their own way, the last ones win */
+	server = timeout = NULL;
+	for (link = &ops; *link; ) {
+		op = *link;
+		if (op->code == PHP_SPHINX_OP_SERVER || op->code == PHP_SPHINX_OP_CONNECT_TIMEOUT) {
+			*link = op->next;
+			op->next = NULL;
+			if (op->code == PHP_SPHINX_OP_SERVER) {
+				if (server) {
+					php_sphinx_op_free(server);
+				}
+				server = op;
+			} else {
+				if (timeout) {
+					php_sphinx_op_free(timeout);
+				}
+				timeout = op;
+			}
+		} else {
+			link = &op->next;
+		}
+	}
+
+	if (server) {
+		const char *q = server->buf.c;
+
+		host = php_sphinx_op_get_string(&q);
+		port = php_sphinx_op_get_long(&q);
+	}
+	if (port < 0 || port > 65535 || (port == 0 && host[0] != '/')) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "corrupted configuration data");
+		res = FAILURE;
+	} else {
+		/* the settings first, they are loaded all or nothing */
+		res = php_sphinx_client_load_ops(c, ops TSRMLS_CC);
+		ops = NULL;
+		if (res == SUCCESS) {
+			/* set_server() records its own op */
+			res = php_sphinx_client_set_server(c, (char *)host, strlen(host), (long)port TSRMLS_CC);
+		}
+	}
+	if (res == SUCCESS && timeout) {
+		const char *q = timeout->buf.c;
+
+		c->connect_timeout = php_sphinx_op_get_double(&q);
+		sphinx_set_connect_timeout(c->sphinx, c->connect_timeout);
+		php_sphinx_ops_add(c, timeout);
+		timeout = NULL;
+	}
+	php_sphinx_ops_free(ops);
+	if (server) {
+		php_sphinx_op_free(server);
+	}
+	if (timeout) {
+		php_sphinx_op_free(timeout);
+	}
+	if (res == FAILURE) {
+		php_sphinx_servers_free(servers, num_servers);
+		php_sphinx_servers_free(replicas, num_replicas);
+		RETURN_FALSE;
+	}
+
+	php_sphinx_servers_free(c->servers, c->num_servers);
+	c->servers = servers;
+	c->num_servers = num_servers;
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_client_free_replicas(c);
+	c->replicas = replicas;
+	c->num_replicas = num_replicas;
+	c->hedge_delay = hedge_delay;
+#else
+	php_sphinx_servers_free(replicas, num_replicas);
+#endif
+	c->array_result = array_result ? 1 : 0;
+	c->result_format = (int)result_format;
+	c->cache_ttl = cache_ttl;
+	c->deadline = deadline;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setCache(int ttl) */
+static PHP_METHOD(SphinxClient, setCache)
+{
+	php_sphinx_client *c;
+	long ttl;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &ttl) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (ttl < 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cache ttl cannot be negative");
+		RETURN_FALSE;
+	}
+
+	c->cache_ttl = ttl;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setAutoBatch(bool enable) */
+static PHP_METHOD(SphinxClient, setAutoBatch)
+{
+	php_sphinx_client *c;
+	zend_bool enable;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "b", &enable) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	c->auto_batch = enable;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setFilterCompaction(bool enable[, array scalar_attributes]) */
+static PHP_METHOD(SphinxClient, setFilterCompaction)
+{
+	php_sphinx_client *c;
+	zval *attrs = NULL, **item;
+	zend_bool enable;
+	char tmp = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "b|a", &enable, &attrs) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	php_sphinx_attrs_free(c->scalar_attrs);
+	c->scalar_attrs = NULL;
+	c->compact_filters = enable;
+
+	if (attrs && zend_hash_num_elements(Z_ARRVAL_P(attrs))) {
+		ALLOC_HASHTABLE(c->scalar_attrs);
+		zend_hash_init(c->scalar_attrs, zend_hash_num_elements(Z_ARRVAL_P(attrs)), NULL, NULL, 0);
+
+		for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(attrs));
+			 zend_hash_get_current_data(Z_ARRVAL_P(attrs), (void **) &item) != FAILURE;
+			 zend_hash_move_forward(Z_ARRVAL_P(attrs))) {
+
+			convert_to_string_ex(item);
+			zend_hash_update(c->scalar_attrs, Z_STRVAL_PP(item), Z_STRLEN_PP(item) + 1, &tmp, sizeof(tmp), NULL);
+		}
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::getCacheStats() */
+static PHP_METHOD(SphinxClient, getCacheStats)
+{
+#ifdef HAVE_SPHINX_SHM
+	if (php_sphinx_shm_cache) {
+		array_init_size(return_value, 6);
+		php_sphinx_shm_stats(return_value);
+		return;
+	}
+#endif
+	array_init_size(return_value, 5);
+	add_assoc_long_ex(return_value, "hits", sizeof("hits"), SPHINX_G(cache_hits));
+	add_assoc_long_ex(return_value, "misses", sizeof("misses"), SPHINX_G(cache_misses));
+	add_assoc_long_ex(return_value, "evictions", sizeof("evictions"), SPHINX_G(cache_evictions));
+	add_assoc_long_ex(return_value, "entries", sizeof("entries"), zend_hash_num_elements(&SPHINX_G(cache)));
+	add_assoc_long_ex(return_value, "bytes", sizeof("bytes"), (long)SPHINX_G(cache_bytes));
+}
+/* }}} */
+
+#if LIBSPHINX_VERSION_ID >= 110
+/* whether the error came from searchd, as opposed to the connection to it */
+static int php_sphinx_searchd_error(const char *error) /* {{{ */
+{
+	return strncmp(error, "searchd error", sizeof("searchd error") - 1) == 0
+		|| strncmp(error, "temporary searchd error", sizeof("temporary searchd error") - 1) == 0;
+}
+/* }}} */
+
+/* {{{ multi-document MVA updates
+ * sphinx_update_attributes_mva() sends one document and one attribute per request, while an 
+ * UpdateAttributes request can carry every attribute of many documents. So the updates are 
+ * encoded here and sent on a connection of the extension's own. Whatever goes wrong there is 
+ * left to the library, one request per document and attribute, which tells the failed 
+ * documents apart. */
+#define PHP_SPHINX_UPDATE_PACKET_SIZE (1024 * 1024)
+#define PHP_SPHINX_MAX_REPLY_SIZE (8 * 1024 * 1024)
+#define PHP_SPHINX_PROTO_VERSION 1
+#define PHP_SPHINX_COMMAND_UPDATE 2
+#define PHP_SPHINX_VER_COMMAND_UPDATE 0x102
+
+/* the protocol is big endian */
+static void php_sphinx_net_put_int(smart_str *buf, unsigned int value) /* {{{ */
+{
+	char bytes[4];
+
+	bytes[0] = (char)(value >> 24);
+	bytes[1] = (char)(value >> 16);
+	bytes[2] = (char)(value >> 8);
+	bytes[3] = (char)value;
+	smart_str_appendl(buf, bytes, sizeof(bytes));
+}
+/* }}} */
+
+static void php_sphinx_net_put_string(smart_str *buf, const char *str) /* {{{ */
+{
+	size_t len = strlen(str);
+
+	php_sphinx_net_put_int(buf, (unsigned int)len);
+	smart_str_appendl(buf, str, len);
+}
+/* }}} */
+
+static unsigned int php_sphinx_net_get_int(const char *p) /* {{{ */
+{
+	const unsigned char *b = (const unsigned char *)p;
+
+	return ((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16) | ((unsigned int)b[2] << 8) | b[3];
+}
+/* }}} */
+
+static int php_sphinx_net_read(php_stream *stream, char *buf, size_t len TSRMLS_DC) /* {{{ */
+{
+	size_t n;
+
+	while (len) {
+		/* nothing read means the connection is closed or timed out */
+		n = php_stream_read(stream, buf, len);
+		if (!n) {
+			return FAILURE;
+		}
+		buf += n;
+		len -= n;
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* connects to the server the client's handle talks to and does the handshake */
+static php_stream *php_sphinx_net_connect(php_sphinx_client *c TSRMLS_DC) /* {{{ */
+{
+	php_stream *stream;
+	smart_str hello = {0};
+	struct timeval tv;
+	const char *host = c->host ? c->host : PHP_SPHINX_DEFAULT_HOST;
+	char *name, *errstr = NULL, version[4];
+	int name_len, errcode = 0, res;
+	long port = c->port;
+	double timeout = c->connect_timeout > 0 ? c->connect_timeout : (double)FG(default_socket_timeout);
+
+	if (c->backend >= 0) {
+		host = c->servers[c->backend].host;
+		port = c->servers[c->backend].port;
+	}
+	if (host[0] == '/') {
+		name_len = spprintf(&name, 0, "unix://%s", host);
+	} else {
+		name_len = spprintf(&name, 0, "tcp://%s:%ld", host, port);
+	}
+
+	tv.tv_sec = (long)timeout;
+	tv.tv_usec = (long)((timeout - tv.tv_sec) * 1000000);
+	stream = php_stream_xport_create(name, name_len, 0, STREAM_XPORT_CLIENT | STREAM_XPORT_CONNECT, 
+			NULL, &tv, NULL, &errstr, &errcode);
+	efree(name);
+	if (errstr) {
+		efree(errstr);
+	}
+	if (!stream) {
+		return NULL;
+	}
+	php_stream_set_option(stream, PHP_STREAM_OPTION_READ_TIMEOUT, 0, &tv);
+
+	php_sphinx_net_put_int(&hello, PHP_SPHINX_PROTO_VERSION);
+	res = php_stream_write(stream, hello.c, hello.len) == hello.len 
+		&& php_sphinx_net_read(stream, version, sizeof(version) TSRMLS_CC) == SUCCESS 
+		&& php_sphinx_net_get_int(version) >= 1;
+	smart_str_free(&hello);
+	if (!res) {
+		php_stream_close(stream);
+		return NULL;
+	}
+	return stream;
+}
+/* }}} */
+
+/* one UpdateAttributes request for num_docs documents, data holds the count and the values of 
+   every attribute of each of them in turn; returns the number of documents updated or -1 */
+static int php_sphinx_update_mva_send(php_stream *stream, const char *index, const char **attrs, int num_attrs, 
+		const sphinx_uint64_t *docids, const unsigned int *data, int num_docs TSRMLS_DC) /* {{{ */
+{
+	smart_str req = {0}, body = {0};
+	char header[8], *reply;
+	unsigned int status, len, warning_len;
+	int a, i, res = -1;
+	unsigned int n;
+
+	php_sphinx_net_put_string(&body, index);
+	php_sphinx_net_put_int(&body, num_attrs);
+	for (a = 0; a < num_attrs; a++) {
+		php_sphinx_net_put_string(&body, attrs[a]);
+		php_sphinx_net_put_int(&body, 1); /* MVA */
+	}
+	php_sphinx_net_put_int(&body, num_docs);
+	for (i = 0; i < num_docs; i++) {
+		php_sphinx_net_put_int(&body, (unsigned int)(docids[i] >> 32));
+		php_sphinx_net_put_int(&body, (unsigned int)docids[i]);
+		for (a = 0; a < num_attrs; a++) {
+			n = *data++;
+			php_sphinx_net_put_int(&body, n);
+			while (n--) {
+				php_sphinx_net_put_int(&body, *data++);
+			}
+		}
+	}
+
+	php_sphinx_net_put_int(&req, (PHP_SPHINX_COMMAND_UPDATE << 16) | PHP_SPHINX_VER_COMMAND_UPDATE);
+	php_sphinx_net_put_int(&req, (unsigned int)body.len);
+	smart_str_appendl(&req, body.c, body.len);
+	smart_str_free(&body);
+
+	if (php_stream_write(stream, req.c, req.len) != req.len
+		|| php_sphinx_net_read(stream, header, sizeof(header) TSRMLS_CC) == FAILURE) {
+		smart_str_free(&req);
+		return -1;
+	}
+	smart_str_free(&req);
+
+	status = php_sphinx_net_get_int(header) >> 16;
+	len = php_sphinx_net_get_int(header + 4);
+	if (len > PHP_SPHINX_MAX_REPLY_SIZE) {
+		return -1;
+	}
+	reply = emalloc(len + 1);
+	if (php_sphinx_net_read(stream, reply, len TSRMLS_CC) == SUCCESS) {
+		if (status == SEARCHD_OK && len >= 4) {
+			res = (int)php_sphinx_net_get_int(reply);
+		} else if (status == SEARCHD_WARNING && len >= 4) {
+			warning_len = php_sphinx_net_get_int(reply);
+			if (len >= 8 && warning_len <= len - 8) {
+				res = (int)php_sphinx_net_get_int(reply + 4 + warning_len);
+			}
+		}
+	}
+	efree(reply);
+	return res;
+}
+/* }}} */
+
+/* sends the documents in as few requests as fit PHP_SPHINX_UPDATE_PACKET_SIZE, stops at the first 
+   request that fails; returns the number of documents sent and their updated count in *updated, 
+   *data is moved past them */
+static int php_sphinx_update_mva(php_sphinx_client *c, const char *index, const char **attrs, int num_attrs, 
+		const sphinx_uint64_t *docids, const unsigned int **data, int num_docs, int *updated TSRMLS_DC) /* {{{ */
+{
+	php_stream *stream;
+	const unsigned int *q;
+	size_t size;
+	int a, i, sent = 0, res;
+
+	*updated = 0;
+	stream = php_sphinx_net_connect(c TSRMLS_CC);
+	if (!stream) {
+		return 0;
+	}
+
+	while (sent < num_docs) {
+		/* as many documents as fit, at least one */
+		q = *data;
+		size = 0;
+		for (i = sent; i < num_docs && (i == sent || size < PHP_SPHINX_UPDATE_PACKET_SIZE); i++) {
+			size += 8;
+			for (a = 0; a < num_attrs; a++) {
+				size += 4 + 4 * (size_t)*q;
+				q += 1 + *q;
+			}
+		}
+
+		res = php_sphinx_update_mva_send(stream, index, attrs, num_attrs, docids + sent, *data, i - sent TSRMLS_CC);
+		if (res < 0) {
+			break;
+		}
+		*updated += res;
+		*data = q;
+		sent = i;
+	}
+	php_stream_close(stream);
+	return sent;
+}
+/* }}} */
+/* }}} */
+#endif
+
+/* {{{ proto int SphinxClient::updateAttributes(string index, array attributes, array values[, bool mva[, array &failed]]) */
+static PHP_METHOD(SphinxClient, updateAttributes)
+{
+	php_sphinx_client *c;
+	zval *attributes, *values, *failed_ids = NULL, **item; 
+	char *index;
+	const char **attrs;
+	int index_len, attrs_num, values_num;
+	int res = 0;
+	sphinx_uint64_t *docids = NULL;
+	sphinx_int64_t *vals = NULL;
+	unsigned int *vals_mva = NULL;
+#if LIBSPHINX_VERSION_ID >= 110
+	const unsigned int *mva_data;
+	size_t mva_len = 0, mva_size = 0;
+	int values_mva_num, sent, updated, opened = 0, num_failed = 0, update_failed;
+	zend_bool lost = 0;
+	zval **attr_value_mva;
+#endif
+	int a = 0, i = 0, j = 0;
+	zend_bool mva = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "saa|bz", &index, &index_len, &attributes, &values, &mva, &failed_ids) == FAILURE) {
+		return;
+	}
+
+#if LIBSPHINX_VERSION_ID < 110
+	if (mva) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "update mva attributes is not supported");
+		RETURN_FALSE;
+	}
+#endif
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	php_sphinx_client_drop_job(c);
+
+	attrs_num = zend_hash_num_elements(Z_ARRVAL_P(attributes));
+
+	if (!attrs_num) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty attributes array passed");
+		RETURN_FALSE;
+	}
+
+	values_num = zend_hash_num_elements(Z_ARRVAL_P(values));
+
+	if (!values_num) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty values array passed");
+		RETURN_FALSE;
+	}
+
+	if (failed_ids) {
+		zval_dtor(failed_ids);
+		array_init(failed_ids);
+	}
+
+	attrs = emalloc(sizeof(char *) * attrs_num);
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(attributes));
+		 zend_hash_get_current_data(Z_ARRVAL_P(attributes), (void **) &item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(attributes))) {
+		if (Z_TYPE_PP(item) != IS_STRING) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "non-string attributes are not allowed");
+			break;
+		}
+		attrs[a] = Z_STRVAL_PP(item); /* no copying here! */
+		a++;
+	}
+
+	/* cleanup on error */
+	if (a != attrs_num) {
+		RETVAL_FALSE;
+		goto cleanup;
+	}
+
+	docids = emalloc(sizeof(sphinx_int64_t) * values_num);
+	if (!mva) {
+		vals = safe_emalloc(values_num * attrs_num, sizeof(sphinx_int64_t), 0);
+	}
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(values));
+		 zend_hash_get_current_data(Z_ARRVAL_P(values), (void **) &item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(values))) {
+		char *str_id;
+		ulong id;
+		zval **attr_value;
+		int failed = 0, key_type;
+		uint str_id_len;
+		double float_id = 0;
+		unsigned char id_type;
+
+		if (Z_TYPE_PP(item) != IS_ARRAY) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "value is not an array of attributes");
+			break;
+		}
+
+		if (zend_hash_num_elements(Z_ARRVAL_PP(item)) != attrs_num) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "number of values is not equal to the number of attributes");
+			break;
+		}
+
+		key_type = zend_hash_get_current_key_ex(Z_ARRVAL_P(values), &str_id, &str_id_len, &id, 0, NULL);
+
+		if (key_type == HASH_KEY_IS_LONG) {
+			/* ok */
+			id_type = IS_LONG;
+		} else if (key_type == HASH_KEY_IS_STRING) {
+			id_type = is_numeric_string(str_id, str_id_len, (long *)&id, &float_id, 0);
+			if (id_type == IS_LONG || id_type == IS_DOUBLE) {
+				/* ok */
+			} else {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "document ID must be numeric");
+				break;
+			}
+		} else {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "document ID must be integer");
+			break;
+		}
+		
+		if (id_type == IS_LONG) {
+			docids[i] = (sphinx_uint64_t)id;
+		} else { /* IS_FLOAT */
+			docids[i] = (sphinx_uint64_t)float_id;
+		}
+		
+		a = 0;
+		for (zend_hash_internal_pointer_reset(Z_ARRVAL_PP(item));
+				zend_hash_get_current_data(Z_ARRVAL_PP(item), (void **) &attr_value) != FAILURE;
+				zend_hash_move_forward(Z_ARRVAL_PP(item))) {
+			if (mva) {
+#if LIBSPHINX_VERSION_ID >= 110
+				if (Z_TYPE_PP(attr_value) != IS_ARRAY) {
+					php_error_docref(NULL TSRMLS_CC, E_WARNING, "attribute value must be an array");
+					failed = 1;
+					break;
+				}
+				/* the count and the values of every attribute of every document in turn */
+				values_mva_num = zend_hash_num_elements(Z_ARRVAL_PP(attr_value));
+				if (mva_len + 1 + values_mva_num > mva_size) {
+					mva_size = (mva_len + 1 + values_mva_num) * 2;
+					vals_mva = safe_erealloc(vals_mva, mva_size, sizeof(unsigned int), 0);
+				}
+				vals_mva[mva_len] = values_mva_num;
+				
+				j = 0;
+				for (zend_hash_internal_pointer_reset(Z_ARRVAL_PP(attr_value));
+						zend_hash_get_current_data(Z_ARRVAL_PP(attr_value), (void **) &attr_value_mva) != FAILURE;
+						zend_hash_move_forward(Z_ARRVAL_PP(attr_value))) {
+					if (Z_TYPE_PP(attr_value_mva) != IS_LONG) {
+						php_error_docref(NULL TSRMLS_CC, E_WARNING, "mva attribute value must be integer");
+						failed = 1;
+						break;
+					}
+					vals_mva[mva_len + 1 + j] = (unsigned int)Z_LVAL_PP(attr_value_mva);
+					j++;
+				}
+				if (failed) {
+					break;
+				}
+				mva_len += 1 + values_mva_num;
+#endif
+				a++; 
+			} else {
+				if (Z_TYPE_PP(attr_value) != IS_LONG) {
+					php_error_docref(NULL TSRMLS_CC, E_WARNING, "attribute value must be integer");
+					failed = 1;
+					break;
+				}
+				vals[j] = (sphinx_int64_t)Z_LVAL_PP(attr_value);
+				j++;
+			}
+		}
+
+		if (failed) {
+#if LIBSPHINX_VERSION_ID >= 110
+			if (mva) {
+				/* the documents before the invalid one are sent, without its attributes read so far */
+				for (mva_len = 0, j = 0; j < i * attrs_num; j++) {
+					mva_len += 1 + vals_mva[mva_len];
+				}
+			}
+#endif
+			break;
+		}
+		i++;
+	}
+
+#if LIBSPHINX_VERSION_ID >= 110
+	if (mva && i) {
+		mva_data = vals_mva;
+		sent = php_sphinx_update_mva(c, index, attrs, attrs_num, docids, &mva_data, i, &updated TSRMLS_CC);
+		res = updated;
+
+		/* the library takes over from the first request that failed */
+		if (sent < i && !c->persistent) {
+			opened = sphinx_open(c->sphinx);
+		}
+		for (; sent < i && !lost; sent++) {
+			update_failed = 0;
+			for (a = 0; a < attrs_num; a++) {
+				values_mva_num = (int)*mva_data++;
+				if (!update_failed && sphinx_update_attributes_mva(c->sphinx, index, attrs[a], docids[sent], values_mva_num, mva_data) < 0) {
+					/* searchd refused the document, the rest of the batch goes on and the 
+					   document is reported. Without a connection there is no point going on. */
+					update_failed = 1;
+					lost = !php_sphinx_searchd_error(sphinx_error(c->sphinx));
+				}
+				mva_data += values_mva_num;
+			}
+
+			if (!update_failed) {
+				res++;
+				continue;
+			}
+			if (num_failed++ == 0) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to update document %.0f: %s", 
+						(double)docids[sent], sphinx_error(c->sphinx));
+			}
+			if (failed_ids) {
+#if SIZEOF_LONG == 8
+				add_next_index_long(failed_ids, (long)docids[sent]);
+#else
+				char buf[128];
+
+				slprintf(buf, sizeof(buf), "%.0f", (double)docids[sent]);
+				add_next_index_string(failed_ids, buf, 1);
+#endif
+			}
+		}
+	}
+
+	if (opened) {
+		sphinx_close(c->sphinx);
+	}
+	if (lost) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "connection lost after updating %d documents, the rest were not sent", res);
+		php_sphinx_cache_invalidate(index);
+		RETVAL_FALSE;
+		goto cleanup;
+	}
+	if (num_failed > 1) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to update %d documents", num_failed);
+	}
+#endif
+
+	if (!mva && i != values_num) {
+		RETVAL_FALSE;
+		goto cleanup;
+	}
+	
+	if (!mva) {
+		res = sphinx_update_attributes(c->sphinx, index, (int)attrs_num, attrs, values_num, docids, vals); 
+	}
+	/* even a failed MVA update may have changed some of the documents */
+	php_sphinx_cache_invalidate(index);
+
+	if (res < 0) {
+		RETVAL_FALSE;
+	} else {
+		RETVAL_LONG(res);
+	}
+
+cleanup:
+	efree(attrs);
+	if (docids) {
+		efree(docids);
+	}
+	if (vals) {
+		efree(vals);
+	}
+	if (vals_mva) {
+		efree(vals_mva);
+	}
+}
+/* }}} */
+
+/* {{{ bulk attribute updates
+ * Rows are taken from an iterator and sent in batches of about batch_size 
+ * bytes. With threads, up to "jobs" batches are in flight at once, each on 
+ * its own connection kept open for the whole call. Those connections are 
+ * opened for the call rather than taken from the persistent pool: the pool 
+ * only ever backs the client's own handle, and parking the job handles there 
+ * afterwards would leave "jobs" idle connections per worker after every call. */
+#define PHP_SPHINX_BULK_BATCH_SIZE (1024 * 1024)
+#define PHP_SPHINX_BULK_MAX_BATCH_SIZE (16 * 1024 * 1024)
+#define PHP_SPHINX_BULK_JOBS 4
+
+typedef struct _php_sphinx_bulk {
+	php_sphinx_client *c;
+	char *index;
+	const char **attrs;
+	int num_attrs;
+	int batch_docs; /* documents per batch */
+	sphinx_uint64_t *docids; /* the batch being filled */
+	sphinx_int64_t *values;
+	int num_docs;
+	long updated;
+	long failed; /* documents of the failed batches */
+	long batches;
+	double batch_time; /* total round trip time of the batches */
+	zend_bool warned;
+	const char *error; /* why the rows stopped being read, NULL if they all were */
+	int num_jobs; /* 0 to send the batches one by one on the client's handle */
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_job **jobs;
+	sphinx_client **handles;
+	double *started;
+#endif
+} php_sphinx_bulk;
+
+static void php_sphinx_bulk_alloc(php_sphinx_bulk *bulk) /* {{{ */
+{
+	bulk->docids = safe_pemalloc(bulk->batch_docs, sizeof(sphinx_uint64_t), 0, 1);
+	bulk->values = safe_pemalloc(bulk->batch_docs, bulk->num_attrs * sizeof(sphinx_int64_t), 0, 1);
+	bulk->num_docs = 0;
+}
+/* }}} */
+
+static void php_sphinx_bulk_done(php_sphinx_bulk *bulk, sphinx_client *sphinx, int res, int num_docs, double start TSRMLS_DC) /* {{{ */
+{
+	bulk->batches++;
+	bulk->batch_time += php_sphinx_time() - start;
+
+	if (res < 0) {
+		bulk->failed += num_docs;
+		if (!bulk->warned) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "failed to update a batch of %d documents: %s", num_docs, sphinx_error(sphinx));
+			bulk->warned = 1;
+		}
+	} else {
+		bulk->updated += res;
+	}
+}
+/* }}} */
+
+#ifdef HAVE_SPHINX_THREADS
+static void php_sphinx_bulk_collect(php_sphinx_bulk *bulk, int i TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_job *job = bulk->jobs[i];
+
+	php_sphinx_job_wait(job);
+	php_sphinx_bulk_done(bulk, job->sphinx, job->updated, job->num_docs, bulk->started[i] TSRMLS_CC);
+	php_sphinx_job_free(job);
+	bulk->jobs[i] = NULL;
+}
+/* }}} */
+#endif
+
+static void php_sphinx_bulk_flush(php_sphinx_bulk *bulk TSRMLS_DC) /* {{{ */
+{
+	double start;
+	int res;
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_job *job;
+	int i;
+#endif
+
+	if (!bulk->num_docs) {
+		return;
+	}
+
+#ifdef HAVE_SPHINX_THREADS
+	for (i = 0; i < bulk->num_jobs && bulk->jobs[i]; i++);
+	if (bulk->num_jobs && i == bulk->num_jobs) {
+		i = php_sphinx_job_any(bulk->jobs, bulk->num_jobs);
+		if (i < 0) {
+			i = 0;
+		}
+		php_sphinx_bulk_collect(bulk, i TSRMLS_CC);
+	}
+
+	if (bulk->num_jobs && !bulk->handles[i]) {
+		bulk->handles[i] = php_sphinx_client_handle_new(bulk->c, 0 TSRMLS_CC);
+#if LIBSPHINX_VERSION_ID >= 99
+		if (bulk->handles[i]) {
+			sphinx_open(bulk->handles[i]);
+		}
+#endif
+	}
+
+	if (bulk->num_jobs && bulk->handles[i]) {
+		job = php_sphinx_job_new(bulk->handles[i], php_sphinx_job_update);
+		php_sphinx_job_set_update(job, bulk->index, bulk->attrs, bulk->num_attrs, bulk->docids, bulk->values, bulk->num_docs);
+		bulk->jobs[i] = job;
+		bulk->started[i] = php_sphinx_time();
+		php_sphinx_job_start(job);
+		php_sphinx_bulk_alloc(bulk);
+		return;
+	}
+#endif
+
+	start = php_sphinx_time();
+	res = sphinx_update_attributes(bulk->c->sphinx, bulk->index, bulk->num_attrs, bulk->attrs, 
+			bulk->num_docs, bulk->docids, bulk->values);
+	php_sphinx_bulk_done(bulk, bulk->c->sphinx, res, bulk->num_docs, start TSRMLS_CC);
+	bulk->num_docs = 0;
+}
+/* }}} */
+
+static int php_sphinx_bulk_add(php_sphinx_bulk *bulk, sphinx_uint64_t id, zval *row TSRMLS_DC) /* {{{ */
+{
+	sphinx_int64_t *values;
+	zval **value;
+
+	if (Z_TYPE_P(row) != IS_ARRAY) {
+		bulk->error = "value is not an array of attributes";
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", bulk->error);
+		return FAILURE;
+	}
+
+	if (zend_hash_num_elements(Z_ARRVAL_P(row)) != bulk->num_attrs) {
+		bulk->error = "number of values is not equal to the number of attributes";
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", bulk->error);
+		return FAILURE;
+	}
+
+	values = bulk->values + bulk->num_docs * bulk->num_attrs;
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(row));
+			zend_hash_get_current_data(Z_ARRVAL_P(row), (void **) &value) != FAILURE;
+			zend_hash_move_forward(Z_ARRVAL_P(row))) {
+		if (Z_TYPE_PP(value) != IS_LONG) {
+			bulk->error = "attribute value must be integer";
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", bulk->error);
+			return FAILURE;
+		}
+		*values++ = (sphinx_int64_t)Z_LVAL_PP(value);
+	}
+
+	bulk->docids[bulk->num_docs++] = id;
+	if (bulk->num_docs == bulk->batch_docs) {
+		php_sphinx_bulk_flush(bulk TSRMLS_CC);
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+static int php_sphinx_bulk_key(zend_object_iterator *it, sphinx_uint64_t *id TSRMLS_DC) /* {{{ */
+{
+	long lval = 0;
+	double dval = 0;
+	int type = 0;
+#if PHP_VERSION_ID >= 50500
+	zval key;
+
+	if (!it->funcs->get_current_key) {
+		return FAILURE;
+	}
+	it->funcs->get_current_key(it, &key TSRMLS_CC);
+	if (Z_TYPE(key) == IS_LONG) {
+		type = IS_LONG;
+		lval = Z_LVAL(key);
+	} else if (Z_TYPE(key) == IS_DOUBLE) {
+		type = IS_DOUBLE;
+		dval = Z_DVAL(key);
+	} else if (Z_TYPE(key) == IS_STRING) {
+		type = is_numeric_string(Z_STRVAL(key), Z_STRLEN(key), &lval, &dval, 0);
+	}
+	zval_dtor(&key);
+#else
+	char *str_key = NULL;
+	uint str_key_len;
+	ulong int_key;
+
+	if (!it->funcs->get_current_key) {
+		return FAILURE;
+	}
+	switch (it->funcs->get_current_key(it, &str_key, &str_key_len, &int_key TSRMLS_CC)) {
+		case HASH_KEY_IS_LONG:
+			type = IS_LONG;
+			lval = (long)int_key;
+			break;
+		case HASH_KEY_IS_STRING:
+			type = is_numeric_string(str_key, str_key_len - 1, &lval, &dval, 0);
+			break;
+	}
+	if (str_key) {
+		efree(str_key);
+	}
+#endif
+
+	if (type == IS_LONG) {
+		*id = (sphinx_uint64_t)lval;
+	} else if (type == IS_DOUBLE) {
+		*id = (sphinx_uint64_t)dval;
+	} else {
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+/* }}} */
+/* }}} */
+
+static void php_sphinx_bulk_stats(php_sphinx_bulk *bulk, zval *stats, double start, int ok) /* {{{ */
+{
+	array_init(stats);
+	add_assoc_long_ex(stats, "updated", sizeof("updated"), bulk->updated);
+	add_assoc_long_ex(stats, "failed", sizeof("failed"), bulk->failed);
+	add_assoc_long_ex(stats, "batches", sizeof("batches"), bulk->batches);
+	add_assoc_double_ex(stats, "time", sizeof("time"), php_sphinx_time() - start);
+	add_assoc_double_ex(stats, "batch_time", sizeof("batch_time"), bulk->batch_time);
+	if (!ok && bulk->error) {
+		add_assoc_string_ex(stats, "error", sizeof("error"), (char *)bulk->error, 1);
+	}
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::bulkUpdateAttributes(string index, array attributes, Traversable values[, array options[, array &stats]]) 
+   an exception thrown by the iterator is passed on once the rows read before it are sent, 
+   stats is filled in either way */
+static PHP_METHOD(SphinxClient, bulkUpdateAttributes)
+{
+	php_sphinx_client *c;
+	php_sphinx_bulk bulk;
+	zend_object_iterator *it;
+	zval *attributes, *values, *opts_array = NULL, *stats = NULL, **item, **row;
+	char *index;
+	int index_len, a = 0, ok = 1;
+	long batch_size = PHP_SPHINX_BULK_BATCH_SIZE;
+	double start;
+	sphinx_uint64_t id;
+#if LIBSPHINX_VERSION_ID >= 99
+	int opened = 0;
+#endif
+#ifdef HAVE_SPHINX_THREADS
+	long num_jobs = PHP_SPHINX_BULK_JOBS;
+	int i;
+#endif
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "saO|a!z", &index, &index_len, &attributes, 
+				&values, zend_ce_traversable, &opts_array, &stats) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	php_sphinx_client_drop_job(c);
+
+	memset(&bulk, 0, sizeof(bulk));
+	bulk.c = c;
+	bulk.index = index;
+	bulk.num_attrs = zend_hash_num_elements(Z_ARRVAL_P(attributes));
+
+	if (!bulk.num_attrs) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty attributes array passed");
+		RETURN_FALSE;
+	}
+
+	if (opts_array) {
+		if (zend_hash_find(Z_ARRVAL_P(opts_array), "batch_size", sizeof("batch_size"), (void **)&item) == SUCCESS) {
+			SEPARATE_ZVAL(item);
+			convert_to_long_ex(item);
+			batch_size = Z_LVAL_PP(item);
+		}
+#ifdef HAVE_SPHINX_THREADS
+		if (zend_hash_find(Z_ARRVAL_P(opts_array), "jobs", sizeof("jobs"), (void **)&item) == SUCCESS) {
+			SEPARATE_ZVAL(item);
+			convert_to_long_ex(item);
+			num_jobs = Z_LVAL_PP(item);
+		}
+#endif
+	}
+
+	bulk.attrs = emalloc(sizeof(char *) * bulk.num_attrs);
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(attributes));
+		 zend_hash_get_current_data(Z_ARRVAL_P(attributes), (void **) &item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(attributes))) {
+		if (Z_TYPE_PP(item) != IS_STRING) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "non-string attributes are not allowed");
+			efree(bulk.attrs);
+			RETURN_FALSE;
+		}
+		bulk.attrs[a++] = Z_STRVAL_PP(item);
+	}
+
+	if (batch_size > PHP_SPHINX_BULK_MAX_BATCH_SIZE) {
+		batch_size = PHP_SPHINX_BULK_MAX_BATCH_SIZE;
+	}
+	/* a document takes its id and a 32-bit value per attribute in the request */
+	bulk.batch_docs = (int)(batch_size / (sizeof(sphinx_uint64_t) + bulk.num_attrs * sizeof(int)));
+	if (bulk.batch_docs < 1) {
+		bulk.batch_docs = 1;
+	}
+	php_sphinx_bulk_alloc(&bulk);
+
+#ifdef HAVE_SPHINX_THREADS
+	if (num_jobs > 1) {
+		bulk.num_jobs = (int)num_jobs;
+		bulk.jobs = safe_emalloc(bulk.num_jobs, sizeof(php_sphinx_job *), 0);
+		bulk.handles = safe_emalloc(bulk.num_jobs, sizeof(sphinx_client *), 0);
+		bulk.started = safe_emalloc(bulk.num_jobs, sizeof(double), 0);
+		for (i = 0; i < bulk.num_jobs; i++) {
+			bulk.jobs[i] = NULL;
+			bulk.handles[i] = NULL;
+		}
+	}
+#endif
+#if LIBSPHINX_VERSION_ID >= 99
+	if (!bulk.num_jobs && !c->persistent) {
+		opened = sphinx_open(c->sphinx);
+	}
+#endif
+
+	start = php_sphinx_time();
+
+	it = Z_OBJCE_P(values)->get_iterator(Z_OBJCE_P(values), values, 0 TSRMLS_CC);
+	if (it && !EG(exception)) {
+		if (it->funcs->rewind) {
+			it->funcs->rewind(it TSRMLS_CC);
+		}
+		while (ok && !EG(exception) && it->funcs->valid(it TSRMLS_CC) == SUCCESS) {
+			it->funcs->get_current_data(it, &row TSRMLS_CC);
+			if (EG(exception)) {
+				break;
+			}
+			if (php_sphinx_bulk_key(it, &id TSRMLS_CC) == FAILURE) {
+				if (!EG(exception)) {
+					bulk.error = "document ID must be numeric";
+					php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", bulk.error);
+				}
+				ok = 0;
+				break;
+			}
+			if (php_sphinx_bulk_add(&bulk, id, *row TSRMLS_CC) == FAILURE) {
+				ok = 0;
+				break;
+			}
+			it->funcs->move_forward(it TSRMLS_CC);
+		}
+	}
+	if (it) {
+		it->funcs->dtor(it TSRMLS_CC);
+	}
+
+	/* what has been read so far is sent even if the iteration failed */
+	php_sphinx_bulk_flush(&bulk TSRMLS_CC);
+
+#ifdef HAVE_SPHINX_THREADS
+	for (i = 0; i < bulk.num_jobs; i++) {
+		if (bulk.jobs[i]) {
+			php_sphinx_bulk_collect(&bulk, i TSRMLS_CC);
+		}
+		if (bulk.handles[i]) {
+#if LIBSPHINX_VERSION_ID >= 99
+			sphinx_close(bulk.handles[i]);
+#endif
+			sphinx_destroy(bulk.handles[i]);
+		}
+	}
+	if (bulk.jobs) {
+		efree(bulk.jobs);
+		efree(bulk.handles);
+		efree(bulk.started);
+	}
+#endif
+#if LIBSPHINX_VERSION_ID >= 99
+	if (opened) {
+		sphinx_close(c->sphinx);
+	}
+#endif
+	pefree(bulk.docids, 1);
+	pefree(bulk.values, 1);
+	efree(bulk.attrs);
+
+	if (bulk.batches) {
+		php_sphinx_cache_invalidate(index);
+	}
+
+	/* the rows read before an invalid one or an exception have been sent, the stats 
+	   say so together with what stopped the iteration */
+	if (stats) {
+		zval_dtor(stats);
+		php_sphinx_bulk_stats(&bulk, stats, start, ok);
+	}
+	if (EG(exception)) {
+		return;
+	}
+	php_sphinx_bulk_stats(&bulk, return_value, start, ok);
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::buildExcerpts(array docs, string index, string words[, array opts]) */
+static PHP_METHOD(SphinxClient, buildExcerpts)
+{
+	php_sphinx_client *c;
+	zval *docs_array, *opts_array = NULL, **item;
+	char *index, *words;
+	const char **docs;
+	sphinx_excerpt_options opts;
+	int index_len, words_len;
+	int docs_num, i = 0, chunk_size = 0, num_jobs = 1;
+	char **result;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ass|a", &docs_array, &index, &index_len, &words, &words_len, &opts_array) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	php_sphinx_client_drop_job(c);
+
+	docs_num = zend_hash_num_elements(Z_ARRVAL_P(docs_array));
+
+	if (!docs_num) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty documents array passed");
+		RETURN_FALSE;
+	}
+
+	docs = emalloc(sizeof(char *) * docs_num);
+	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(docs_array));
+		 zend_hash_get_current_data(Z_ARRVAL_P(docs_array), (void **) &item) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(docs_array))) {
+		if (Z_TYPE_PP(item) != IS_STRING) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "non-string documents are not allowed");
+			break;
+		}
+		docs[i] = Z_STRVAL_PP(item); /* no copying here! */
+		i++;
+	}
+
+	if (i != docs_num) {
+		RETVAL_FALSE;
+		goto cleanup;
+	}
+
+#define OPTS_EQUAL(str, str_len, txt) str_len == sizeof(txt) && memcmp(txt, str, sizeof(txt)) == 0 
+
+	if (opts_array) {
+		char *string_key;
+		unsigned int string_key_len;
+		ulong dummy;
+
+		/* nullify everything */
+		sphinx_init_excerpt_options(&opts);
+		for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(opts_array));
+				zend_hash_get_current_data(Z_ARRVAL_P(opts_array), (void **) &item) != FAILURE;
+				zend_hash_move_forward(Z_ARRVAL_P(opts_array))) {
+
+			switch (Z_TYPE_PP(item)) {
+				case IS_STRING:
+				case IS_LONG:
+				case IS_BOOL:
+					break;
+				default:
+					continue; /* ignore invalid options */
+			}
+
+			if (zend_hash_get_current_key_ex(Z_ARRVAL_P(opts_array), &string_key, &string_key_len, &dummy, 0, NULL) != HASH_KEY_IS_STRING) {
+				continue; /* ignore invalid option names */
+			}
+
+			if (OPTS_EQUAL(string_key, string_key_len, "before_match")) {
+				SEPARATE_ZVAL(item);
+				convert_to_string_ex(item);
+				opts.before_match = Z_STRVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "after_match")) {
+				SEPARATE_ZVAL(item);
+				convert_to_string_ex(item);
+				opts.after_match = Z_STRVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "chunk_separator")) {
+				SEPARATE_ZVAL(item);
+				convert_to_string_ex(item);
+				opts.chunk_separator = Z_STRVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "limit")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				opts.limit = (int)Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "around")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				opts.around = (int)Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "exact_phrase")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.exact_phrase = Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "single_passage")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.single_passage = Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "use_boundaries")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.use_boundaries = Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "weight_order")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.weight_order = Z_LVAL_PP(item);
+#if LIBSPHINX_VERSION_ID >= 110
+			} else if (OPTS_EQUAL(string_key, string_key_len, "query_mode")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.query_mode = Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "force_all_words")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.force_all_words = Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "limit_passages")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				opts.limit_passages = (int)Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "limit_words")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				opts.limit_words = (int)Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "start_passage_id")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				opts.start_passage_id = (int)Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "load_files")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.load_files = Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "html_strip_mode")) {
+				SEPARATE_ZVAL(item);
+				convert_to_string_ex(item);
+				opts.html_strip_mode = Z_STRVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "allow_empty")) {
+				SEPARATE_ZVAL(item);
+				convert_to_boolean_ex(item);
+				opts.allow_empty = Z_LVAL_PP(item);
+#endif
+			} else if (OPTS_EQUAL(string_key, string_key_len, "chunk_size")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				chunk_size = (int)Z_LVAL_PP(item);
+			} else if (OPTS_EQUAL(string_key, string_key_len, "jobs")) {
+				SEPARATE_ZVAL(item);
+				convert_to_long_ex(item);
+				num_jobs = (int)Z_LVAL_PP(item);
+			} else {
+				/* ignore invalid option names */
+			}
+		}
+	}
+
+	if (opts_array) {
+		result = php_sphinx_client_excerpts(c, docs_num, docs, index, words, &opts, chunk_size, num_jobs TSRMLS_CC); 
+	} else {
+		result = php_sphinx_client_excerpts(c, docs_num, docs, index, words, NULL, 0, 1 TSRMLS_CC); 
+	}
+
+	if (!result) {
+		RETVAL_FALSE;
+	} else {
+		array_init(return_value);
+		for (i = 0; i < docs_num; i++) {
+			if (result[i] && result[i][0] != '\0') {
+				add_next_index_string(return_value, result[i], 1);
+			} else {
+				add_next_index_string(return_value, "", 1);
+			}
+			free(result[i]);
+		}
+		free(result);
+	}
+
+cleanup:
+	efree(docs);
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::buildKeywords(string query, string index, bool hits) */
+static PHP_METHOD(SphinxClient, buildKeywords)
+{
+	php_sphinx_client *c;
+	char *query, *index;
+	int query_len, index_len;
+	zend_bool hits;
+	sphinx_keyword_info *result;
+	int i, num_keywords;
+	zval *tmp;
+	php_sphinx_op key = {0}, block = {0};
+	php_sphinx_cache_deps deps = {0}; /* the keywords do not depend on the indexed documents, their statistics do */
+	const char *p;
+	char *data;
+	size_t data_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ssb", &query, &query_len, &index, &index_len, &hits) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	php_sphinx_client_drop_job(c);
+
+	if (c->cache_ttl > 0 && (SPHINX_G(cache_size) > 0 || PHP_SPHINX_SHM_ENABLED())) {
+		smart_str_appendc(&key.buf, PHP_SPHINX_CACHE_KEYWORDS);
+		php_sphinx_cache_servers(c, &key.buf);
+		php_sphinx_op_put_string(&key, index);
+		php_sphinx_op_put_string(&key, query);
+		php_sphinx_op_put_long(&key, hits);
+		if (hits) {
+			/* taken before the request, an update meanwhile makes the entry stale */
+			php_sphinx_cache_deps_init(c, index, &deps);
+		}
+
+		data = php_sphinx_cache_get(key.buf.c, key.buf.len, 0, &data_len TSRMLS_CC);
+		if (data) {
+			smart_str_free(&key.buf);
+
+			p = data;
+			num_keywords = (int)php_sphinx_op_get_long(&p);
+			array_init_size(return_value, num_keywords);
+			for (i = 0; i < num_keywords; i++) {
+				MAKE_STD_ZVAL(tmp);
+				array_init(tmp);
+
+				add_assoc_string_ex(tmp, "tokenized", sizeof("tokenized"), (char *)php_sphinx_op_get_string(&p), 1);
+				add_assoc_string_ex(tmp, "normalized", sizeof("normalized"), (char *)php_sphinx_op_get_string(&p), 1);
+				if (hits) {
+					add_assoc_long_ex(tmp, "docs", sizeof("docs"), (long)php_sphinx_op_get_long(&p));
+					add_assoc_long_ex(tmp, "hits", sizeof("hits"), (long)php_sphinx_op_get_long(&p));
+				}
+				add_next_index_zval(return_value, tmp);
+			}
+			efree(data);
+			return;
+		}
+	}
+
+	result = sphinx_build_keywords(c->sphinx, query, index, hits, &num_keywords);
+	if (!result || num_keywords <= 0) {
+		if (key.buf.c) {
+			php_sphinx_cache_miss_failed(key.buf.c, key.buf.len);
+		}
+		smart_str_free(&key.buf);
+		RETURN_FALSE;
+	}
+
+	if (key.buf.c) {
+		php_sphinx_op_put_long(&block, num_keywords);
+	}
+
+	array_init(return_value);
+	for (i = 0; i < num_keywords; i++) {
+		MAKE_STD_ZVAL(tmp);
+		array_init(tmp);
+		
+		add_assoc_string_ex(tmp, "tokenized", sizeof("tokenized"), result[i].tokenized, 1);
+		add_assoc_string_ex(tmp, "normalized", sizeof("normalized"), result[i].normalized, 1);
+
+		if (hits) {
+			add_assoc_long_ex(tmp, "docs", sizeof("docs"), result[i].num_docs);
+			add_assoc_long_ex(tmp, "hits", sizeof("hits"), result[i].num_hits);
+		}
+
+		add_next_index_zval(return_value, tmp);
+
+		if (key.buf.c) {
+			php_sphinx_op_put_string(&block, result[i].tokenized);
+			php_sphinx_op_put_string(&block, result[i].normalized);
+			if (hits) {
+				php_sphinx_op_put_long(&block, result[i].num_docs);
+				php_sphinx_op_put_long(&block, result[i].num_hits);
+			}
+		}
+
+		free(result[i].tokenized);
+		free(result[i].normalized);
+	}
+	free(result);
+
+	if (key.buf.c) {
+		php_sphinx_cache_put(key.buf.c, key.buf.len, block.buf.c, block.buf.len, c->cache_ttl, &deps TSRMLS_CC);
+		smart_str_free(&block.buf);
+		smart_str_free(&key.buf);
+	}
+}
+/* }}} */
+
+/* {{{ proto void SphinxClient::resetFilters() */
+static PHP_METHOD(SphinxClient, resetFilters)
+{
+	php_sphinx_client *c;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	sphinx_reset_filters(c->sphinx);
+	php_sphinx_ops_add(c, php_sphinx_op_new(PHP_SPHINX_OP_RESET_FILTERS));
+}
+/* }}} */
+
+/* {{{ proto void SphinxClient::resetGroupBy() */
+static PHP_METHOD(SphinxClient, resetGroupBy)
+{
+	php_sphinx_client *c;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	sphinx_reset_groupby(c->sphinx);
+	php_sphinx_ops_add(c, php_sphinx_op_new(PHP_SPHINX_OP_RESET_GROUPBY));
+}
+/* }}} */
+
+/* {{{ proto string SphinxClient::getLastWarning() */
+static PHP_METHOD(SphinxClient, getLastWarning)
+{
+	php_sphinx_client *c;
+	const char *warning;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	warning = sphinx_warning(c->sphinx);
+	if (!warning || !warning[0]) {
+		RETURN_EMPTY_STRING();
+	}
+	RETURN_STRING((char *)warning, 1);
+}
+/* }}} */
+
+/* {{{ proto string SphinxClient::getLastError() */
+static PHP_METHOD(SphinxClient, getLastError)
+{
+	php_sphinx_client *c;
+	const char *error;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	error = sphinx_error(c->sphinx);
+	if (!error || !error[0]) {
+		RETURN_EMPTY_STRING();
+	}
+	RETURN_STRING((char *)error, 1);
+}
+/* }}} */
+
+/* returns the position of the query in the batch, negative on error */
+static int php_sphinx_client_add_query(php_sphinx_client *c, char *query, char *index, char *comment TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_op *op;
+	int res;
+
+	/* the query time limit is a part of the query */
+	php_sphinx_client_cap(c, c->sphinx, c->deadline > 0 ? (int)(c->deadline * 1000) : -1);
+	res = sphinx_add_query(c->sphinx, query, index, comment);
+	php_sphinx_client_uncap(c, c->sphinx);
+
+	if (res < 0) {
+		return res;
+	}
+
+	op = php_sphinx_op_new(PHP_SPHINX_OP_ADD_QUERY);
+	php_sphinx_op_put_string(op, query);
+	php_sphinx_op_put_string(op, index);
+	php_sphinx_op_put_string(op, comment);
+	php_sphinx_ops_add(c, op);
+	return res;
+}
+/* }}} */
+
+static int php_sphinx_client_defer(php_sphinx_client *c, char *query, char *index, char *comment, zval *return_value TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_result_obj *r;
+	zval *object;
+	int pos;
+
+	/* the deferred results are the whole batch, queries of addQuery() would be swallowed by it */
+	if (!c->num_deferred && (php_sphinx_ops_mask(c->ops) & PHP_SPHINX_OP_BIT(PHP_SPHINX_OP_ADD_QUERY))) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot defer the query, queries added by addQuery() have to be run first");
+		return FAILURE;
+	}
+
+	pos = php_sphinx_client_add_query(c, query, index, comment TSRMLS_CC);
+	if (pos < 0) {
+		return FAILURE;
+	}
+
+	MAKE_STD_ZVAL(object);
+	object_init_ex(object, ce_sphinx_result);
+	r = (php_sphinx_result_obj *)zend_object_store_get_object(object TSRMLS_CC);
+	r->client = c;
+	r->batch_pos = pos;
+
+	c->deferred = safe_erealloc(c->deferred, c->num_deferred + 1, sizeof(zval *), 0);
+	c->deferred[c->num_deferred++] = object;
+
+	RETVAL_ZVAL(object, 1, 0);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::query(string query[, string index[, string comment]]) */
+static PHP_METHOD(SphinxClient, query)
+{
+	php_sphinx_client *c;
+	char *query, *index = "*", *comment = "";
+	int query_len, index_len, comment_len;
+	sphinx_result *result;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|ss", &query, &query_len, &index, &index_len, &comment, &comment_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (c->auto_batch) {
+		if (php_sphinx_client_defer(c, query, index, comment, return_value TSRMLS_CC) == FAILURE) {
+			RETURN_FALSE;
+		}
+		return;
+	}
+
+	result = php_sphinx_client_search(c, query, index, comment TSRMLS_CC);
+	if (!result) {
+		RETURN_FALSE;
+	}
+
+	if (c->result_format == SPH_RESULT_LAZY) {
+		php_sphinx_result_object(c, result, return_value TSRMLS_CC);
+	} else {
+		php_sphinx_result_to_array(result, &return_value, c->array_result, c->result_format TSRMLS_CC);
+	}
+}
+
+/* }}} */
+
+/* {{{ proto int SphinxClient::addQuery(string query[, string index[, string comment]]) */
+static PHP_METHOD(SphinxClient, addQuery)
+{
+	php_sphinx_client *c;
+	char *query, *index = "*", *comment = "";
+	int query_len, index_len, comment_len, res;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|ss", &query, &query_len, &index, &index_len, &comment, &comment_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (c->num_deferred) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot add a query while deferred queries are pending, use their results first");
+		RETURN_FALSE;
+	}
+
+	res = php_sphinx_client_add_query(c, query, index, comment TSRMLS_CC);
+	if (res < 0) {
+		RETURN_FALSE;
+	}
+	RETURN_LONG(res);
+}
+
+/* }}} */
+
+/* {{{ proto array SphinxClient::runQueries() */
+static PHP_METHOD(SphinxClient, runQueries)
+{
+	php_sphinx_client *c;
+	sphinx_result *results;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	results = php_sphinx_client_search(c, NULL, NULL, NULL TSRMLS_CC);
+	if (!results) {
+		RETURN_FALSE;
+	}
+
+	php_sphinx_results_to_array(c, results, return_value TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto int SphinxClient::queryEach(string query, callable callback[, string index[, string comment]]) */
+static PHP_METHOD(SphinxClient, queryEach)
+{
+	php_sphinx_client *c;
+	char *query, *index = "*", *comment = "";
+	int query_len, index_len, comment_len, i;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	zval *match, *retval, **args[1];
+	sphinx_result *result;
+	php_sphinx_results_ref *ref;
+	uint *attr_lens;
+	ulong *attr_hashes;
+	zend_bool stop = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sf|ss", &query, &query_len, &fci, &fcc, &index, &index_len, &comment, &comment_len) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	result = php_sphinx_client_search(c, query, index, comment TSRMLS_CC);
+	if (!result || (result->status != SEARCHD_OK && result->status != SEARCHD_WARNING)) {
+		RETURN_FALSE;
+	}
+
+	fci.params = args;
+	fci.param_count = 1;
+	fci.retval_ptr_ptr = &retval;
+	fci.no_separation = 0;
+
+	/* only the current match exists as PHP value, it is released once the callback returns. 
+	   The callback may use the client, which must not free the result meanwhile. */
+	ref = php_sphinx_client_results_ref(c);
+	php_sphinx_attr_keys(result, &attr_lens, &attr_hashes);
+	for (i = 0; i < result->num_matches && !stop; i++) {
+		MAKE_STD_ZVAL(match);
+		php_sphinx_match_to_array(result, i, 1, attr_lens, attr_hashes, match);
+		args[0] = &match;
+
+		retval = NULL;
+		if (zend_call_function(&fci, &fcc TSRMLS_CC) == FAILURE || EG(exception)) {
+			stop = 1;
+		}
+		if (retval) {
+			/* returning false stops the iteration */
+			if (Z_TYPE_P(retval) == IS_BOOL && !Z_BVAL_P(retval)) {
+				stop = 1;
+			}
+			zval_ptr_dtor(&retval);
+		}
+		zval_ptr_dtor(&match);
+	}
+	efree(attr_lens);
+	efree(attr_hashes);
+	php_sphinx_results_ref_release(ref);
+
+	RETURN_LONG(i);
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::queryIds(string query[, string index[, string comment[, bool weights]]]) */
+static PHP_METHOD(SphinxClient, queryIds)
+{
+	php_sphinx_client *c;
+	char *query, *index = "*", *comment = "";
+	int query_len, index_len, comment_len;
+	zend_bool weights = 0;
+	sphinx_result *result;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|ssb", &query, &query_len, &index, &index_len, &comment, &comment_len, &weights) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	result = php_sphinx_client_search(c, query, index, comment TSRMLS_CC);
+	if (!result) {
 		RETURN_FALSE;
 	}
 
-	attrs = emalloc(sizeof(char *) * attrs_num);
-	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(attributes));
-		 zend_hash_get_current_data(Z_ARRVAL_P(attributes), (void **) &item) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(attributes))) {
-		if (Z_TYPE_PP(item) != IS_STRING) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "non-string attributes are not allowed");
-			break;
+	php_sphinx_result_to_ids(result, weights, return_value);
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::runQueriesIds([bool weights]) */
+static PHP_METHOD(SphinxClient, runQueriesIds)
+{
+	php_sphinx_client *c;
+	sphinx_result *results;
+	zend_bool weights = 0;
+	zval *ids;
+	int i, num_results;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|b", &weights) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	results = php_sphinx_client_search(c, NULL, NULL, NULL TSRMLS_CC);
+	if (!results) {
+		RETURN_FALSE;
+	}
+
+	num_results = php_sphinx_client_num_results(c);
+
+	array_init_size(return_value, num_results);
+	for (i = 0; i < num_results; i++) {
+		MAKE_STD_ZVAL(ids);
+		php_sphinx_result_to_ids(&results[i], weights, ids);
+		add_next_index_zval(return_value, ids);
+	}
+}
+/* }}} */
+
+#ifdef HAVE_SPHINX_THREADS
+static int php_sphinx_client_send(php_sphinx_client *c TSRMLS_DC) /* {{{ */
+{
+	if (c->num_deferred) {
+		/* the results of the deferred queries cannot wait for fetchResults() */
+		php_sphinx_client_search(c, NULL, NULL, NULL TSRMLS_CC);
+		if (!c->sphinx) {
+			return FAILURE;
 		}
-		attrs[a] = Z_STRVAL_PP(item); /* no copying here! */
-		a++;
 	}
 
-	/* cleanup on error */
-	if (a != attrs_num) {
-		RETVAL_FALSE;
-		goto cleanup;
+	php_sphinx_client_drop_job(c);
+	if (php_sphinx_client_detach_results(c, 1 TSRMLS_CC) == FAILURE) {
+		return FAILURE;
 	}
 
-	docids = emalloc(sizeof(sphinx_int64_t) * values_num);
-	if (!mva) {
-		vals = safe_emalloc(values_num * attrs_num, sizeof(sphinx_int64_t), 0);
+	c->job = php_sphinx_job_new(c->sphinx, php_sphinx_job_run_queries);
+	php_sphinx_job_start(c->job);
+	php_sphinx_ops_queries_done(c);
+	return SUCCESS;
+}
+/* }}} */
+
+static void php_sphinx_client_fetch(php_sphinx_client *c, zval *array TSRMLS_DC) /* {{{ */
+{
+	sphinx_result *results;
+
+	php_sphinx_client_wait(c);
+	results = c->job->results;
+	php_sphinx_client_drop_job(c);
+
+	if (!results) {
+		c->failed = c->persistent;
+		ZVAL_FALSE(array);
+		return;
+	}
+
+	php_sphinx_results_to_array(c, results, array TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::sendQueries() */
+static PHP_METHOD(SphinxClient, sendQueries)
+{
+	php_sphinx_client *c;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (php_sphinx_client_send(c TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::isReady() */
+static PHP_METHOD(SphinxClient, isReady)
+{
+	php_sphinx_client *c;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+
+	if (!c || !c->sphinx) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "using uninitialized SphinxClient object");
+		RETURN_FALSE;
+	}
+
+	if (!c->job) {
+		/* nothing is running */
+		RETURN_TRUE;
+	}
+	RETURN_BOOL(php_sphinx_job_ready(c->job, 0));
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::fetchResults() */
+static PHP_METHOD(SphinxClient, fetchResults)
+{
+	php_sphinx_client *c;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (!c->job) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "no queries have been sent, issue sendQueries() first");
+		RETURN_FALSE;
+	}
+
+	php_sphinx_client_fetch(c, return_value TSRMLS_CC);
+}
+/* }}} */
+#endif
+
+/* {{{ proto string SphinxClient::escapeString(string data) */
+static PHP_METHOD(SphinxClient, escapeString)
+{
+	char *str, *new_str, *source, *target;
+	int str_len, new_str_len, i;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &str, &str_len) == FAILURE) {
+		return;
+	}
+	
+	if (!str_len) {
+		RETURN_EMPTY_STRING();
+	}
+
+	new_str = safe_emalloc(2, str_len, 1);
+	target = new_str;
+	source = str;
+	for (i = 0; i < str_len; i++) {
+		switch (*source) {
+			case '(':
+			case ')':
+			case '|':
+			case '-':
+			case '!':
+			case '@':
+			case '~':
+			case '"':
+			case '&':
+			case '/':
+			case '\\':
+			case '^':
+			case '$':
+			case '=':
+			case '<':
+				*target++ = '\\';
+				*target++ = *source;
+				break;
+			default:
+				*target++ = *source;
+				break;
+		}
+		source++;
+	}
+	*target = '\0';
+
+	new_str_len = target - new_str;
+	new_str = erealloc(new_str, new_str_len + 1);
+	RETURN_STRINGL(new_str, new_str_len, 0);
+}
+/* }}} */
+
+#if LIBSPHINX_VERSION_ID >= 99
+/* {{{ proto bool SphinxClient::open([bool persistent]) */
+static PHP_METHOD(SphinxClient, open)
+{
+	php_sphinx_client *c;
+	zend_bool persistent = 0;
+	int res;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|b", &persistent) == FAILURE) {
+		return;
+	}
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+
+	if (persistent) {
+		if (c->persistent) {
+			/* already connected */
+			RETURN_TRUE;
+		}
+		if (php_sphinx_client_detach_results(c, 1 TSRMLS_CC) == FAILURE) {
+			RETURN_FALSE;
+		}
+		if (php_sphinx_pool_acquire(c TSRMLS_CC) == SUCCESS) {
+			c->persistent = 1;
+			c->failed = 0;
+			RETURN_TRUE;
+		}
+	}
+	
+	res = sphinx_open(c->sphinx);
+	if (!res) {
+		RETURN_FALSE;
+	}
+	c->persistent = persistent;
+	c->failed = 0;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::close() */
+static PHP_METHOD(SphinxClient, close)
+{
+	php_sphinx_client *c;
+	int res;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	
+	res = sphinx_close(c->sphinx);
+	c->persistent = 0;
+	if (!res) {
+		RETURN_FALSE;
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto array SphinxClient::status() */
+static PHP_METHOD(SphinxClient, status)
+{
+	php_sphinx_client *c;
+	char **result;
+	int i, j, k, num_rows, num_cols;
+	zval *tmp;
+
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	php_sphinx_client_drop_job(c);
+	
+	result = sphinx_status(c->sphinx, &num_rows, &num_cols);
+	
+	if (!result || num_rows <= 0) {
+		RETURN_FALSE;
+	}
+	
+	k = 0;
+	array_init(return_value);
+	for (i = 0; i < num_rows; i++) {
+		MAKE_STD_ZVAL(tmp);
+		array_init(tmp);
+		
+		for (j = 0; j < num_cols; j++, k++) {
+			add_next_index_string(tmp, result[k], 1);
+		}
+		add_next_index_zval(return_value, tmp);
+	}
+	sphinx_status_destroy(result, num_rows, num_cols);
+}
+/* }}} */
+
+/* {{{ proto bool SphinxClient::setOverride(string attribute, int type, array values) */
+static PHP_METHOD(SphinxClient, setOverride)
+{
+	php_sphinx_client *c;
+	zval *values, **attr_value;
+	char *attribute;
+	long type;
+	int attribute_len, values_num, i = 0;
+	php_sphinx_op *op;
+	sphinx_uint64_t *docids = NULL; 
+	unsigned int *vals = NULL;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sla", &attribute, &attribute_len, &type, &values) == FAILURE) {
+		return;
+	}
+	
+	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
+	SPHINX_INITIALIZED(c)
+	
+	if (type != SPH_ATTR_INTEGER && type != SPH_ATTR_TIMESTAMP
+		&& type != SPH_ATTR_BOOL && type != SPH_ATTR_FLOAT) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "type must be scalar");
+		RETURN_FALSE;
+	}
+	
+	values_num = zend_hash_num_elements(Z_ARRVAL_P(values));
+	if (!values_num) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty values array passed");
+		RETURN_FALSE;
 	}
+	
+	docids = emalloc(sizeof(sphinx_uint64_t) * values_num);
+	vals = safe_emalloc(values_num, sizeof(unsigned int), 0);
 	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(values));
-		 zend_hash_get_current_data(Z_ARRVAL_P(values), (void **) &item) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(values))) {
+		 zend_hash_get_current_data(Z_ARRVAL_P(values), (void **) &attr_value) != FAILURE;
+		 zend_hash_move_forward(Z_ARRVAL_P(values))) 
+	{
 		char *str_id;
 		ulong id;
-		zval **attr_value;
-		int failed = 0, key_type;
+		int key_type;
 		uint str_id_len;
 		double float_id = 0;
 		unsigned char id_type;
 
-		if (Z_TYPE_PP(item) != IS_ARRAY) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "value is not an array of attributes");
-			break;
-		}
-
-		if (zend_hash_num_elements(Z_ARRVAL_PP(item)) != attrs_num) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "number of values is not equal to the number of attributes");
+		if (Z_TYPE_PP(attr_value) != IS_LONG) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "attribute value must be integer");
 			break;
 		}
 
@@ -1092,689 +7546,566 @@ static PHP_METHOD(SphinxClient, updateAttributes)
 			php_error_docref(NULL TSRMLS_CC, E_WARNING, "document ID must be integer");
 			break;
 		}
-		
+		vals[i] = (sphinx_uint64_t)Z_LVAL_PP(attr_value);
+
 		if (id_type == IS_LONG) {
 			docids[i] = (sphinx_uint64_t)id;
 		} else { /* IS_FLOAT */
 			docids[i] = (sphinx_uint64_t)float_id;
 		}
-		
-		a = 0;
-		for (zend_hash_internal_pointer_reset(Z_ARRVAL_PP(item));
-				zend_hash_get_current_data(Z_ARRVAL_PP(item), (void **) &attr_value) != FAILURE;
-				zend_hash_move_forward(Z_ARRVAL_PP(item))) {
-			if (mva) {
-#if LIBSPHINX_VERSION_ID >= 110
-				if (Z_TYPE_PP(attr_value) != IS_ARRAY) {
-					php_error_docref(NULL TSRMLS_CC, E_WARNING, "attribute value must be an array");
-					failed = 1;
-					break;
-				}
-				values_mva_num = zend_hash_num_elements(Z_ARRVAL_PP(attr_value));
-				if (values_mva_num > values_mva_size) {
-					values_mva_size = values_mva_num;
-					vals_mva = safe_erealloc(vals_mva, values_mva_size, sizeof(unsigned int), 0);
-				}
-				if (vals_mva) {
-					memset(vals_mva, 0, values_mva_size * sizeof(unsigned int));
-				}
-				
-				j = 0;
-				for (zend_hash_internal_pointer_reset(Z_ARRVAL_PP(attr_value));
-						zend_hash_get_current_data(Z_ARRVAL_PP(attr_value), (void **) &attr_value_mva) != FAILURE;
-						zend_hash_move_forward(Z_ARRVAL_PP(attr_value))) {
-					if (Z_TYPE_PP(attr_value_mva) != IS_LONG) {
-						php_error_docref(NULL TSRMLS_CC, E_WARNING, "mva attribute value must be integer");
-						failed = 1;
-						break;
-					}
-					vals_mva[j] = (unsigned int)Z_LVAL_PP(attr_value_mva);
-					j++;
-				}
-				if (failed) {
-					break;
-				}
-
-				res_mva = sphinx_update_attributes_mva(c->sphinx, index, attrs[a], docids[i], values_mva_num, vals_mva);
-
-				if (res_mva < 0) {
-					failed = 1;
-					break;
-				}
-#endif
-				a++; 
-			} else {
-				if (Z_TYPE_PP(attr_value) != IS_LONG) {
-					php_error_docref(NULL TSRMLS_CC, E_WARNING, "attribute value must be integer");
-					failed = 1;
-					break;
-				}
-				vals[j] = (sphinx_int64_t)Z_LVAL_PP(attr_value);
-				j++;
-			}
-		}
-
-		if (failed) {
-			break;
-		}
-		
-		if (mva) {
-			res++;
-		}
 		i++;
 	}
 
-	if (!mva && i != values_num) {
+	if (i != values_num) {
 		RETVAL_FALSE;
 		goto cleanup;
 	}
 	
-	if (!mva) {
-		res = sphinx_update_attributes(c->sphinx, index, (int)attrs_num, attrs, values_num, docids, vals); 
-	}
-
-	if (res < 0) {
+	op = php_sphinx_op_new(PHP_SPHINX_OP_OVERRIDE);
+	php_sphinx_op_put_string(op, attribute);
+	php_sphinx_op_put_long(op, values_num);
+	php_sphinx_op_put_data(op, docids, values_num * sizeof(sphinx_uint64_t));
+	php_sphinx_op_put_data(op, vals, values_num * sizeof(unsigned int));
+	if (!php_sphinx_client_apply(c, op)) {
 		RETVAL_FALSE;
 	} else {
-		RETVAL_LONG(res);
+		RETVAL_TRUE;
 	}
 
 cleanup:
-	efree(attrs);
 	if (docids) {
 		efree(docids);
 	}
 	if (vals) {
 		efree(vals);
 	}
-	if (vals_mva) {
-		efree(vals_mva);
-	}
 }
 /* }}} */
-
-/* {{{ proto array SphinxClient::buildExcerpts(array docs, string index, string words[, array opts]) */
-static PHP_METHOD(SphinxClient, buildExcerpts)
-{
-	php_sphinx_client *c;
-	zval *docs_array, *opts_array = NULL, **item;
-	char *index, *words;
-	const char **docs;
-	sphinx_excerpt_options opts;
-	int index_len, words_len;
-	int docs_num, i = 0;
-	char **result;
-
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ass|a", &docs_array, &index, &index_len, &words, &words_len, &opts_array) == FAILURE) {
-		return;
-	}
-
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	docs_num = zend_hash_num_elements(Z_ARRVAL_P(docs_array));
-
-	if (!docs_num) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty documents array passed");
-		RETURN_FALSE;
-	}
-
-	docs = emalloc(sizeof(char *) * docs_num);
-	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(docs_array));
-		 zend_hash_get_current_data(Z_ARRVAL_P(docs_array), (void **) &item) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(docs_array))) {
-		if (Z_TYPE_PP(item) != IS_STRING) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "non-string documents are not allowed");
-			break;
-		}
-		docs[i] = Z_STRVAL_PP(item); /* no copying here! */
-		i++;
-	}
-
-	if (i != docs_num) {
-		RETVAL_FALSE;
-		goto cleanup;
-	}
-
-#define OPTS_EQUAL(str, str_len, txt) str_len == sizeof(txt) && memcmp(txt, str, sizeof(txt)) == 0 
-
-	if (opts_array) {
-		char *string_key;
-		unsigned int string_key_len;
-		ulong dummy;
-
-		/* nullify everything */
-		sphinx_init_excerpt_options(&opts);
-		for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(opts_array));
-				zend_hash_get_current_data(Z_ARRVAL_P(opts_array), (void **) &item) != FAILURE;
-				zend_hash_move_forward(Z_ARRVAL_P(opts_array))) {
-
-			switch (Z_TYPE_PP(item)) {
-				case IS_STRING:
-				case IS_LONG:
-				case IS_BOOL:
-					break;
-				default:
-					continue; /* ignore invalid options */
-			}
-
-			if (zend_hash_get_current_key_ex(Z_ARRVAL_P(opts_array), &string_key, &string_key_len, &dummy, 0, NULL) != HASH_KEY_IS_STRING) {
-				continue; /* ignore invalid option names */
-			}
-
-			if (OPTS_EQUAL(string_key, string_key_len, "before_match")) {
-				SEPARATE_ZVAL(item);
-				convert_to_string_ex(item);
-				opts.before_match = Z_STRVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "after_match")) {
-				SEPARATE_ZVAL(item);
-				convert_to_string_ex(item);
-				opts.after_match = Z_STRVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "chunk_separator")) {
-				SEPARATE_ZVAL(item);
-				convert_to_string_ex(item);
-				opts.chunk_separator = Z_STRVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "limit")) {
-				SEPARATE_ZVAL(item);
-				convert_to_long_ex(item);
-				opts.limit = (int)Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "around")) {
-				SEPARATE_ZVAL(item);
-				convert_to_long_ex(item);
-				opts.around = (int)Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "exact_phrase")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.exact_phrase = Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "single_passage")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.single_passage = Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "use_boundaries")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.use_boundaries = Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "weight_order")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.weight_order = Z_LVAL_PP(item);
-#if LIBSPHINX_VERSION_ID >= 110
-			} else if (OPTS_EQUAL(string_key, string_key_len, "query_mode")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.query_mode = Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "force_all_words")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.force_all_words = Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "limit_passages")) {
-				SEPARATE_ZVAL(item);
-				convert_to_long_ex(item);
-				opts.limit_passages = (int)Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "limit_words")) {
-				SEPARATE_ZVAL(item);
-				convert_to_long_ex(item);
-				opts.limit_words = (int)Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "start_passage_id")) {
-				SEPARATE_ZVAL(item);
-				convert_to_long_ex(item);
-				opts.start_passage_id = (int)Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "load_files")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.load_files = Z_LVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "html_strip_mode")) {
-				SEPARATE_ZVAL(item);
-				convert_to_string_ex(item);
-				opts.html_strip_mode = Z_STRVAL_PP(item);
-			} else if (OPTS_EQUAL(string_key, string_key_len, "allow_empty")) {
-				SEPARATE_ZVAL(item);
-				convert_to_boolean_ex(item);
-				opts.allow_empty = Z_LVAL_PP(item);
 #endif
-			} else {
-				/* ignore invalid option names */
-			}
-		}
-	}
-
-	if (opts_array) {
-		result = sphinx_build_excerpts(c->sphinx, docs_num, docs, index, words, &opts); 
-	} else {
-		result = sphinx_build_excerpts(c->sphinx, docs_num, docs, index, words, NULL); 
-	}
-
-	if (!result) {
-		RETVAL_FALSE;
-	} else {
-		array_init(return_value);
-		for (i = 0; i < docs_num; i++) {
-			if (result[i] && result[i][0] != '\0') {
-				add_next_index_string(return_value, result[i], 1);
-			} else {
-				add_next_index_string(return_value, "", 1);
-			}
-			free(result[i]);
-		}
-		free(result);
-	}
 
-cleanup:
-	efree(docs);
+/* {{{ proto int SphinxClient::__sleep() */
+static PHP_METHOD(SphinxClient, __sleep)
+{
+	php_error_docref(NULL TSRMLS_CC, E_RECOVERABLE_ERROR, "SphinxClient instance cannot be (un)serialized");
 }
 /* }}} */
 
-/* {{{ proto array SphinxClient::buildKeywords(string query, string index, bool hits) */
-static PHP_METHOD(SphinxClient, buildKeywords)
+/* {{{ proto int SphinxClient::__wakeup() */
+static PHP_METHOD(SphinxClient, __wakeup)
 {
-	php_sphinx_client *c;
-	char *query, *index;
-	int query_len, index_len;
-	zend_bool hits;
-	sphinx_keyword_info *result;
-	int i, num_keywords;
-	zval *tmp;
+	php_error_docref(NULL TSRMLS_CC, E_RECOVERABLE_ERROR, "SphinxClient instance cannot be (un)serialized");
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ssb", &query, &query_len, &index, &index_len, &hits) == FAILURE) {
-		return;
-	}
+#ifdef HAVE_SPHINX_THREADS
+/* {{{ SphinxMulti */
+enum {
+	PHP_SPHINX_MULTI_IDLE = 0,
+	PHP_SPHINX_MULTI_SENT,
+	PHP_SPHINX_MULTI_DONE
+};
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+typedef struct _php_sphinx_multi {
+	zend_object std;
+	zval **clients;
+	char *state;
+	int num_clients;
+} php_sphinx_multi;
 
-	result = sphinx_build_keywords(c->sphinx, query, index, hits, &num_keywords);
-	if (!result || num_keywords <= 0) {
-		RETURN_FALSE;
-	}
+static void php_sphinx_multi_obj_dtor(void *object TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_multi *m = (php_sphinx_multi *)object;
+	int i;
 
-	array_init(return_value);
-	for (i = 0; i < num_keywords; i++) {
-		MAKE_STD_ZVAL(tmp);
-		array_init(tmp);
-		
-		add_assoc_string_ex(tmp, "tokenized", sizeof("tokenized"), result[i].tokenized, 1);
-		add_assoc_string_ex(tmp, "normalized", sizeof("normalized"), result[i].normalized, 1);
+	for (i = 0; i < m->num_clients; i++) {
+		zval_ptr_dtor(&m->clients[i]);
+	}
+	if (m->clients) {
+		efree(m->clients);
+		efree(m->state);
+	}
+	zend_object_std_dtor(&m->std TSRMLS_CC);
+	efree(m);
+}
+/* }}} */
 
-		if (hits) {
-			add_assoc_long_ex(tmp, "docs", sizeof("docs"), result[i].num_docs);
-			add_assoc_long_ex(tmp, "hits", sizeof("hits"), result[i].num_hits);
-		}
+static zend_object_value php_sphinx_multi_new(zend_class_entry *ce TSRMLS_DC) /* {{{ */
+{
+	php_sphinx_multi *m;
+	zend_object_value retval;
+#if PHP_VERSION_ID < 50399
+	zval *tmp;
+#endif
 
-		add_next_index_zval(return_value, tmp);
+	m = ecalloc(1, sizeof(*m));
+	zend_object_std_init(&m->std, ce TSRMLS_CC);
 
-		free(result[i].tokenized);
-		free(result[i].normalized);
-	}
-	free(result);
+#if PHP_VERSION_ID < 50399
+	ALLOC_HASHTABLE(m->std.properties);
+	zend_hash_init(m->std.properties, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(m->std.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, (void *) &tmp, sizeof(zval *));
+#else
+	object_properties_init(&m->std, ce);
+#endif
+	retval.handle = zend_objects_store_put(m, (zend_objects_store_dtor_t)zend_objects_destroy_object, php_sphinx_multi_obj_dtor, NULL TSRMLS_CC);
+	retval.handlers = &cannot_be_cloned;
+	return retval;
 }
 /* }}} */
 
-/* {{{ proto void SphinxClient::resetFilters() */
-static PHP_METHOD(SphinxClient, resetFilters)
+static void php_sphinx_multi_fetch(php_sphinx_multi *m, int i, zval *results TSRMLS_DC) /* {{{ */
 {
 	php_sphinx_client *c;
+	zval *result;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	c = (php_sphinx_client *)zend_object_store_get_object(m->clients[i] TSRMLS_CC);
 
-	sphinx_reset_filters(c->sphinx);
+	MAKE_STD_ZVAL(result);
+	if (c->job) {
+		php_sphinx_client_fetch(c, result TSRMLS_CC);
+	} else {
+		/* the batch has been dropped by another request */
+		ZVAL_FALSE(result);
+	}
+	add_index_zval(results, i, result);
+	m->state[i] = PHP_SPHINX_MULTI_DONE;
 }
 /* }}} */
 
-/* {{{ proto void SphinxClient::resetGroupBy() */
-static PHP_METHOD(SphinxClient, resetGroupBy)
+static int php_sphinx_multi_num_sent(php_sphinx_multi *m) /* {{{ */
 {
-	php_sphinx_client *c;
-
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	int i, num = 0;
 
-	sphinx_reset_groupby(c->sphinx);
+	for (i = 0; i < m->num_clients; i++) {
+		if (m->state[i] == PHP_SPHINX_MULTI_SENT) {
+			num++;
+		}
+	}
+	return num;
 }
 /* }}} */
 
-/* {{{ proto string SphinxClient::getLastWarning() */
-static PHP_METHOD(SphinxClient, getLastWarning)
+/* waits up to timeout milliseconds for the sent batches and adds the finished ones to results */
+static void php_sphinx_multi_poll(php_sphinx_multi *m, int timeout, zval *results TSRMLS_DC) /* {{{ */
 {
 	php_sphinx_client *c;
-	const char *warning;
+	struct pollfd *pfds;
+	int *sent, i, num = 0, res;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	pfds = safe_emalloc(m->num_clients, sizeof(struct pollfd), 0);
+	sent = safe_emalloc(m->num_clients, sizeof(int), 0);
 
-	warning = sphinx_warning(c->sphinx);
-	if (!warning || !warning[0]) {
-		RETURN_EMPTY_STRING();
+	for (i = 0; i < m->num_clients; i++) {
+		if (m->state[i] != PHP_SPHINX_MULTI_SENT) {
+			continue;
+		}
+
+		c = (php_sphinx_client *)zend_object_store_get_object(m->clients[i] TSRMLS_CC);
+		if (!c->job || c->job->joined || c->job->fds[0] < 0) {
+			/* finished already, don't wait for the others */
+			php_sphinx_multi_fetch(m, i, results TSRMLS_CC);
+			timeout = 0;
+			continue;
+		}
+
+		pfds[num].fd = c->job->fds[0];
+		pfds[num].events = POLLIN;
+		pfds[num].revents = 0;
+		sent[num] = i;
+		num++;
 	}
-	RETURN_STRING((char *)warning, 1);
+
+	if (num) {
+		do {
+			res = poll(pfds, num, timeout);
+		} while (res < 0 && errno == EINTR);
+
+		for (i = 0; res > 0 && i < num; i++) {
+			if (pfds[i].revents) {
+				php_sphinx_multi_fetch(m, sent[i], results TSRMLS_CC);
+			}
+		}
+	}
+
+	efree(pfds);
+	efree(sent);
 }
 /* }}} */
 
-/* {{{ proto string SphinxClient::getLastError() */
-static PHP_METHOD(SphinxClient, getLastError)
+static void php_sphinx_multi_send(php_sphinx_multi *m TSRMLS_DC) /* {{{ */
 {
 	php_sphinx_client *c;
-	const char *error;
+	int i;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	for (i = 0; i < m->num_clients; i++) {
+		if (m->state[i] == PHP_SPHINX_MULTI_SENT) {
+			continue;
+		}
 
-	error = sphinx_error(c->sphinx);
-	if (!error || !error[0]) {
-		RETURN_EMPTY_STRING();
+		c = (php_sphinx_client *)zend_object_store_get_object(m->clients[i] TSRMLS_CC);
+		if (!c->sphinx) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "using uninitialized SphinxClient object");
+			continue;
+		}
+
+		php_sphinx_client_wait(c);
+		if (php_sphinx_client_send(c TSRMLS_CC) == SUCCESS) {
+			m->state[i] = PHP_SPHINX_MULTI_SENT;
+		}
 	}
-	RETURN_STRING((char *)error, 1);
 }
 /* }}} */
 
-/* {{{ proto array SphinxClient::query(string query[, string index[, string comment]]) */
-static PHP_METHOD(SphinxClient, query)
+/* {{{ proto int SphinxMulti::add(SphinxClient client) */
+static PHP_METHOD(SphinxMulti, add)
 {
-	php_sphinx_client *c;
-	char *query, *index = "*", *comment = "";
-	int query_len, index_len, comment_len;
-	sphinx_result *result;
+	php_sphinx_multi *m;
+	zval *client;
+	int i;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|ss", &query, &query_len, &index, &index_len, &comment, &comment_len) == FAILURE) {
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &client, ce_sphinx_client) == FAILURE) {
 		return;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	result = sphinx_query(c->sphinx, query, index, comment);
+	m = (php_sphinx_multi *)zend_object_store_get_object(getThis() TSRMLS_CC);
 
-	if (!result) {
-		RETURN_FALSE;
+	for (i = 0; i < m->num_clients; i++) {
+		if (Z_OBJ_HANDLE_P(m->clients[i]) == Z_OBJ_HANDLE_P(client)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "the client has been added already");
+			RETURN_FALSE;
+		}
 	}
 
-	php_sphinx_result_to_array(c, result, &return_value TSRMLS_CC);
+	m->clients = safe_erealloc(m->clients, m->num_clients + 1, sizeof(zval *), 0);
+	m->state = safe_erealloc(m->state, m->num_clients + 1, sizeof(char), 0);
+
+	Z_ADDREF_P(client);
+	m->clients[m->num_clients] = client;
+	m->state[m->num_clients] = PHP_SPHINX_MULTI_IDLE;
+	RETURN_LONG(m->num_clients++);
 }
+/* }}} */
+
+/* {{{ proto bool SphinxMulti::send() */
+static PHP_METHOD(SphinxMulti, send)
+{
+	php_sphinx_multi *m;
+
+	m = (php_sphinx_multi *)zend_object_store_get_object(getThis() TSRMLS_CC);
 
+	php_sphinx_multi_send(m TSRMLS_CC);
+	RETURN_TRUE;
+}
 /* }}} */
 
-/* {{{ proto int SphinxClient::addQuery(string query[, string index[, string comment]]) */
-static PHP_METHOD(SphinxClient, addQuery)
+/* {{{ proto array SphinxMulti::select([float timeout]) */
+static PHP_METHOD(SphinxMulti, select)
 {
-	php_sphinx_client *c;
-	char *query, *index = "*", *comment = "";
-	int query_len, index_len, comment_len, res;
+	php_sphinx_multi *m;
+	double timeout = -1;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|ss", &query, &query_len, &index, &index_len, &comment, &comment_len) == FAILURE) {
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|d", &timeout) == FAILURE) {
 		return;
 	}
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-
-	res = sphinx_add_query(c->sphinx, query, index, comment);
+	m = (php_sphinx_multi *)zend_object_store_get_object(getThis() TSRMLS_CC);
 
-	if (res < 0) {
+	if (!php_sphinx_multi_num_sent(m)) {
+		/* nothing to wait for */
 		RETURN_FALSE;
 	}
-	RETURN_LONG(res);
-}
 
+	array_init(return_value);
+	php_sphinx_multi_poll(m, timeout < 0 ? -1 : (int)(timeout * 1000), return_value TSRMLS_CC);
+}
 /* }}} */
 
-/* {{{ proto array SphinxClient::runQueries() */
-static PHP_METHOD(SphinxClient, runQueries)
+/* {{{ proto array SphinxMulti::run([float timeout]) */
+static PHP_METHOD(SphinxMulti, run)
 {
-	php_sphinx_client *c;
-	sphinx_result *results;
-	int i, num_results;
-	zval *single_result;
+	php_sphinx_multi *m;
+	double timeout = -1, deadline = 0;
+	int i, wait = -1;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|d", &timeout) == FAILURE) {
+		return;
+	}
 
-	results = sphinx_run_queries(c->sphinx);
+	m = (php_sphinx_multi *)zend_object_store_get_object(getThis() TSRMLS_CC);
 
-	if (!results) {
-		RETURN_FALSE;
+	if (timeout >= 0) {
+		deadline = php_sphinx_time() + timeout;
 	}
 
-	num_results = sphinx_get_num_results(c->sphinx);
+	php_sphinx_multi_send(m TSRMLS_CC);
 
 	array_init(return_value);
-	for (i = 0; i < num_results; i++) {
-		MAKE_STD_ZVAL(single_result);
-		php_sphinx_result_to_array(c, &results[i], &single_result TSRMLS_CC);
-		add_next_index_zval(return_value, single_result);
+	while (php_sphinx_multi_num_sent(m)) {
+		if (timeout >= 0) {
+			wait = (int)((deadline - php_sphinx_time()) * 1000);
+			if (wait <= 0) {
+				break;
+			}
+		}
+		php_sphinx_multi_poll(m, wait, return_value TSRMLS_CC);
+	}
+
+	/* the batches still running are reported as null and stay sent, 
+	 * so that select() or the next run() collects them */
+	for (i = 0; i < m->num_clients; i++) {
+		if (m->state[i] == PHP_SPHINX_MULTI_SENT) {
+			add_index_null(return_value, i);
+		}
 	}
 }
 /* }}} */
+/* }}} */
+#endif
 
-/* {{{ proto string SphinxClient::escapeString(string data) */
-static PHP_METHOD(SphinxClient, escapeString)
+/* {{{ SphinxResult */
+/* a deferred query runs once its result is needed */
+static php_sphinx_result_obj *php_sphinx_result_get(zval *object TSRMLS_DC) /* {{{ */
 {
-	char *str, *new_str, *source, *target;
-	int str_len, new_str_len, i;
+	php_sphinx_result_obj *r;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &str, &str_len) == FAILURE) {
-		return;
-	}
-	
-	if (!str_len) {
-		RETURN_EMPTY_STRING();
+	r = (php_sphinx_result_obj *)zend_object_store_get_object(object TSRMLS_CC);
+	if (r->client) {
+		php_sphinx_client_search(r->client, NULL, NULL, NULL TSRMLS_CC);
 	}
+	return r;
+}
+/* }}} */
 
-	new_str = safe_emalloc(2, str_len, 1);
-	target = new_str;
-	source = str;
-	for (i = 0; i < str_len; i++) {
-		switch (*source) {
-			case '(':
-			case ')':
-			case '|':
-			case '-':
-			case '!':
-			case '@':
-			case '~':
-			case '"':
-			case '&':
-			case '/':
-			case '\\':
-			case '^':
-			case '$':
-			case '=':
-			case '<':
-				*target++ = '\\';
-				*target++ = *source;
-				break;
-			default:
-				*target++ = *source;
-				break;
+#define SPHINX_RESULT_INITIALIZED(r) \
+		if (!(r) || !(r)->ref) { \
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "using uninitialized SphinxResult object"); \
+			RETURN_FALSE; \
 		}
-		source++;
+
+static int php_sphinx_result_offset_valid(php_sphinx_result_obj *r, long offset TSRMLS_DC) /* {{{ */
+{
+	if (offset < 0 || offset >= r->num_matches) {
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "undefined offset %ld", offset);
+		return 0;
 	}
-	*target = '\0';
+	return 1;
+}
+/* }}} */
 
-	new_str_len = target - new_str;
-	new_str = erealloc(new_str, new_str_len + 1);
-	RETURN_STRINGL(new_str, new_str_len, 0);
+/* {{{ proto int SphinxResult::count() */
+static PHP_METHOD(SphinxResult, count)
+{
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	RETURN_LONG(r->num_matches);
 }
 /* }}} */
 
-#if LIBSPHINX_VERSION_ID >= 99
-/* {{{ proto bool SphinxClient::open() */
-static PHP_METHOD(SphinxClient, open)
+/* {{{ proto void SphinxResult::rewind() */
+static PHP_METHOD(SphinxResult, rewind)
 {
-	php_sphinx_client *c;
-	int res;
+	php_sphinx_result_obj *r;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-	
-	res = sphinx_open(c->sphinx);
-	if (!res) {
-		RETURN_FALSE;
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	r->pos = 0;
+}
+/* }}} */
+
+/* {{{ proto bool SphinxResult::valid() */
+static PHP_METHOD(SphinxResult, valid)
+{
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	RETURN_BOOL(r->pos < r->num_matches);
+}
+/* }}} */
+
+/* {{{ proto array SphinxResult::current() */
+static PHP_METHOD(SphinxResult, current)
+{
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (r->pos >= r->num_matches) {
+		RETURN_NULL();
 	}
-	RETURN_TRUE;
+	php_sphinx_match_to_array(r->result, r->pos, r->array_result, r->attr_lens, r->attr_hashes, return_value);
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::close() */
-static PHP_METHOD(SphinxClient, close)
+/* {{{ proto int SphinxResult::key() */
+static PHP_METHOD(SphinxResult, key)
 {
-	php_sphinx_client *c;
-	int res;
+	php_sphinx_result_obj *r;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-	
-	res = sphinx_close(c->sphinx);
-	if (!res) {
-		RETURN_FALSE;
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (r->pos >= r->num_matches) {
+		RETURN_NULL();
 	}
-	RETURN_TRUE;
+	RETURN_LONG(r->pos);
+}
+/* }}} */
+
+/* {{{ proto void SphinxResult::next() */
+static PHP_METHOD(SphinxResult, next)
+{
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (r->pos < r->num_matches) {
+		r->pos++;
+	}
+}
+/* }}} */
+
+/* {{{ proto bool SphinxResult::offsetExists(int offset) */
+static PHP_METHOD(SphinxResult, offsetExists)
+{
+	php_sphinx_result_obj *r;
+	long offset;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &offset) == FAILURE) {
+		return;
+	}
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	RETURN_BOOL(offset >= 0 && offset < r->num_matches);
 }
 /* }}} */
 
-/* {{{ proto array SphinxClient::status() */
-static PHP_METHOD(SphinxClient, status)
+/* {{{ proto array SphinxResult::offsetGet(int offset) */
+static PHP_METHOD(SphinxResult, offsetGet)
 {
-	php_sphinx_client *c;
-	char **result;
-	int i, j, k, num_rows, num_cols;
-	zval *tmp;
+	php_sphinx_result_obj *r;
+	long offset;
 
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-	
-	result = sphinx_status(c->sphinx, &num_rows, &num_cols);
-	
-	if (!result || num_rows <= 0) {
-		RETURN_FALSE;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &offset) == FAILURE) {
+		return;
 	}
-	
-	k = 0;
-	array_init(return_value);
-	for (i = 0; i < num_rows; i++) {
-		MAKE_STD_ZVAL(tmp);
-		array_init(tmp);
-		
-		for (j = 0; j < num_cols; j++, k++) {
-			add_next_index_string(tmp, result[k], 1);
-		}
-		add_next_index_zval(return_value, tmp);
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (!php_sphinx_result_offset_valid(r, offset TSRMLS_CC)) {
+		RETURN_NULL();
 	}
-	sphinx_status_destroy(result, num_rows, num_cols);
+	php_sphinx_match_to_array(r->result, (int)offset, r->array_result, r->attr_lens, r->attr_hashes, return_value);
 }
 /* }}} */
 
-/* {{{ proto bool SphinxClient::setOverride(string attribute, int type, array values) */
-static PHP_METHOD(SphinxClient, setOverride)
+/* {{{ proto void SphinxResult::offsetSet(int offset, mixed value) */
+static PHP_METHOD(SphinxResult, offsetSet)
 {
-	php_sphinx_client *c;
-	zval *values, **attr_value;
-	char *attribute;
-	long type;
-	int attribute_len, values_num, i = 0;
-	int res;
-	sphinx_uint64_t *docids = NULL; 
-	unsigned int *vals = NULL;
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "SphinxResult is read-only");
+}
+/* }}} */
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sla", &attribute, &attribute_len, &type, &values) == FAILURE) {
+/* {{{ proto void SphinxResult::offsetUnset(int offset) */
+static PHP_METHOD(SphinxResult, offsetUnset)
+{
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "SphinxResult is read-only");
+}
+/* }}} */
+
+/* {{{ proto mixed SphinxResult::getId(int offset) */
+static PHP_METHOD(SphinxResult, getId)
+{
+	php_sphinx_result_obj *r;
+	long offset;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &offset) == FAILURE) {
 		return;
 	}
-	
-	c = (php_sphinx_client *)zend_object_store_get_object(getThis() TSRMLS_CC);
-	SPHINX_INITIALIZED(c)
-	
-	if (type != SPH_ATTR_INTEGER && type != SPH_ATTR_TIMESTAMP
-		&& type != SPH_ATTR_BOOL && type != SPH_ATTR_FLOAT) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "type must be scalar");
-		RETURN_FALSE;
-	}
-	
-	values_num = zend_hash_num_elements(Z_ARRVAL_P(values));
-	if (!values_num) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "empty values array passed");
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (!php_sphinx_result_offset_valid(r, offset TSRMLS_CC)) {
 		RETURN_FALSE;
 	}
-	
-	docids = emalloc(sizeof(sphinx_uint64_t) * values_num);
-	vals = safe_emalloc(values_num, sizeof(unsigned int), 0);
-	for (zend_hash_internal_pointer_reset(Z_ARRVAL_P(values));
-		 zend_hash_get_current_data(Z_ARRVAL_P(values), (void **) &attr_value) != FAILURE;
-		 zend_hash_move_forward(Z_ARRVAL_P(values))) 
+#if SIZEOF_LONG == 8
+	RETURN_LONG(sphinx_get_id(r->result, (int)offset));
+#else
 	{
-		char *str_id;
-		ulong id;
-		int key_type;
-		uint str_id_len;
-		double float_id = 0;
-		unsigned char id_type;
-
-		if (Z_TYPE_PP(attr_value) != IS_LONG) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "attribute value must be integer");
-			break;
-		}
+		char buf[128];
+		int buf_len;
 
-		key_type = zend_hash_get_current_key_ex(Z_ARRVAL_P(values), &str_id, &str_id_len, &id, 0, NULL);
+		buf_len = slprintf(buf, sizeof(buf), "%.0f", (double)sphinx_get_id(r->result, (int)offset));
+		RETURN_STRINGL(buf, buf_len, 1);
+	}
+#endif
+}
+/* }}} */
 
-		if (key_type == HASH_KEY_IS_LONG) {
-			/* ok */
-			id_type = IS_LONG;
-		} else if (key_type == HASH_KEY_IS_STRING) {
-			id_type = is_numeric_string(str_id, str_id_len, (long *)&id, &float_id, 0);
-			if (id_type == IS_LONG || id_type == IS_DOUBLE) {
-				/* ok */
-			} else {
-				php_error_docref(NULL TSRMLS_CC, E_WARNING, "document ID must be numeric");
-				break;
-			}
-		} else {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "document ID must be integer");
-			break;
-		}
-		vals[i] = (sphinx_uint64_t)Z_LVAL_PP(attr_value);
+/* {{{ proto int SphinxResult::getWeight(int offset) */
+static PHP_METHOD(SphinxResult, getWeight)
+{
+	php_sphinx_result_obj *r;
+	long offset;
 
-		if (id_type == IS_LONG) {
-			docids[i] = (sphinx_uint64_t)id;
-		} else { /* IS_FLOAT */
-			docids[i] = (sphinx_uint64_t)float_id;
-		}
-		i++;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &offset) == FAILURE) {
+		return;
 	}
 
-	if (i != values_num) {
-		RETVAL_FALSE;
-		goto cleanup;
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (!php_sphinx_result_offset_valid(r, offset TSRMLS_CC)) {
+		RETURN_FALSE;
 	}
-	
-	res = sphinx_add_override(c->sphinx, attribute, docids, values_num, vals); 
-	if (!res) {
-		RETVAL_FALSE;
-	} else {
-		RETVAL_TRUE;
+	RETURN_LONG(sphinx_get_weight(r->result, (int)offset));
+}
+/* }}} */
+
+/* {{{ proto mixed SphinxResult::getAttr(int offset, string name) */
+static PHP_METHOD(SphinxResult, getAttr)
+{
+	php_sphinx_result_obj *r;
+	long offset;
+	char *name;
+	int name_len, j;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ls", &offset, &name, &name_len) == FAILURE) {
+		return;
 	}
 
-cleanup:
-	if (docids) {
-		efree(docids);
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	if (!php_sphinx_result_offset_valid(r, offset TSRMLS_CC)) {
+		RETURN_FALSE;
 	}
-	if (vals) {
-		efree(vals);
+
+	for (j = 0; j < r->result->num_attrs; j++) {
+		if (r->attr_lens[j] == (uint)name_len + 1 && memcmp(r->result->attr_names[j], name, name_len) == 0) {
+			php_sphinx_attr_to_zval(r->result, (int)offset, j, return_value);
+			return;
+		}
 	}
+
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown attribute '%s'", name);
+	RETURN_FALSE;
 }
 /* }}} */
-#endif
 
-/* {{{ proto int SphinxClient::__sleep() */
-static PHP_METHOD(SphinxClient, __sleep)
+/* {{{ proto array SphinxResult::getMeta() */
+static PHP_METHOD(SphinxResult, getMeta)
 {
-	php_error_docref(NULL TSRMLS_CC, E_RECOVERABLE_ERROR, "SphinxClient instance cannot be (un)serialized");
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	SPHINX_RESULT_INITIALIZED(r)
+
+	php_sphinx_result_to_array(r->result, &return_value, r->array_result, PHP_SPHINX_RESULT_META TSRMLS_CC);
 }
 /* }}} */
 
-/* {{{ proto int SphinxClient::__wakeup() */
-static PHP_METHOD(SphinxClient, __wakeup)
+/* {{{ proto array SphinxResult::toArray() */
+static PHP_METHOD(SphinxResult, toArray)
 {
-	php_error_docref(NULL TSRMLS_CC, E_RECOVERABLE_ERROR, "SphinxClient instance cannot be (un)serialized");
+	php_sphinx_result_obj *r;
+
+	r = php_sphinx_result_get(getThis() TSRMLS_CC);
+	SPHINX_RESULT_INITIALIZED(r)
+
+	php_sphinx_result_to_array(r->result, &return_value, r->array_result, SPH_RESULT_ROWS TSRMLS_CC);
 }
 /* }}} */
+/* }}} */
 
 /* {{{ arginfo */
 ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setserver, 0, 0, 2)
@@ -1885,11 +8216,45 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setarrayresult, 0, 0, 1)
 	ZEND_ARG_INFO(0, array_result)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setresultformat, 0, 0, 1)
+	ZEND_ARG_INFO(0, format)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_prepare, 0, 0, 1)
+	ZEND_ARG_INFO(0, name)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_importconfig, 0, 0, 1)
+	ZEND_ARG_INFO(0, data)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setautobatch, 0, 0, 1)
+	ZEND_ARG_INFO(0, enable)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setfiltercompaction, 0, 0, 1)
+	ZEND_ARG_INFO(0, enable)
+	ZEND_ARG_INFO(0, scalar_attributes)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setcache, 0, 0, 1)
+	ZEND_ARG_INFO(0, ttl)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_updateattributes, 0, 0, 3)
 	ZEND_ARG_INFO(0, index)
 	ZEND_ARG_INFO(0, attributes)
 	ZEND_ARG_INFO(0, values)
 	ZEND_ARG_INFO(0, mva)
+	ZEND_ARG_INFO(1, failed)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_bulkupdateattributes, 0, 0, 3)
+	ZEND_ARG_INFO(0, index)
+	ZEND_ARG_INFO(0, attributes)
+	ZEND_ARG_INFO(0, values)
+	ZEND_ARG_INFO(0, options)
+	ZEND_ARG_INFO(1, stats)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_buildexcerpts, 0, 0, 3)
@@ -1911,12 +8276,71 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_query, 0, 0, 1)
 	ZEND_ARG_INFO(0, comment)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_queryeach, 0, 0, 2)
+	ZEND_ARG_INFO(0, query)
+	ZEND_ARG_INFO(0, callback)
+	ZEND_ARG_INFO(0, index)
+	ZEND_ARG_INFO(0, comment)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_queryids, 0, 0, 1)
+	ZEND_ARG_INFO(0, query)
+	ZEND_ARG_INFO(0, index)
+	ZEND_ARG_INFO(0, comment)
+	ZEND_ARG_INFO(0, weights)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_runqueriesids, 0, 0, 0)
+	ZEND_ARG_INFO(0, weights)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_sphinxclient__param_void, 0)
 ZEND_END_ARG_INFO()
 
+#if LIBSPHINX_VERSION_ID >= 99
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_open, 0, 0, 0)
+	ZEND_ARG_INFO(0, persistent)
+ZEND_END_ARG_INFO()
+#endif
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setservers, 0, 0, 1)
+	ZEND_ARG_INFO(0, servers)
+ZEND_END_ARG_INFO()
+
+#ifdef HAVE_SPHINX_THREADS
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_setreplicas, 0, 0, 1)
+	ZEND_ARG_INFO(0, servers)
+	ZEND_ARG_INFO(0, hedge_delay)
+ZEND_END_ARG_INFO()
+#endif
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxclient_escapestring, 0, 0, 1)
 	ZEND_ARG_INFO(0, data)
 ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxresult_offset, 0, 0, 1)
+	ZEND_ARG_INFO(0, offset)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxresult_offsetset, 0, 0, 2)
+	ZEND_ARG_INFO(0, offset)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxresult_getattr, 0, 0, 2)
+	ZEND_ARG_INFO(0, offset)
+	ZEND_ARG_INFO(0, name)
+ZEND_END_ARG_INFO()
+
+#ifdef HAVE_SPHINX_THREADS
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxmulti_add, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, client, SphinxClient, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_sphinxmulti_timeout, 0, 0, 0)
+	ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+#endif
 /* }}} */
 
 static zend_function_entry sphinx_client_methods[] = { /* {{{ */
@@ -1929,16 +8353,35 @@ static zend_function_entry sphinx_client_methods[] = { /* {{{ */
 #endif		
 	PHP_ME(SphinxClient, getLastError, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, getLastWarning, 		arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, getCacheStats, 		arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
 	PHP_ME(SphinxClient, escapeString, 			arginfo_sphinxclient_escapestring, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, exportConfig, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+#ifdef HAVE_SPHINX_THREADS
+	PHP_ME(SphinxClient, fetchResults, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, isReady, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+#endif
 #if LIBSPHINX_VERSION_ID >= 99
-	PHP_ME(SphinxClient, open, 					arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, open, 					arginfo_sphinxclient_open, ZEND_ACC_PUBLIC)
 #endif		
+	PHP_ME(SphinxClient, importConfig, 			arginfo_sphinxclient_importconfig, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, queryEach, 			arginfo_sphinxclient_queryeach, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, queryIds, 				arginfo_sphinxclient_queryids, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, prepare, 				arginfo_sphinxclient_prepare, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, query, 				arginfo_sphinxclient_query, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, resetFilters, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, resetGroupBy, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, runQueries, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, runQueriesIds, 		arginfo_sphinxclient_runqueriesids, ZEND_ACC_PUBLIC)
+#ifdef HAVE_SPHINX_THREADS
+	PHP_ME(SphinxClient, sendQueries, 			arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+#endif
 	PHP_ME(SphinxClient, setArrayResult, 		arginfo_sphinxclient_setarrayresult, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, setAutoBatch, 			arginfo_sphinxclient_setautobatch, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, setFilterCompaction, 	arginfo_sphinxclient_setfiltercompaction, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, setResultFormat, 		arginfo_sphinxclient_setresultformat, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, setCache, 				arginfo_sphinxclient_setcache, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, setConnectTimeout, 	arginfo_sphinxclient_setconnecttimeout, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, setDeadline, 			arginfo_sphinxclient_setconnecttimeout, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, setFieldWeights, 		arginfo_sphinxclient_setindexweights, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, setFilter, 			arginfo_sphinxclient_setfilter, ZEND_ACC_PUBLIC)
 #ifdef HAVE_SPHINX_ADD_FILTER_STRING
@@ -1962,29 +8405,118 @@ static zend_function_entry sphinx_client_methods[] = { /* {{{ */
 #endif	
 	PHP_ME(SphinxClient, setRankingMode, 		arginfo_sphinxclient_setrankingmode, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, setRetries, 			arginfo_sphinxclient_setretries, ZEND_ACC_PUBLIC)
+#ifdef HAVE_SPHINX_THREADS
+	PHP_ME(SphinxClient, setReplicas, 			arginfo_sphinxclient_setreplicas, ZEND_ACC_PUBLIC)
+#endif
 	PHP_ME(SphinxClient, setServer, 			arginfo_sphinxclient_setserver, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, setServers, 			arginfo_sphinxclient_setservers, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, setSortMode, 			arginfo_sphinxclient_setsortmode, ZEND_ACC_PUBLIC)
 #if LIBSPHINX_VERSION_ID >= 99
 	PHP_ME(SphinxClient, status, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)	
 #endif	
 	PHP_ME(SphinxClient, updateAttributes, 		arginfo_sphinxclient_updateattributes, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, bulkUpdateAttributes, 	arginfo_sphinxclient_bulkupdateattributes, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxClient, usePrepared, 			arginfo_sphinxclient_prepare, ZEND_ACC_PUBLIC)
 	PHP_ME(SphinxClient, __sleep,				NULL, ZEND_ACC_PUBLIC|ZEND_ACC_FINAL)
 	PHP_ME(SphinxClient, __wakeup,				NULL, ZEND_ACC_PUBLIC|ZEND_ACC_FINAL)
 	{NULL, NULL, NULL}
 };
 /* }}} */
 
+static zend_function_entry sphinx_result_methods[] = { /* {{{ */
+	PHP_ME(SphinxResult, count, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, current, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, getAttr, 				arginfo_sphinxresult_getattr, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, getId, 				arginfo_sphinxresult_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, getMeta, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, getWeight, 			arginfo_sphinxresult_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, key, 					arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, next, 					arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, offsetExists, 			arginfo_sphinxresult_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, offsetGet, 			arginfo_sphinxresult_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, offsetSet, 			arginfo_sphinxresult_offsetset, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, offsetUnset, 			arginfo_sphinxresult_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, rewind, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, toArray, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxResult, valid, 				arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	{NULL, NULL, NULL}
+};
+/* }}} */
+
+#ifdef HAVE_SPHINX_THREADS
+static zend_function_entry sphinx_multi_methods[] = { /* {{{ */
+	PHP_ME(SphinxMulti, add, 					arginfo_sphinxmulti_add, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxMulti, run, 					arginfo_sphinxmulti_timeout, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxMulti, select, 				arginfo_sphinxmulti_timeout, ZEND_ACC_PUBLIC)
+	PHP_ME(SphinxMulti, send, 					arginfo_sphinxclient__param_void, ZEND_ACC_PUBLIC)
+	{NULL, NULL, NULL}
+};
+/* }}} */
+#endif
+
+/* {{{ PHP_INI
+ */
+PHP_INI_BEGIN()
+	STD_PHP_INI_ENTRY("sphinx.pool_max_idle",		"4",	PHP_INI_ALL,	OnUpdateLong,	pool_max_idle,		zend_sphinx_globals,	sphinx_globals)
+	STD_PHP_INI_ENTRY("sphinx.pool_idle_timeout",	"60",	PHP_INI_ALL,	OnUpdateLong,	pool_idle_timeout,	zend_sphinx_globals,	sphinx_globals)
+	STD_PHP_INI_ENTRY("sphinx.pool_ping_interval",	"5",	PHP_INI_ALL,	OnUpdateLong,	pool_ping_interval,	zend_sphinx_globals,	sphinx_globals)
+	STD_PHP_INI_ENTRY("sphinx.cache_size",			"8M",	PHP_INI_ALL,	OnUpdateLong,	cache_size,			zend_sphinx_globals,	sphinx_globals)
+#ifdef HAVE_SPHINX_SHM
+	STD_PHP_INI_ENTRY("sphinx.shm_cache_size",		"0",	PHP_INI_SYSTEM,	OnUpdateLong,	shm_cache_size,		zend_sphinx_globals,	sphinx_globals)
+	STD_PHP_INI_ENTRY("sphinx.shm_cache_stale",		"0",	PHP_INI_ALL,	OnUpdateLong,	shm_cache_stale,	zend_sphinx_globals,	sphinx_globals)
+#endif
+PHP_INI_END()
+/* }}} */
+
+static void php_sphinx_template_dtor(void *data) /* {{{ */
+{
+	pefree(((php_sphinx_template *)data)->data, 1);
+}
+/* }}} */
+
+static void php_sphinx_init_globals(zend_sphinx_globals *sphinx_globals) /* {{{ */
+{
+	memset(sphinx_globals, 0, sizeof(zend_sphinx_globals));
+	zend_hash_init(&sphinx_globals->backends, 0, NULL, NULL, 1);
+	zend_hash_init(&sphinx_globals->cache, 0, NULL, php_sphinx_cache_entry_dtor, 1);
+	zend_hash_init(&sphinx_globals->templates, 0, NULL, php_sphinx_template_dtor, 1);
+}
+/* }}} */
+
+static void php_sphinx_shutdown_globals(zend_sphinx_globals *sphinx_globals) /* {{{ */
+{
+	zend_hash_destroy(&sphinx_globals->backends);
+	zend_hash_destroy(&sphinx_globals->cache);
+	zend_hash_destroy(&sphinx_globals->templates);
+}
+/* }}} */
+
 /* {{{ PHP_MINIT_FUNCTION
  */
 PHP_MINIT_FUNCTION(sphinx)
 {
 	zend_class_entry ce;
 
+	ZEND_INIT_MODULE_GLOBALS(sphinx, php_sphinx_init_globals, php_sphinx_shutdown_globals);
+	REGISTER_INI_ENTRIES();
+#ifdef HAVE_SPHINX_RESULT_LAYOUT
+	php_sphinx_results_cacheable = php_sphinx_cache_layout_check();
+#endif
+#ifdef HAVE_SPHINX_SHM
+	if (SPHINX_G(shm_cache_size) > 0) {
+		php_sphinx_shm_init((size_t)SPHINX_G(shm_cache_size) TSRMLS_CC);
+	}
+#endif
+
+#if LIBSPHINX_VERSION_ID >= 99
+	le_sphinx_pool = zend_register_list_destructors_ex(NULL, php_sphinx_pool_dtor, "sphinx persistent connections", module_number);
+#endif
+
 	memcpy(&cannot_be_cloned, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
 	cannot_be_cloned.clone_obj = NULL;
 
 	memcpy(&php_sphinx_client_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
-	php_sphinx_client_handlers.clone_obj = NULL;
+	php_sphinx_client_handlers.clone_obj = php_sphinx_client_clone;
 	php_sphinx_client_handlers.read_property = php_sphinx_client_read_property;
 	php_sphinx_client_handlers.get_properties = php_sphinx_client_get_properties;
 
@@ -1992,6 +8524,22 @@ PHP_MINIT_FUNCTION(sphinx)
 	ce_sphinx_client = zend_register_internal_class(&ce TSRMLS_CC);
 	ce_sphinx_client->create_object = php_sphinx_client_new;
 
+	memcpy(&php_sphinx_result_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	php_sphinx_result_handlers.clone_obj = NULL;
+	php_sphinx_result_handlers.count_elements = php_sphinx_result_count_elements;
+
+	INIT_CLASS_ENTRY(ce, "SphinxResult", sphinx_result_methods);
+	ce_sphinx_result = zend_register_internal_class(&ce TSRMLS_CC);
+	ce_sphinx_result->create_object = php_sphinx_result_new;
+	ce_sphinx_result->ce_flags |= ZEND_ACC_FINAL_CLASS;
+	zend_class_implements(ce_sphinx_result TSRMLS_CC, 3, zend_ce_iterator, zend_ce_arrayaccess, spl_ce_Countable);
+
+#ifdef HAVE_SPHINX_THREADS
+	INIT_CLASS_ENTRY(ce, "SphinxMulti", sphinx_multi_methods);
+	ce_sphinx_multi = zend_register_internal_class(&ce TSRMLS_CC);
+	ce_sphinx_multi->create_object = php_sphinx_multi_new;
+#endif
+
 	SPHINX_CONST(SEARCHD_OK);
 	SPHINX_CONST(SEARCHD_ERROR);
 	SPHINX_CONST(SEARCHD_RETRY);
@@ -2052,11 +8600,33 @@ PHP_MINIT_FUNCTION(sphinx)
 	SPHINX_CONST(SPH_GROUPBY_YEAR);
 	SPHINX_CONST(SPH_GROUPBY_ATTR);
 	SPHINX_CONST(SPH_GROUPBY_ATTRPAIR);
+
+	SPHINX_CONST(SPH_RESULT_ROWS);
+	SPHINX_CONST(SPH_RESULT_COLUMNAR);
+	SPHINX_CONST(SPH_RESULT_LAZY);
 	
 	return SUCCESS;
 }
 /* }}} */
 
+/* {{{ PHP_MSHUTDOWN_FUNCTION
+ */
+PHP_MSHUTDOWN_FUNCTION(sphinx)
+{
+#ifdef HAVE_SPHINX_THREADS
+	php_sphinx_jobs_reap(1);
+#endif
+#ifdef HAVE_SPHINX_SHM
+	php_sphinx_shm_shutdown();
+#endif
+	UNREGISTER_INI_ENTRIES();
+#ifndef ZTS
+	php_sphinx_shutdown_globals(&sphinx_globals);
+#endif
+	return SUCCESS;
+}
+/* }}} */
+
 /* {{{ PHP_MINFO_FUNCTION
  */
 PHP_MINFO_FUNCTION(sphinx)
@@ -2065,7 +8635,13 @@ PHP_MINFO_FUNCTION(sphinx)
 	php_info_print_table_header(2, "sphinx support", "enabled");
 	php_info_print_table_header(2, "Version", PHP_SPHINX_VERSION);
 	php_info_print_table_header(2, "Revision", "$Revision$");
+	php_info_print_table_row(2, "Results cache", php_sphinx_results_cacheable ? "enabled" : "disabled (unknown libsphinxclient result layout)");
+#ifdef HAVE_SPHINX_SHM
+	php_info_print_table_row(2, "Shared results cache", php_sphinx_shm_cache ? "enabled" : "disabled");
+#endif
 	php_info_print_table_end();
+
+	DISPLAY_INI_ENTRIES();
 }
 /* }}} */
 
@@ -2083,7 +8659,7 @@ zend_module_entry sphinx_module_entry = {
 	"sphinx",
 	sphinx_functions,
 	PHP_MINIT(sphinx),
-	NULL,
+	PHP_MSHUTDOWN(sphinx),
 	NULL,
 	NULL,
 	PHP_MINFO(sphinx),
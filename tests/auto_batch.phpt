@@ -0,0 +1,57 @@
+--TEST--
+SphinxClient::setAutoBatch() defers query() into one runQueries() round trip
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+var_dump($s->setAutoBatch(true));
+
+$a = $s->query("test", "test1");
+$b = $s->query("doc", "test1");
+var_dump(get_class($a), get_class($b));
+
+/* the deferred queries own the batch */
+var_dump($s->addQuery("test", "test1"));
+
+/* using any of the results runs them all */
+var_dump(count($b), count($a));
+echo $a->getId(2), " ", $b->getId(0), "\n";
+
+$meta = $a->getMeta();
+var_dump($meta["total_found"]);
+
+/* a new batch once the results are in */
+$c = $s->query("test", "test1");
+var_dump(count($c));
+
+/* the queries of addQuery() have to be run first */
+$s->setAutoBatch(false);
+$s->addQuery("test", "test1");
+$s->setAutoBatch(true);
+var_dump($s->query("doc", "test1"));
+$r = $s->runQueries();
+var_dump(count($r));
+
+echo "Done\n";
+?>
+--EXPECTF--
+bool(true)
+string(12) "SphinxResult"
+string(12) "SphinxResult"
+
+Warning: SphinxClient::addQuery(): cannot add a query while deferred queries are pending, use their results first in %s on line %d
+bool(false)
+int(2)
+int(3)
+4 3
+int(3)
+int(3)
+
+Warning: SphinxClient::query(): cannot defer the query, queries added by addQuery() have to be run first in %s on line %d
+bool(false)
+int(1)
+Done
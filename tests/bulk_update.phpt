@@ -0,0 +1,83 @@
+--TEST--
+SphinxClient::bulkUpdateAttributes() streams the updates in batches
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+class ThrowingIterator extends ArrayIterator
+{
+	function current()
+	{
+		if ($this->key() == 3) {
+			throw new Exception("no row 3");
+		}
+		return parent::current();
+	}
+}
+
+/* the values the index was built with */
+$rows = array(1 => array(5), 2 => array(6), 3 => array(7), 4 => array(8));
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+
+var_dump($s->bulkUpdateAttributes("test1", array(), new ArrayIterator($rows)));
+
+$stats = $s->bulkUpdateAttributes("test1", array("group_id2"), new ArrayIterator($rows), array("batch_size" => 1, "jobs" => 1));
+var_dump($stats["updated"], $stats["failed"], $stats["batches"], isset($stats["error"]));
+
+$stats = $s->bulkUpdateAttributes("test1", array("group_id2"), new ArrayIterator($rows), array("jobs" => 2));
+var_dump($stats["updated"], $stats["failed"]);
+
+/* the rows read before the bad one are sent */
+$bad = $rows;
+$bad[3] = array("seven");
+$stats = $s->bulkUpdateAttributes("test1", array("group_id2"), new ArrayIterator($bad), array("batch_size" => 1, "jobs" => 1));
+var_dump($stats["updated"], $stats["error"]);
+
+/* so are those read before an exception, which is passed on, the stats come by reference */
+$stats = null;
+try {
+	$s->bulkUpdateAttributes("test1", array("group_id2"), new ThrowingIterator($rows), array("batch_size" => 1, "jobs" => 1), $stats);
+} catch (Exception $e) {
+	echo get_class($e), ": ", $e->getMessage(), "\n";
+}
+var_dump($stats["updated"], $stats["batches"]);
+
+/* a huge batch size is capped */
+$stats = $s->bulkUpdateAttributes("test1", array("group_id2"), new ArrayIterator($rows), array("batch_size" => PHP_INT_MAX));
+var_dump($stats["updated"], $stats["batches"]);
+
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+$s->setArrayResult(true);
+$r = $s->query("", "test1");
+foreach ($r["matches"] as $match) {
+	echo $match["id"], " ", $match["attrs"]["group_id2"], "\n";
+}
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::bulkUpdateAttributes(): empty attributes array passed in %s on line %d
+bool(false)
+int(4)
+int(0)
+int(4)
+bool(false)
+int(4)
+int(0)
+
+Warning: SphinxClient::bulkUpdateAttributes(): attribute value must be integer in %s on line %d
+int(2)
+string(31) "attribute value must be integer"
+Exception: no row 3
+int(2)
+int(2)
+int(4)
+int(1)
+1 5
+2 6
+3 7
+4 8
+Done
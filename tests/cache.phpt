@@ -0,0 +1,68 @@
+--TEST--
+SphinxClient::setCache() keeps search results in the per-worker cache
+--SKIPIF--
+<?php
+require_once dirname(__FILE__) . "/skipif.inc";
+ob_start();
+phpinfo(INFO_MODULES);
+if (strpos(ob_get_clean(), "Results cache => enabled") === false) die("skip results cache is disabled");
+?>
+--INI--
+sphinx.cache_size=1M
+sphinx.shm_cache_size=0
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+var_dump($s->setCache(-1));
+var_dump(SphinxClient::getCacheStats());
+
+var_dump($s->setCache(60));
+$r1 = $s->query("test", "test1");
+$r2 = $s->query("test", "test1");
+var_dump($r1 == $r2, $r2["total_found"]);
+
+/* other settings are another entry */
+$s->setLimits(0, 1);
+$r3 = $s->query("test", "test1");
+var_dump(count($r3["matches"]));
+
+$stats = SphinxClient::getCacheStats();
+var_dump($stats["hits"], $stats["misses"], $stats["entries"], $stats["bytes"] > 0);
+
+/* the cache is off by default */
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->query("test", "test1");
+$stats = SphinxClient::getCacheStats();
+var_dump($stats["hits"], $stats["misses"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::setCache(): cache ttl cannot be negative in %s on line %d
+bool(false)
+array(5) {
+  ["hits"]=>
+  int(0)
+  ["misses"]=>
+  int(0)
+  ["evictions"]=>
+  int(0)
+  ["entries"]=>
+  int(0)
+  ["bytes"]=>
+  int(0)
+}
+bool(true)
+bool(true)
+int(3)
+int(1)
+int(1)
+int(2)
+int(2)
+bool(true)
+int(1)
+int(2)
+Done
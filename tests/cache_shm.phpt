@@ -0,0 +1,63 @@
+--TEST--
+sphinx.shm_cache_size shares the results cache between the workers
+--SKIPIF--
+<?php
+require_once dirname(__FILE__) . "/skipif.inc";
+ob_start();
+phpinfo(INFO_MODULES);
+$info = ob_get_clean();
+if (strpos($info, "Results cache => enabled") === false) die("skip results cache is disabled");
+if (strpos($info, "Shared results cache") === false) die("skip needs shared memory support");
+?>
+--INI--
+sphinx.shm_cache_size=4M
+sphinx.shm_cache_stale=0
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setCache(60);
+
+$before = SphinxClient::getCacheStats();
+var_dump(array_keys($before));
+
+$s->query("test", "test1");
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+$stats = SphinxClient::getCacheStats();
+var_dump($stats["hits"] - $before["hits"], $stats["misses"] - $before["misses"], $stats["entries"] > 0);
+
+/* updating the index drops its entries */
+var_dump($s->updateAttributes("test1", array("group_id2"), array(1 => array(5))));
+$s->query("test", "test1");
+
+$after = SphinxClient::getCacheStats();
+var_dump($after["hits"] - $stats["hits"], $after["misses"] - $stats["misses"]);
+
+echo "Done\n";
+?>
+--EXPECT--
+array(6) {
+  [0]=>
+  string(4) "hits"
+  [1]=>
+  string(6) "misses"
+  [2]=>
+  string(10) "stale_hits"
+  [3]=>
+  string(9) "evictions"
+  [4]=>
+  string(7) "entries"
+  [5]=>
+  string(5) "bytes"
+}
+int(3)
+int(1)
+int(1)
+bool(true)
+int(1)
+int(0)
+int(1)
+Done
@@ -0,0 +1,50 @@
+--TEST--
+Cloned SphinxClient objects keep the settings, not the queued queries
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setArrayResult(true);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+$s->setFilter("group_id", array(1));
+
+$c = clone $s;
+$r = $c->query("test", "test1");
+var_dump($r["total_found"]);
+echo $r["matches"][0]["id"], "\n";
+
+$c->resetFilters();
+$r = $c->query("test", "test1");
+var_dump($r["total_found"]);
+
+/* the original one is not affected */
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+/* queued queries stay with the original */
+$s->addQuery("doc", "test1");
+$c = clone $s;
+$c->addQuery("test", "test1");
+$r = $c->runQueries();
+var_dump(count($r));
+$r = $s->runQueries();
+var_dump(count($r));
+
+unset($s);
+$r = $c->query("test", "test1");
+var_dump($r["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECT--
+int(2)
+1
+int(3)
+int(2)
+int(1)
+int(1)
+int(2)
+Done
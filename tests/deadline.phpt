@@ -0,0 +1,36 @@
+--TEST--
+SphinxClient::setDeadline() bounds a whole call
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+var_dump($s->setDeadline(-1));
+
+var_dump($s->setDeadline(5));
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+/* the failover stays within the deadline as well */
+$s->setServers(array("localhost:1", "localhost:9312"));
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+/* 0 turns it off */
+var_dump($s->setDeadline(0));
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::setDeadline(): deadline cannot be negative in %s on line %d
+bool(false)
+bool(true)
+int(3)
+int(3)
+bool(true)
+int(3)
+Done
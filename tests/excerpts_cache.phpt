@@ -0,0 +1,43 @@
+--TEST--
+SphinxClient::buildExcerpts() caches the excerpts per document
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--INI--
+sphinx.cache_size=1M
+sphinx.shm_cache_size=0
+--FILE--
+<?php
+
+$docs = array("this is my test document number one", "this is another group", "this is to test groups");
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setCache(60);
+
+$before = SphinxClient::getCacheStats();
+$e1 = $s->buildExcerpts($docs, "test1", "test");
+var_dump(count($e1), strpos($e1[0], "<b>test</b>") !== false);
+
+/* one of the documents is new, only that one is sent */
+$docs[1] = "doc number four";
+$e2 = $s->buildExcerpts($docs, "test1", "test");
+var_dump($e2[0] === $e1[0], $e2[2] === $e1[2]);
+
+$stats = SphinxClient::getCacheStats();
+var_dump($stats["hits"] - $before["hits"], $stats["misses"] - $before["misses"]);
+
+/* other options are other entries */
+$e3 = $s->buildExcerpts($docs, "test1", "test", array("before_match" => "[", "after_match" => "]"));
+var_dump(strpos($e3[0], "[test]") !== false);
+
+echo "Done\n";
+?>
+--EXPECT--
+int(3)
+bool(true)
+bool(true)
+bool(true)
+int(2)
+int(4)
+bool(true)
+Done
@@ -0,0 +1,36 @@
+--TEST--
+SphinxClient::buildExcerpts() splits the documents into chunks built in parallel
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$docs = array();
+for ($i = 0; $i < 25; $i++) {
+	$docs[] = "document $i is the test document number $i";
+}
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+
+$serial = $s->buildExcerpts($docs, "test1", "test", array("chunk_size" => 0));
+var_dump(count($serial));
+
+$parallel = $s->buildExcerpts($docs, "test1", "test", array("chunk_size" => 4, "jobs" => 3));
+var_dump(count($parallel), $parallel === $serial);
+
+/* more jobs than chunks */
+$parallel = $s->buildExcerpts(array_slice($docs, 0, 3), "test1", "test", array("chunk_size" => 1, "jobs" => 8));
+var_dump($parallel === array_slice($serial, 0, 3));
+
+var_dump(strpos($parallel[2], "<b>test</b>") !== false);
+
+echo "Done\n";
+?>
+--EXPECT--
+int(25)
+int(25)
+bool(true)
+bool(true)
+bool(true)
+Done
@@ -0,0 +1,69 @@
+--TEST--
+SphinxClient::exportConfig() and importConfig() move the settings between requests
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setArrayResult(true);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+$s->setFilter("group_id", array(1));
+$s->addQuery("not exported", "test1");
+
+$data = $s->exportConfig();
+var_dump(is_string($data));
+
+$s2 = new SphinxClient();
+var_dump($s2->importConfig("junk"));
+var_dump($s2->importConfig(substr($data, 0, -1) . chr(ord(substr($data, -1)) ^ 1)));
+
+/* forged data with a matching checksum */
+function forge($data, $offset, $bytes) {
+	$body = substr_replace(substr($data, 16), $bytes, $offset, strlen($bytes));
+	return substr($data, 0, 12) . pack("V", crc32($body)) . $body;
+}
+var_dump($s2->importConfig(forge($data, 8, pack("V", 7)))); /* result format */
+var_dump($s2->importConfig(forge($data, 32, "\xff\xff\xff\x7f"))); /* servers count */
+var_dump($s2->importConfig(forge($data, 76, str_repeat("\xff", 8)))); /* NULL host */
+$body = substr($data, 16, 20); /* truncated */
+var_dump($s2->importConfig(substr($data, 0, 12) . pack("V", crc32($body)) . $body));
+
+var_dump($s2->importConfig($data));
+
+$r = $s2->query("test", "test1");
+var_dump($r["total_found"]);
+echo $r["matches"][0]["id"], "\n";
+
+/* the queued query stayed behind */
+$s2->addQuery("doc", "test1");
+var_dump(count($s2->runQueries()));
+
+echo "Done\n";
+?>
+--EXPECTF--
+bool(true)
+
+Warning: SphinxClient::importConfig(): invalid configuration data in %s on line %d
+bool(false)
+
+Warning: SphinxClient::importConfig(): corrupted configuration data in %s on line %d
+bool(false)
+
+Warning: SphinxClient::importConfig(): corrupted configuration data in %s on line %d
+bool(false)
+
+Warning: SphinxClient::importConfig(): corrupted configuration data in %s on line %d
+bool(false)
+
+Warning: SphinxClient::importConfig(): corrupted configuration data in %s on line %d
+bool(false)
+
+Warning: SphinxClient::importConfig(): corrupted configuration data in %s on line %d
+bool(false)
+bool(true)
+int(2)
+1
+int(1)
+Done
@@ -0,0 +1,54 @@
+--TEST--
+SphinxClient::setFilterCompaction() sorts, deduplicates and range-ifies filter values
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+function ids($s, $attr, $values, $exclude = false)
+{
+	$s->resetFilters();
+	$s->setFilter($attr, $values, $exclude);
+	$r = $s->query("", "test1");
+	/* the ids are strings on 32-bit builds */
+	return isset($r["matches"]) ? implode(",", array_keys($r["matches"])) : "";
+}
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+
+$plain = array(
+	ids($s, "group_id2", array(8, 5, 5, 6)),
+	ids($s, "group_id2", array(6, 7, 8, 7), true),
+	ids($s, "mva", array(7, 3, 4, 5, 6)),
+	ids($s, "@id", array(-1, 2, 1)), /* -1 is the largest id */
+	ids($s, "@id", array(4, 2, 3)),
+);
+
+var_dump($s->setFilterCompaction(true, array("group_id2")));
+
+/* a range for the scalar attribute, a sorted unique list for the MVA one */
+$compact = array(
+	ids($s, "group_id2", array(8, 5, 5, 6)),
+	ids($s, "group_id2", array(6, 7, 8, 7), true),
+	ids($s, "mva", array(7, 3, 4, 5, 6)),
+	ids($s, "@id", array(-1, 2, 1)), /* -1 is the largest id */
+	ids($s, "@id", array(4, 2, 3)),
+);
+var_dump($compact === $plain);
+echo $compact[0], "\n", $compact[1], "\n", $compact[3], "\n", $compact[4], "\n";
+
+var_dump($s->setFilterCompaction(false));
+
+echo "Done\n";
+?>
+--EXPECT--
+bool(true)
+bool(true)
+1,2,4
+1
+1,2
+2,3,4
+bool(true)
+Done
@@ -0,0 +1,45 @@
+--TEST--
+SphinxClient::setFilter() takes the values packed with pack('P*')
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; if (version_compare(PHP_VERSION, "5.6.3", "<")) die("skip pack('P') needs PHP 5.6.3"); ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+$s->setArrayResult(true);
+
+var_dump($s->setFilter("group_id2", "1234567"));
+var_dump($s->setFilter("group_id2", 5));
+var_dump($s->setFilter("group_id2", ""));
+
+var_dump($s->setFilter("group_id2", pack("P*", 8, 5)));
+$r = $s->query("", "test1");
+foreach ($r["matches"] as $match) {
+	echo $match["id"], "\n";
+}
+
+/* the same as the array */
+$s->resetFilters();
+$s->setFilter("group_id2", pack("P*", 6, 7), true);
+$packed = $s->query("", "test1");
+$s->resetFilters();
+$s->setFilter("group_id2", array(6, 7), true);
+$r = $s->query("", "test1");
+var_dump($packed["matches"] == $r["matches"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::setFilter(): packed values must be a multiple of 8 bytes long in %s on line %d
+bool(false)
+
+Warning: SphinxClient::setFilter(): values must be an array or a packed string in %s on line %d
+bool(false)
+bool(false)
+bool(true)
+1
+4
+bool(true)
+Done
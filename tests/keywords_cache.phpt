@@ -0,0 +1,47 @@
+--TEST--
+SphinxClient::buildKeywords() results are cached
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--INI--
+sphinx.cache_size=1M
+sphinx.shm_cache_size=0
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setCache(60);
+
+$before = SphinxClient::getCacheStats();
+$k1 = $s->buildKeywords("test document", "test1", false);
+$k2 = $s->buildKeywords("test document", "test1", false);
+var_dump(count($k2), $k1 == $k2, $k2[0]["tokenized"]);
+
+/* the statistics come from the index and are another entry */
+$k3 = $s->buildKeywords("test document", "test1", true);
+var_dump($k3[0]["docs"], $k3[0]["hits"]);
+
+$stats = SphinxClient::getCacheStats();
+var_dump($stats["hits"] - $before["hits"], $stats["misses"] - $before["misses"]);
+
+/* updating the index drops the entry with the statistics only */
+$s->updateAttributes("test1", array("group_id2"), array(1 => array(5)));
+$s->buildKeywords("test document", "test1", false);
+$s->buildKeywords("test document", "test1", true);
+
+$after = SphinxClient::getCacheStats();
+var_dump($after["hits"] - $stats["hits"], $after["misses"] - $stats["misses"]);
+
+echo "Done\n";
+?>
+--EXPECT--
+int(2)
+bool(true)
+string(4) "test"
+int(3)
+int(5)
+int(1)
+int(2)
+int(1)
+int(1)
+Done
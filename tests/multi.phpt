@@ -0,0 +1,57 @@
+--TEST--
+SphinxMulti runs the batches of several clients concurrently
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; if (!class_exists("SphinxMulti")) die("skip needs thread support"); ?>
+--FILE--
+<?php
+
+$a = new SphinxClient();
+$a->setServer("localhost", 9312);
+$a->addQuery("test", "test1");
+
+$b = new SphinxClient();
+$b->setServer("localhost", 9312);
+$b->addQuery("doc", "test1");
+$b->addQuery("test", "test1");
+
+$m = new SphinxMulti();
+var_dump($m->add($a));
+var_dump($m->add($b));
+var_dump($m->add($a));
+var_dump($m->select());
+
+$r = $m->run();
+ksort($r);
+var_dump(array_keys($r));
+var_dump(count($r[0]), $r[0][0]["total_found"]);
+var_dump(count($r[1]), $r[1][0]["total_found"], $r[1][1]["total_found"]);
+
+/* a client can be reused once its batch has been collected */
+$a->addQuery("doc", "test1");
+$b->addQuery("doc", "test1");
+$r = $m->run(10);
+var_dump(count($r), $r[0][0]["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+int(0)
+int(1)
+
+Warning: SphinxMulti::add(): the client has been added already in %s on line %d
+bool(false)
+bool(false)
+array(2) {
+  [0]=>
+  int(0)
+  [1]=>
+  int(1)
+}
+int(1)
+int(3)
+int(2)
+int(2)
+int(3)
+int(2)
+int(2)
+Done
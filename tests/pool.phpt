@@ -0,0 +1,37 @@
+--TEST--
+SphinxClient::open(true) takes the connection from the per-worker pool
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; if (!method_exists("SphinxClient", "open")) die("skip open() needs libsphinxclient 0.9.9"); ?>
+--INI--
+sphinx.pool_max_idle=2
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+var_dump($s->open(true));
+var_dump($s->open(true));
+
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+unset($s);
+
+/* the connection went back to the pool and is reused */
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+var_dump($s->open(true));
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+var_dump($s->close());
+
+var_dump(ini_get("sphinx.pool_max_idle"));
+
+?>
+--EXPECT--
+bool(true)
+bool(true)
+int(3)
+bool(true)
+int(3)
+bool(true)
+string(1) "2"
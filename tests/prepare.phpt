@@ -0,0 +1,46 @@
+--TEST--
+SphinxClient::prepare() and usePrepared() share settings between clients
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id DESC");
+$s->setLimits(0, 1);
+$s->setFilter("group_id", array(1));
+var_dump($s->prepare("first_of_group1"));
+
+/* the server is not a part of the template */
+$s2 = new SphinxClient();
+$s2->setServer("localhost", 9312);
+var_dump($s2->usePrepared("no_such_template"));
+var_dump($s2->usePrepared("first_of_group1"));
+
+$r = $s2->query("test", "test1");
+var_dump($r["total_found"]);
+echo implode(",", array_keys($r["matches"])), "\n";
+
+/* the settings of the client are replaced */
+$s2->resetFilters();
+$r = $s2->query("test", "test1");
+var_dump($r["total_found"]);
+var_dump($s2->usePrepared("first_of_group1"));
+$r = $s2->query("test", "test1");
+var_dump($r["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+bool(true)
+
+Warning: SphinxClient::usePrepared(): no prepared settings named 'no_such_template' in %s on line %d
+bool(false)
+bool(true)
+int(2)
+2
+int(3)
+bool(true)
+int(2)
+Done
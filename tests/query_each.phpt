@@ -0,0 +1,44 @@
+--TEST--
+SphinxClient::queryEach() passes the matches to a callback one by one
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+
+var_dump($s->queryEach("test", function ($match) {
+	echo $match["id"], " ", $match["attrs"]["group_id2"], "\n";
+}, "test1"));
+
+/* returning false stops the iteration */
+var_dump($s->queryEach("test", function ($match) {
+	return false;
+}, "test1"));
+
+/* the callback may run other queries on the same client */
+var_dump($s->queryEach("test", function ($match) use ($s) {
+	$r = $s->query("doc", "test1");
+	echo $match["id"], " ", $r["total_found"], "\n";
+}, "test1"));
+
+var_dump($s->queryEach("test", "no_such_function", "test1"));
+
+echo "Done\n";
+?>
+--EXPECTF--
+1 5
+2 6
+4 8
+int(3)
+int(1)
+1 2
+2 2
+4 2
+int(3)
+
+Warning: SphinxClient::queryEach() expects parameter 2 to be a valid callback, %s in %s on line %d
+NULL
+Done
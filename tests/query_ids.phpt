@@ -0,0 +1,33 @@
+--TEST--
+SphinxClient::queryIds() and runQueriesIds() return only the document ids
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+
+/* the ids are strings on 32-bit builds */
+echo implode(",", $s->queryIds("test", "test1")), "\n";
+
+$ids = $s->queryIds("test", "test1", "", true);
+echo implode(",", array_keys($ids)), "\n";
+var_dump(min($ids) > 0);
+
+$s->addQuery("test", "test1");
+$s->addQuery("doc", "test1");
+foreach ($s->runQueriesIds() as $ids) {
+	echo implode(",", $ids), "\n";
+}
+
+echo "Done\n";
+?>
+--EXPECT--
+1,2,4
+1,2,4
+bool(true)
+1,2,4
+3,4
+Done
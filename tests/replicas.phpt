@@ -0,0 +1,43 @@
+--TEST--
+SphinxClient::setReplicas() hedges query() and runQueries()
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; if (!method_exists("SphinxClient", "setReplicas")) die("skip needs thread support"); ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+var_dump($s->setReplicas(array()));
+var_dump($s->setReplicas(array("localhost:0")));
+
+/* the hedge is sent right away, whichever answers first wins */
+var_dump($s->setReplicas(array("localhost:9312", "127.0.0.1:9312"), 0));
+
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+$s->addQuery("test", "test1");
+$s->addQuery("doc", "test1");
+$r = $s->runQueries();
+var_dump(count($r), $r[0]["total_found"], $r[1]["total_found"]);
+
+/* the tracked latency picks the delay */
+var_dump($s->setReplicas(array("localhost:9312", "127.0.0.1:9312")));
+$r = $s->query("test", "test1");
+var_dump($r["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::setReplicas(): servers list is empty in %s on line %d
+bool(false)
+
+Warning: SphinxClient::setReplicas(): invalid port in server 'localhost:0', expected 1-65535 in %s on line %d
+bool(false)
+bool(true)
+int(3)
+int(2)
+int(3)
+int(2)
+bool(true)
+int(3)
+Done
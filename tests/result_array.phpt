@@ -0,0 +1,45 @@
+--TEST--
+SphinxClient::query() result arrays in both setArrayResult() modes
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+
+$r = $s->query("test", "test1");
+/* the ids are strings on 32-bit builds */
+echo implode(",", array_keys($r["matches"])), "\n";
+foreach ($r["matches"] as $id => $match) {
+	var_dump($match["weight"] > 0, $match["attrs"]["group_id"], $match["attrs"]["group_id2"]);
+}
+
+$s->setArrayResult(true);
+$r = $s->query("test", "test1");
+foreach ($r["matches"] as $match) {
+	echo $match["id"], "\n";
+	var_dump($match["attrs"]["group_id"]);
+}
+
+echo "Done\n";
+?>
+--EXPECT--
+1,2,4
+bool(true)
+int(1)
+int(5)
+bool(true)
+int(1)
+int(6)
+bool(true)
+int(2)
+int(8)
+1
+int(1)
+2
+int(1)
+4
+int(2)
+Done
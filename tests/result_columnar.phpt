@@ -0,0 +1,47 @@
+--TEST--
+SphinxClient::setResultFormat(SPH_RESULT_COLUMNAR) returns one list per attribute
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+var_dump($s->setResultFormat(42));
+var_dump($s->setResultFormat(SPH_RESULT_COLUMNAR));
+
+$r = $s->query("test", "test1");
+var_dump(isset($r["matches"]));
+echo implode(",", $r["ids"]), "\n";
+var_dump(count($r["weights"]));
+var_dump($r["columns"]["group_id"], $r["columns"]["group_id2"]);
+var_dump($r["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::setResultFormat(): unknown result format 42 in %s on line %d
+bool(false)
+bool(true)
+bool(false)
+1,2,4
+int(3)
+array(3) {
+  [0]=>
+  int(1)
+  [1]=>
+  int(1)
+  [2]=>
+  int(2)
+}
+array(3) {
+  [0]=>
+  int(5)
+  [1]=>
+  int(6)
+  [2]=>
+  int(8)
+}
+int(3)
+Done
@@ -0,0 +1,75 @@
+--TEST--
+SphinxClient::setResultFormat(SPH_RESULT_LAZY) returns SphinxResult objects
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+$s->setSortMode(SPH_SORT_EXTENDED, "@id ASC");
+$s->setArrayResult(true);
+var_dump($s->setResultFormat(SPH_RESULT_LAZY));
+
+$r = $s->query("test", "test1");
+var_dump(get_class($r), count($r));
+
+$meta = $r->getMeta();
+var_dump($meta["total_found"], isset($meta["matches"]));
+
+/* the ids are strings on 32-bit builds */
+echo $r->getId(2), "\n";
+var_dump($r->getWeight(2) > 0, $r->getAttr(2, "group_id2"));
+var_dump($r->getAttr(0, "nosuchattr"));
+var_dump($r->getId(10));
+
+var_dump(isset($r[1]), isset($r[3]));
+echo $r[1]["id"], "\n";
+var_dump($r[1]["attrs"]["group_id"]);
+$r[1] = 1;
+unset($r[1]);
+
+foreach ($r as $i => $match) {
+	echo $i, " ", $match["id"], "\n";
+}
+
+$a = $r->toArray();
+var_dump(count($a["matches"]));
+
+/* the result outlives the next query */
+$r2 = $s->query("doc", "test1");
+var_dump(count($r2));
+echo $r->getId(0), "\n";
+
+echo "Done\n";
+?>
+--EXPECTF--
+bool(true)
+string(12) "SphinxResult"
+int(3)
+int(3)
+bool(false)
+4
+bool(true)
+int(8)
+
+Warning: SphinxResult::getAttr(): unknown attribute 'nosuchattr' in %s on line %d
+bool(false)
+
+Notice: SphinxResult::getId(): undefined offset 10 in %s on line %d
+bool(false)
+bool(true)
+bool(false)
+2
+int(1)
+
+Warning: SphinxResult::offsetSet(): SphinxResult is read-only in %s on line %d
+
+Warning: SphinxResult::offsetUnset(): SphinxResult is read-only in %s on line %d
+0 1
+1 2
+2 4
+int(3)
+int(2)
+1
+Done
@@ -0,0 +1,44 @@
+--TEST--
+SphinxClient::sendQueries() runs the batch in the background
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; if (!method_exists("SphinxClient", "sendQueries")) die("skip needs thread support"); ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+
+var_dump($s->isReady());
+var_dump($s->fetchResults());
+
+$s->addQuery("test", "test1");
+$s->addQuery("doc", "test1");
+var_dump($s->sendQueries());
+
+while (!$s->isReady()) {
+	usleep(1000);
+}
+
+$r = $s->fetchResults();
+var_dump(count($r));
+var_dump($r[0]["total_found"]);
+var_dump($r[1]["total_found"]);
+
+/* a client dropped with its batch still running */
+$s->addQuery("test", "test1");
+var_dump($s->sendQueries());
+unset($s);
+
+echo "Done\n";
+?>
+--EXPECTF--
+bool(true)
+
+Warning: SphinxClient::fetchResults(): no queries have been sent, issue sendQueries() first in %s on line %d
+bool(false)
+bool(true)
+int(2)
+int(3)
+int(2)
+bool(true)
+Done
@@ -0,0 +1,49 @@
+--TEST--
+SphinxClient::setServers() picks a backend and fails over to the next one
+--SKIPIF--
+<?php require_once dirname(__FILE__) . "/skipif.inc"; ?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+var_dump($s->setServers(array()));
+var_dump($s->setServers(array("localhost:70000")));
+var_dump($s->setServers(array("localhost:93a12")));
+var_dump($s->setServers(array("localhost:9312" => 0)));
+
+/* nothing listens on port 1, the queries fail over to the live server */
+var_dump($s->setServers(array("localhost:1" => 1, "localhost:9312" => 10)));
+for ($i = 0; $i < 3; $i++) {
+	$r = $s->query("test", "test1");
+	var_dump($r["total_found"]);
+}
+
+var_dump($s->setServers(array("localhost:9312", "127.0.0.1:9312")));
+$s->addQuery("test", "test1");
+$s->addQuery("doc", "test1");
+$r = $s->runQueries();
+var_dump(count($r), $r[0]["total_found"], $r[1]["total_found"]);
+
+echo "Done\n";
+?>
+--EXPECTF--
+Warning: SphinxClient::setServers(): servers list is empty in %s on line %d
+bool(false)
+
+Warning: SphinxClient::setServers(): invalid port in server 'localhost:70000', expected 1-65535 in %s on line %d
+bool(false)
+
+Warning: SphinxClient::setServers(): invalid port in server 'localhost:93a12', expected 1-65535 in %s on line %d
+bool(false)
+
+Warning: SphinxClient::setServers(): server must be a non-empty string with a positive weight in %s on line %d
+bool(false)
+bool(true)
+int(3)
+int(3)
+int(3)
+bool(true)
+int(2)
+int(3)
+int(2)
+Done
@@ -0,0 +1,55 @@
+--TEST--
+SphinxClient::updateAttributes() updates MVA attributes and reports the failed documents
+--SKIPIF--
+<?php
+require_once dirname(__FILE__) . "/skipif.inc";
+$s = new SphinxClient();
+$s->setServer("localhost", 1);
+@$s->updateAttributes("test1", array("mva"), array(1 => array(array(1))), true);
+$e = error_get_last();
+if (strpos($e["message"], "not supported") !== false) die("skip needs libsphinxclient 1.10");
+?>
+--FILE--
+<?php
+
+$s = new SphinxClient();
+$s->setServer("localhost", 9312);
+
+/* the values the index was built with */
+$failed = null;
+var_dump($s->updateAttributes("test1", array("mva"), array(1 => array(array(1, 3, 5, 7)), 2 => array(array(2, 4, 6))), true, $failed));
+var_dump($failed);
+
+$s->setFilter("mva", array(6));
+$r = $s->query("", "test1");
+/* the ids are strings on 32-bit builds */
+echo implode(",", array_keys($r["matches"])), "\n";
+$s->resetFilters();
+
+/* searchd refuses every document, all of them are reported */
+var_dump($s->updateAttributes("test1", array("no_such_attr"), array(1 => array(array(1)), 2 => array(array(2))), true, $failed));
+echo implode(",", $failed), "\n";
+
+/* without a connection the rest is not sent */
+$s->setServer("localhost", 1);
+var_dump($s->updateAttributes("test1", array("mva"), array(1 => array(array(1, 3, 5, 7)), 2 => array(array(2, 4, 6))), true, $failed));
+
+echo "Done\n";
+?>
+--EXPECTF--
+int(2)
+array(0) {
+}
+2
+
+Warning: SphinxClient::updateAttributes(): failed to update document 1: %s in %s on line %d
+
+Warning: SphinxClient::updateAttributes(): failed to update 2 documents in %s on line %d
+int(0)
+1,2
+
+Warning: SphinxClient::updateAttributes(): failed to update document 1: %s in %s on line %d
+
+Warning: SphinxClient::updateAttributes(): connection lost after updating 0 documents, the rest were not sent in %s on line %d
+bool(false)
+Done